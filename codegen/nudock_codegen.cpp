@@ -0,0 +1,450 @@
+/**
+ * @file nudock_codegen.cpp
+ *
+ * @brief Generates C++ types for the endpoints described by NuDock schema files.
+ *
+ * Usage: nudock_codegen <output header> <schema files...>
+ *
+ * For every "<name>.schema.json", the header gets:
+ *  - <Name>Request and <Name>Response: structs for json objects with
+ *    properties (optional properties as std::optional), or aliases of the
+ *    matching C++ type (double, std::string, std::vector, std::map, or
+ *    nlohmann::json for anything that can't be typed, e.g. anyOf),
+ *  - to_json() / from_json() for the structs, where from_json() checks the
+ *    types, required and unexpected properties, property name patterns, array
+ *    sizes and number bounds of the schema, throwing std::invalid_argument,
+ *  - <Name>Endpoint, with the request name and both types, for
+ *    NuDock::register_response<Endpoint>() and NuDock::send_request<Endpoint>().
+ *
+ * Handlers and clients using these types no longer compile once they use
+ * fields the schemas dropped or renamed. Only the schemas of endpoints should
+ * be given: a variant schema, e.g. log_likelihood_strict.schema.json, would
+ * get an endpoint type for a request name no server serves.
+ */
+
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace {
+
+/// @brief "set_parameters" -> "SetParameters"
+std::string camel_case(const std::string& _name)
+{
+  std::string result;
+  bool upper = true;
+  for (char c : _name) {
+    if (!std::isalnum(static_cast<unsigned char>(c))) {
+      upper = true;
+      continue;
+    }
+    result += upper ? static_cast<char>(std::toupper(static_cast<unsigned char>(c))) : c;
+    upper = false;
+  }
+  return result;
+}
+
+/// @brief Turns a json property name into a C++ member name
+std::string identifier(const std::string& _name)
+{
+  static const std::set<std::string> keywords = {
+      "auto", "bool", "break", "case", "catch", "char", "class", "const", "continue", "default",
+      "delete", "do", "double", "else", "enum", "explicit", "false", "float", "for", "friend",
+      "if", "inline", "int", "long", "namespace", "new", "operator", "private", "protected",
+      "public", "return", "short", "signed", "sizeof", "static", "struct", "switch", "template",
+      "this", "throw", "true", "try", "typedef", "union", "unsigned", "using", "virtual", "void",
+      "while"};
+  std::string result;
+  for (char c : _name) {
+    result += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  if (result.empty() || std::isdigit(static_cast<unsigned char>(result[0]))) {
+    result = "_" + result;
+  }
+  if (keywords.count(result)) {
+    result += "_";
+  }
+  return result;
+}
+
+/// @brief C++ string literal of a json string
+std::string literal(const std::string& _value)
+{
+  return nlohmann::json(_value).dump();
+}
+
+class Generator
+{
+  public:
+    /**
+     * @brief Adds the types of one endpoint.
+     *
+     * @param _stem Schema file name without ".schema.json", also the request name without the leading slash
+     * @param _schema Content of the schema file
+     */
+    void add_schema(const std::string& _stem, const nlohmann::json& _schema)
+    {
+      const std::string name = camel_case(_stem);
+      const nlohmann::json& properties = _schema.at("properties");
+      const std::string request = declare(properties.value("request", nlohmann::json::object()), name + "Request", _stem + ".request");
+      const std::string response = declare(properties.value("response", nlohmann::json::object()), name + "Response", _stem + ".response");
+
+      m_code << "/// @brief Endpoint \"/" << _stem << "\", from " << _stem << ".schema.json\n"
+             << "struct " << name << "Endpoint\n"
+             << "{\n"
+             << "  static constexpr const char* name = " << literal("/" + _stem) << ";\n"
+             << "  using Request = " << request << ";\n"
+             << "  using Response = " << response << ";\n"
+             << "};\n\n";
+      m_sources.push_back(_stem + ".schema.json");
+    }
+
+    /// @brief The whole generated header
+    std::string header() const
+    {
+      std::ostringstream header;
+      header << "/**\n"
+             << " * @file nudock_schemas.hpp\n"
+             << " *\n"
+             << " * @brief C++ types of the NuDock endpoints, generated by nudock_codegen from:\n";
+      for (const auto& source : m_sources) {
+        header << " *   " << source << "\n";
+      }
+      header << " *\n"
+             << " * Do not edit, rerun nudock_codegen on the schemas instead.\n"
+             << " */\n\n"
+             << "#pragma once\n\n"
+             << "#include <cstdint>\n"
+             << "#include <map>\n"
+             << "#include <optional>\n"
+             << "#include <regex>\n"
+             << "#include <stdexcept>\n"
+             << "#include <string>\n"
+             << "#include <vector>\n\n"
+             << "#include <nlohmann/json.hpp>\n\n"
+             << "#ifndef NUDOCK_SCHEMA_CHECK\n"
+             << "#define NUDOCK_SCHEMA_CHECK\n"
+             << "/// @brief Throws if a decoded value doesn't follow its schema\n"
+             << "inline void nudock_schema_check(bool _ok, const std::string& _path, const char* _message)\n"
+             << "{\n"
+             << "  if (!_ok) {\n"
+             << "    throw std::invalid_argument(_path + \": \" + _message);\n"
+             << "  }\n"
+             << "}\n"
+             << "#endif\n\n"
+             << m_code.str();
+      return header.str();
+    }
+
+  private:
+    /**
+     * @brief Declares the C++ type of a top-level request or response.
+     *
+     * @return Name of the type
+     */
+    std::string declare(const nlohmann::json& _schema, const std::string& _name, const std::string& _path)
+    {
+      std::string type = type_of(_schema, _name, _path);
+      if (type != _name) {
+        m_code << "using " << _name << " = " << type << ";\n\n";
+      }
+      return _name;
+    }
+
+    static bool is_struct(const nlohmann::json& _schema)
+    {
+      return _schema.value("type", "") == "object" && _schema.contains("properties") && !_schema["properties"].empty() &&
+             !_schema.contains("patternProperties") && !is_untyped(_schema);
+    }
+
+    static bool is_map(const nlohmann::json& _schema)
+    {
+      return _schema.value("type", "") == "object" && !_schema.contains("properties") && !is_untyped(_schema) &&
+             ((_schema.contains("patternProperties") && _schema["patternProperties"].size() == 1) ||
+              (_schema.contains("additionalProperties") && _schema["additionalProperties"].is_object()));
+    }
+
+    static bool is_untyped(const nlohmann::json& _schema)
+    {
+      return _schema.contains("anyOf") || _schema.contains("oneOf") || _schema.contains("allOf") || _schema.contains("$ref");
+    }
+
+    /// @brief Schema of the values of a map
+    static const nlohmann::json& map_values(const nlohmann::json& _schema)
+    {
+      if (_schema.contains("patternProperties")) {
+        return _schema["patternProperties"].begin().value();
+      }
+      return _schema["additionalProperties"];
+    }
+
+    /**
+     * @brief C++ type of a schema, generating the structs it needs first.
+     *
+     * @param _schema Schema of the value
+     * @param _name Name of the struct, if the value is one
+     * @param _path Location of the value, for the error messages
+     */
+    std::string type_of(const nlohmann::json& _schema, const std::string& _name, const std::string& _path)
+    {
+      if (is_untyped(_schema) || !_schema.contains("type") || !_schema["type"].is_string()) {
+        return "nlohmann::json";
+      }
+      const std::string type = _schema["type"];
+      if (type == "number") {
+        return "double";
+      }
+      if (type == "integer") {
+        return "std::int64_t";
+      }
+      if (type == "string") {
+        return "std::string";
+      }
+      if (type == "boolean") {
+        return "bool";
+      }
+      if (type == "array") {
+        if (!_schema.contains("items") || !_schema["items"].is_object()) {
+          return "std::vector<nlohmann::json>";
+        }
+        return "std::vector<" + type_of(_schema["items"], _name + "Item", _path + "[]") + ">";
+      }
+      if (is_struct(_schema)) {
+        generate_struct(_schema, _name, _path);
+        return _name;
+      }
+      if (is_map(_schema)) {
+        return "std::map<std::string, " + type_of(map_values(_schema), _name + "Value", _path + "{}") + ">";
+      }
+      return "nlohmann::json";
+    }
+
+    /// @brief Generates a struct with its to_json() and from_json()
+    void generate_struct(const nlohmann::json& _schema, const std::string& _name, const std::string& _path)
+    {
+      const nlohmann::json& properties = _schema["properties"];
+      std::set<std::string> required;
+      for (const auto& name : _schema.value("required", nlohmann::json::array())) {
+        required.insert(name.get<std::string>());
+      }
+
+      // The types of the members first, they may be structs themselves
+      struct Member {
+        std::string key;
+        std::string name;
+        std::string type;
+        bool required;
+        const nlohmann::json* schema;
+        std::string path;
+      };
+      std::vector<Member> members;
+      for (const auto& [key, schema] : properties.items()) {
+        Member member{key, identifier(key), "", required.count(key) > 0, &schema, _path + "." + key};
+        member.type = type_of(schema, _name + camel_case(key), member.path);
+        members.push_back(member);
+      }
+
+      m_code << "struct " << _name << "\n{\n";
+      for (const auto& member : members) {
+        if (member.required) {
+          m_code << "  " << member.type << " " << member.name << "{};\n";
+        } else {
+          m_code << "  std::optional<" << member.type << "> " << member.name << ";\n";
+        }
+      }
+      m_code << "};\n\n";
+
+      m_code << "inline void to_json(nlohmann::json& _json, const " << _name << "& _value)\n"
+             << "{\n"
+             << "  _json = nlohmann::json::object();\n";
+      for (const auto& member : members) {
+        if (member.required) {
+          m_code << "  _json[" << literal(member.key) << "] = _value." << member.name << ";\n";
+        } else {
+          m_code << "  if (_value." << member.name << ") {\n"
+                 << "    _json[" << literal(member.key) << "] = *_value." << member.name << ";\n"
+                 << "  }\n";
+        }
+      }
+      m_code << "}\n\n";
+
+      m_code << "inline void from_json(const nlohmann::json& _json, " << _name << "& _value)\n"
+             << "{\n"
+             << "  nudock_schema_check(_json.is_object(), " << literal(_path) << ", \"expected an object\");\n";
+      for (const auto& member : members) {
+        m_code << "  {\n"
+               << "    auto it = _json.find(" << literal(member.key) << ");\n";
+        if (member.required) {
+          m_code << "    nudock_schema_check(it != _json.end(), " << literal(member.path) << ", \"missing required property\");\n";
+          decode(*member.schema, member.type, "(*it)", "_value." + member.name, member.path, 2, 0);
+        } else {
+          m_code << "    if (it != _json.end()) {\n"
+                 << "      _value." << member.name << ".emplace();\n";
+          decode(*member.schema, member.type, "(*it)", "(*_value." + member.name + ")", member.path, 3, 0);
+          m_code << "    } else {\n"
+                 << "      _value." << member.name << ".reset();\n"
+                 << "    }\n";
+        }
+        m_code << "  }\n";
+      }
+      if (_schema.contains("additionalProperties") && _schema["additionalProperties"] == false) {
+        m_code << "  for (const auto& entry : _json.items()) {\n"
+               << "    const std::string& key = entry.key();\n"
+               << "    nudock_schema_check(";
+        for (size_t i = 0; i < members.size(); ++i) {
+          m_code << (i ? " || " : "") << "key == " << literal(members[i].key);
+        }
+        m_code << ", " << literal(_path) << " + (\".\" + key), \"unexpected property\");\n"
+               << "  }\n";
+      }
+      m_code << "}\n\n";
+    }
+
+    /**
+     * @brief Generates the statements decoding and checking one value.
+     *
+     * @param _schema Schema of the value
+     * @param _type C++ type of the value, as given by type_of()
+     * @param _source Expression of the json value
+     * @param _target Expression of the C++ value to fill
+     * @param _path Location of the value, for the error messages
+     * @param _indent Indentation level of the statements
+     * @param _depth Nesting level of arrays and maps, to name their loop variables
+     */
+    void decode(const nlohmann::json& _schema, const std::string& _type, const std::string& _source,
+                const std::string& _target, const std::string& _path, int _indent, int _depth)
+    {
+      const std::string pad(2 * _indent, ' ');
+      const std::string path = literal(_path);
+      const std::string level = std::to_string(_depth);
+
+      if (_type == "nlohmann::json") {
+        m_code << pad << _target << " = " << _source << ";\n";
+        return;
+      }
+      if (_type == "double" || _type == "std::int64_t") {
+        const bool integer = _type == "std::int64_t";
+        m_code << pad << "nudock_schema_check(" << _source << (integer ? ".is_number_integer()" : ".is_number()") << ", "
+               << path << (integer ? ", \"expected an integer\");\n" : ", \"expected a number\");\n")
+               << pad << _target << " = " << _source << ".get<" << _type << ">();\n";
+        if (_schema.contains("minimum")) {
+          m_code << pad << "nudock_schema_check(" << _target << " >= " << _schema["minimum"].dump() << ", " << path
+                 << ", \"below the minimum of " << _schema["minimum"].dump() << "\");\n";
+        }
+        if (_schema.contains("maximum")) {
+          m_code << pad << "nudock_schema_check(" << _target << " <= " << _schema["maximum"].dump() << ", " << path
+                 << ", \"above the maximum of " << _schema["maximum"].dump() << "\");\n";
+        }
+        return;
+      }
+      if (_type == "std::string") {
+        m_code << pad << "nudock_schema_check(" << _source << ".is_string(), " << path << ", \"expected a string\");\n"
+               << pad << _target << " = " << _source << ".get<std::string>();\n";
+        return;
+      }
+      if (_type == "bool") {
+        m_code << pad << "nudock_schema_check(" << _source << ".is_boolean(), " << path << ", \"expected a boolean\");\n"
+               << pad << _target << " = " << _source << ".get<bool>();\n";
+        return;
+      }
+      if (_type.rfind("std::vector<", 0) == 0) {
+        const std::string item_type = _type.substr(12, _type.size() - 13);
+        m_code << pad << "nudock_schema_check(" << _source << ".is_array(), " << path << ", \"expected an array\");\n";
+        if (_schema.contains("minItems")) {
+          m_code << pad << "nudock_schema_check(" << _source << ".size() >= " << _schema["minItems"].dump() << ", " << path
+                 << ", \"fewer than " << _schema["minItems"].dump() << " items\");\n";
+        }
+        if (_schema.contains("maxItems")) {
+          m_code << pad << "nudock_schema_check(" << _source << ".size() <= " << _schema["maxItems"].dump() << ", " << path
+                 << ", \"more than " << _schema["maxItems"].dump() << " items\");\n";
+        }
+        m_code << pad << _target << ".clear();\n"
+               << pad << _target << ".reserve(" << _source << ".size());\n"
+               << pad << "for (const auto& item" << level << " : " << _source << ") {\n"
+               << pad << "  " << item_type << " value" << level << "{};\n";
+        decode(_schema.value("items", nlohmann::json::object()), item_type, "item" + level, "value" + level, _path + "[]", _indent + 1, _depth + 1);
+        m_code << pad << "  " << _target << ".push_back(std::move(value" << level << "));\n"
+               << pad << "}\n";
+        return;
+      }
+      if (_type.rfind("std::map<std::string, ", 0) == 0) {
+        const std::string value_type = _type.substr(22, _type.size() - 23);
+        m_code << pad << "nudock_schema_check(" << _source << ".is_object(), " << path << ", \"expected an object\");\n"
+               << pad << _target << ".clear();\n"
+               << pad << "for (const auto& entry" << level << " : " << _source << ".items()) {\n";
+        if (_schema.contains("patternProperties")) {
+          const std::string pattern = _schema["patternProperties"].begin().key();
+          m_code << pad << "  static const std::regex pattern" << level << "(" << literal(pattern) << ");\n"
+                 << pad << "  nudock_schema_check(std::regex_search(entry" << level << ".key(), pattern" << level << "), "
+                 << path << " + (\".\" + entry" << level << ".key()), \"property name not matching " << literal(pattern).substr(1, literal(pattern).size() - 2) << "\");\n";
+        }
+        m_code << pad << "  " << value_type << " value" << level << "{};\n";
+        decode(map_values(_schema), value_type, "entry" + level + ".value()", "value" + level, _path + "{}", _indent + 1, _depth + 1);
+        m_code << pad << "  " << _target << ".emplace(entry" << level << ".key(), std::move(value" << level << "));\n"
+               << pad << "}\n";
+        return;
+      }
+      // A generated struct
+      m_code << pad << "from_json(" << _source << ", " << _target << ");\n";
+    }
+
+    std::ostringstream m_code;
+    std::vector<std::string> m_sources;
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <output header> <schema files...>" << std::endl;
+    return 1;
+  }
+
+  Generator generator;
+  for (int i = 2; i < argc; ++i) {
+    const std::string path = argv[i];
+    std::string stem = path.substr(path.find_last_of('/') + 1);
+    const std::string suffix = ".schema.json";
+    if (stem.size() <= suffix.size() || stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) != 0) {
+      std::cerr << "Schema files must be named <request>.schema.json, got: " << path << std::endl;
+      return 1;
+    }
+    stem.resize(stem.size() - suffix.size());
+
+    std::ifstream file(path);
+    if (!file) {
+      std::cerr << "Could not open schema file: " << path << std::endl;
+      return 1;
+    }
+    try {
+      generator.add_schema(stem, nlohmann::json::parse(file));
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Could not generate the types of " << path << ": " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  // Only rewrite the header if it changed, so that its users are not rebuilt for nothing
+  const std::string header = generator.header();
+  std::ifstream previous(argv[1]);
+  std::stringstream previous_header;
+  previous_header << previous.rdbuf();
+  if (previous && previous_header.str() == header) {
+    return 0;
+  }
+  std::ofstream output(argv[1]);
+  output << header;
+  if (!output) {
+    std::cerr << "Could not write " << argv[1] << std::endl;
+    return 1;
+  }
+  return 0;
+}
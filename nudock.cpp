@@ -1,27 +1,272 @@
 #include "nudock.hpp"
 
-NuDock::NuDock(bool _debug, 
+#include <unistd.h>
+
+namespace {
+
+/// @brief Sends a json value to a SAX handler as the events parsing it would give
+bool replay_sax(const nlohmann::json& _value, nlohmann::json_sax<nlohmann::json>* _sax)
+{
+  switch (_value.type()) {
+    case nlohmann::json::value_t::null:
+      return _sax->null();
+    case nlohmann::json::value_t::boolean:
+      return _sax->boolean(_value.get<bool>());
+    case nlohmann::json::value_t::number_integer:
+      return _sax->number_integer(_value.get<nlohmann::json::number_integer_t>());
+    case nlohmann::json::value_t::number_unsigned:
+      return _sax->number_unsigned(_value.get<nlohmann::json::number_unsigned_t>());
+    case nlohmann::json::value_t::number_float:
+      return _sax->number_float(_value.get<nlohmann::json::number_float_t>(), "");
+    case nlohmann::json::value_t::string: {
+      nlohmann::json::string_t string = _value.get<nlohmann::json::string_t>();
+      return _sax->string(string);
+    }
+    case nlohmann::json::value_t::binary: {
+      nlohmann::json::binary_t binary = _value.get_binary();
+      return _sax->binary(binary);
+    }
+    case nlohmann::json::value_t::object:
+      if (!_sax->start_object(_value.size())) {
+        return false;
+      }
+      for (const auto& [name, element] : _value.items()) {
+        nlohmann::json::string_t key = name;
+        if (!_sax->key(key) || !replay_sax(element, _sax)) {
+          return false;
+        }
+      }
+      return _sax->end_object();
+    case nlohmann::json::value_t::array:
+      if (!_sax->start_array(_value.size())) {
+        return false;
+      }
+      for (const auto& element : _value) {
+        if (!replay_sax(element, _sax)) {
+          return false;
+        }
+      }
+      return _sax->end_array();
+    case nlohmann::json::value_t::discarded:
+      break;
+  }
+  return true;
+}
+
+#ifdef NUDOCK_SIMDJSON
+/// @brief On-demand parser of the calling thread, keeping its buffers from one request to the next
+simdjson::ondemand::parser& ondemand_parser()
+{
+  thread_local simdjson::ondemand::parser parser;
+  return parser;
+}
+#endif
+
+/// @brief Applies TcpOptions to a freshly created server or client socket
+void apply_tcp_options(httplib::socket_t _sock, const TcpOptions& _options)
+{
+  int yes = 1;
+  setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  if (_options.nodelay) {
+    setsockopt(_sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  }
+  if (_options.send_buffer_size > 0) {
+    setsockopt(_sock, SOL_SOCKET, SO_SNDBUF, &_options.send_buffer_size, sizeof(_options.send_buffer_size));
+  }
+  if (_options.receive_buffer_size > 0) {
+    setsockopt(_sock, SOL_SOCKET, SO_RCVBUF, &_options.receive_buffer_size, sizeof(_options.receive_buffer_size));
+  }
+  if (_options.keep_alive) {
+    setsockopt(_sock, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
+#ifdef TCP_KEEPIDLE
+    setsockopt(_sock, IPPROTO_TCP, TCP_KEEPIDLE, &_options.keep_alive_idle, sizeof(_options.keep_alive_idle));
+#endif
+  }
+#ifdef SO_BINDTODEVICE
+  if (!_options.interface.empty() &&
+      setsockopt(_sock, SOL_SOCKET, SO_BINDTODEVICE, _options.interface.c_str(), _options.interface.size()) != 0) {
+    std::cerr << "Could not bind the socket to interface " << _options.interface << ": " << std::strerror(errno) << std::endl;
+  }
+#endif
+}
+
+/// @brief Servers available to CommunicationType::IN_PROCESS clients, by port
+std::mutex in_process_servers_mutex;
+std::unordered_map<int, NuDockBase*> in_process_servers;
+
+} // namespace
+
+NuDockBase::NuDockBase(bool _debug, 
                const std::string &_default_schemas_location,
                const CommunicationType& _comm_type,
                const int& _port)
-    : m_server(nullptr),
-      m_client(nullptr),
+    : m_client(nullptr),
+      m_running(false),
       m_debug(_debug), m_debug_prefix("Undefined"),
       m_default_schemas_location(_default_schemas_location),
       m_request_counter(0),
       m_comm_type(_comm_type), 
-      m_port(_port)
+      m_port(_port),
+      m_preferred_encoding(MessageEncoding::JSON),
+      m_encoding(MessageEncoding::JSON),
+      m_wire_protocol(WireProtocol::HTTP),
+      m_max_concurrent_requests(1)
 {
   if (m_default_schemas_location.empty()) {
     m_default_schemas_location = NUDOCK_SCHEMAS_DIR;
   }
 
+  use_validation_policy<NoValidation>();
+
+  // Endpoint id 0 is reserved for the handshake
+  m_endpoints.emplace_back();
+  m_endpoints.back().name = "/validate_start";
+
   std::cout << DEBUG() << "Created Nudock instance!" << std::endl;
   std::cout << DEBUG() << "debug  : " << m_debug << std::endl;
   std::cout << DEBUG() << "schemas: " << m_default_schemas_location << std::endl;
 }
 
-nlohmann::json NuDock::load_json_file(const std::string& _path)
+NuDockBase::~NuDockBase()
+{
+  if (m_in_process_port >= 0) {
+    std::lock_guard<std::mutex> lock(in_process_servers_mutex);
+    in_process_servers.erase(m_in_process_port);
+  }
+
+  // Stop the I/O before the rest of the instance goes away under the callbacks
+  m_framed_client.reset();
+  {
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+    m_async_done = true;
+    m_async_requests.clear();
+  }
+  m_async_cv.notify_all();
+  if (m_async_thread.joinable()) {
+    m_async_thread.join();
+  }
+
+  // The requests already answered are still validated
+  {
+    std::lock_guard<std::mutex> lock(m_validation_mutex);
+    m_validation_done = true;
+  }
+  m_validation_cv.notify_all();
+  if (m_validation_thread.joinable()) {
+    m_validation_thread.join();
+  }
+}
+
+void NuDockBase::set_tcp_options(const TcpOptions& _options)
+{
+  if (m_client || !m_servers.empty() || m_framed_client || !m_framed_servers.empty()) {
+    std::cerr << DEBUG() << "TCP options must be set before starting the client or server" << std::endl;
+    return;
+  }
+  m_tcp_options = _options;
+}
+
+void NuDockBase::set_wire_protocol(WireProtocol _protocol)
+{
+  if (m_client || !m_servers.empty() || m_framed_client || !m_framed_servers.empty()) {
+    std::cerr << DEBUG() << "Wire protocol must be set before starting the client or server" << std::endl;
+    return;
+  }
+  m_wire_protocol = _protocol;
+}
+
+void NuDockBase::set_encoding(MessageEncoding _encoding)
+{
+  if (m_client || m_shm_channel || m_framed_client || m_in_process_server) {
+    std::cerr << DEBUG() << "Encoding must be set before starting the client" << std::endl;
+    return;
+  }
+  m_preferred_encoding = _encoding;
+}
+
+void NuDockBase::set_compression(Compression _compression, size_t _threshold)
+{
+  if (m_client || m_shm_channel || m_framed_client || m_in_process_server || !m_servers.empty() || !m_framed_servers.empty()) {
+    std::cerr << DEBUG() << "Compression must be set before starting the client or server" << std::endl;
+    return;
+  }
+  if (!compression_available(_compression)) {
+    std::cerr << DEBUG() << "NuDock was built without " << compression_name(_compression) << " compression" << std::endl;
+    return;
+  }
+  m_preferred_compression = _compression;
+  m_compression_threshold = _threshold;
+}
+
+void NuDockBase::set_validation_sampling(const ValidationSampling& _sampling)
+{
+  if (!m_servers.empty() || !m_framed_servers.empty() || m_shm_channel || m_in_process_port >= 0) {
+    std::cerr << DEBUG() << "Validation sampling must be set before starting the server" << std::endl;
+    return;
+  }
+  m_validation_sampling = _sampling;
+}
+
+void NuDockBase::set_validation_failure_hook(ValidationFailureHook _hook)
+{
+  if (!m_servers.empty() || !m_framed_servers.empty() || m_shm_channel || m_in_process_port >= 0) {
+    std::cerr << DEBUG() << "Validation failure hook must be set before starting the server" << std::endl;
+    return;
+  }
+  m_validation_failure_hook = std::move(_hook);
+}
+
+ValidationCounters NuDockBase::validation_counters(const std::string& _request) const
+{
+  ValidationCounters counters;
+  auto id = m_endpoint_ids.find(_request);
+  if (id == m_endpoint_ids.end() || !m_endpoints[id->second].validation) {
+    return counters;
+  }
+  const EndpointValidation& validation = *m_endpoints[id->second].validation;
+  counters.validated = validation.validated;
+  counters.skipped = validation.skipped;
+  counters.failed = validation.failed;
+  return counters;
+}
+
+void NuDockBase::set_max_concurrent_requests(unsigned _max_concurrent_requests)
+{
+  if (!m_framed_servers.empty()) {
+    std::cerr << DEBUG() << "Number of concurrent requests must be set before starting the server" << std::endl;
+    return;
+  }
+  m_max_concurrent_requests = std::max(1u, _max_concurrent_requests);
+}
+
+void NuDockBase::set_max_payload_size(uint64_t _max_payload_size)
+{
+  if (m_client || m_shm_channel || m_framed_client || m_in_process_server || !m_servers.empty() || !m_framed_servers.empty()) {
+    std::cerr << DEBUG() << "Maximum payload size must be set before starting the client or server" << std::endl;
+    return;
+  }
+  m_max_payload_size = _max_payload_size;
+}
+
+void NuDockBase::set_parameter_layout(const ParameterLayout& _layout)
+{
+  if (!m_servers.empty() || !m_framed_servers.empty() || m_shm_channel || m_in_process_port >= 0) {
+    std::cerr << DEBUG() << "Parameter layout must be set before starting the server" << std::endl;
+    return;
+  }
+  m_parameter_layout = _layout;
+}
+
+void NuDockBase::add_transport(const CommunicationType& _comm_type, int _port)
+{
+  if (!m_servers.empty() || !m_framed_servers.empty() || m_shm_channel) {
+    std::cerr << DEBUG() << "Transports must be added before starting the server" << std::endl;
+    return;
+  }
+  m_additional_transports.emplace_back(_comm_type, _port < 0 ? m_port : _port);
+}
+
+nlohmann::json NuDockBase::load_json_file(const std::string& _path)
 {
   std::ifstream file(_path.c_str());
   if (!file.is_open()) {
@@ -38,9 +283,9 @@ nlohmann::json NuDock::load_json_file(const std::string& _path)
   return j;
 }
 
-void NuDock::register_response(const std::string& _request,
-                               HandlerFunction _handler_function,
-                               const std::string& _schema_path)
+void NuDockBase::register_response(const std::string& _request,
+                                   HandlerFunction _handler_function,
+                                   const std::string& _schema_path)
 {
   std::string schema_path = _schema_path.empty() ? m_default_schemas_location + _request + ".schema.json" : std::string(_schema_path);
 
@@ -49,33 +294,85 @@ void NuDock::register_response(const std::string& _request,
     std::cerr << DEBUG() << "Request name is empty!" << std::endl;
     return;
   }
-  if (m_request_handlers.count(_request)) {
+  if (m_endpoint_ids.count(_request)) {
     std::cerr << DEBUG() << "Request handler for \"" << _request << "\" already exists!" << std::endl;
     return;
   }
 
   // Create the schema validator for a specific request
   nlohmann::json schema = load_json_file(schema_path);
-  SchemaValidator validator;
-  validator.schema = schema["properties"];
-
-  // Request validator
-  validator.request_validator = std::make_shared<json_validator>();
-  validator.request_validator->set_root_schema(schema["properties"]["request"]);
+  EndpointEntry endpoint;
+  endpoint.name = _request;
+  endpoint.validator.schema = schema["properties"];
 
-  // Response validator
-  validator.response_validator = std::make_shared<json_validator>();
-  validator.response_validator->set_root_schema(schema["properties"]["response"]);
+  // Request and response validators, compiled once here instead of walking the schemas for every message
+  endpoint.validator.request_validator = std::make_shared<CompiledSchema>(schema["properties"]["request"]);
+  endpoint.validator.response_validator = std::make_shared<CompiledSchema>(schema["properties"]["response"]);
+  if (!endpoint.validator.request_validator->compiled() || !endpoint.validator.response_validator->compiled()) {
+    std::cout << DEBUG() << "Schema of \"" << _request << "\" uses keywords that aren't compiled, validating with json_validator" << std::endl;
+  }
 
-  // Move the validator to the internally held map
-  m_schema_validator[_request] = std::move(validator);
+  endpoint.validation = std::make_unique<EndpointValidation>();
 
-  // Add the request handler function
-  m_request_handlers[_request] = std::move(_handler_function);
+  // Add the request handler function under the next endpoint id
+  endpoint.handler = std::move(_handler_function);
+  m_endpoint_ids[_request] = static_cast<uint32_t>(m_endpoints.size());
+  m_endpoints.push_back(std::move(endpoint));
   std::cout << DEBUG() << "Registered request handler for \"" << _request << "\" with schema at: " << schema_path << std::endl;
 }
 
-bool NuDock::validate_start(const nlohmann::json& _message)
+void NuDockBase::register_response_sax(const std::string& _request,
+                                       SaxHandlerFactory _handler_factory,
+                                       const std::string& _schema_path)
+{
+  if (m_endpoint_ids.count(_request)) {
+    std::cerr << DEBUG() << "Request handler for \"" << _request << "\" already exists!" << std::endl;
+    return;
+  }
+
+  // Validation and IN_PROCESS go through the json value, which is replayed as SAX events
+  register_response(_request,
+      [factory = _handler_factory](const nlohmann::json& _message) {
+        std::unique_ptr<SaxRequestHandler> handler = factory();
+        if (!replay_sax(_message, handler.get())) {
+          throw std::invalid_argument("The SAX handler stopped reading the request");
+        }
+        return handler->finish();
+      },
+      _schema_path);
+  auto endpoint_it = m_endpoint_ids.find(_request);
+  if (endpoint_it != m_endpoint_ids.end()) {
+    m_endpoints[endpoint_it->second].sax_handler = std::move(_handler_factory);
+  }
+}
+
+#ifdef NUDOCK_SIMDJSON
+void NuDockBase::register_response_ondemand(const std::string& _request,
+                                            OnDemandHandlerFunction _handler_function,
+                                            const std::string& _schema_path)
+{
+  if (m_endpoint_ids.count(_request)) {
+    std::cerr << DEBUG() << "Request handler for \"" << _request << "\" already exists!" << std::endl;
+    return;
+  }
+
+  // Validation, binary encodings and IN_PROCESS go through the json value,
+  // which is written back out as json text for the handler
+  register_response(_request,
+      [handler = _handler_function](const nlohmann::json& _message) {
+        simdjson::padded_string body(_message.dump());
+        simdjson::ondemand::document document = ondemand_parser().iterate(body);
+        return handler(document);
+      },
+      _schema_path);
+  auto endpoint_it = m_endpoint_ids.find(_request);
+  if (endpoint_it != m_endpoint_ids.end()) {
+    m_endpoints[endpoint_it->second].ondemand_handler = std::move(_handler_function);
+  }
+}
+#endif
+
+bool NuDockBase::validate_start(const nlohmann::json& _message)
 {
   if (!_message.contains("version")) {
     std::cerr << DEBUG() << "Received /validate_start request without provided \"version\" entry! We will crash. Full request received:" << std::endl;
@@ -94,223 +391,1437 @@ bool NuDock::validate_start(const nlohmann::json& _message)
   return true;
 }
 
-void NuDock::start_server()
+int NuDockBase::process_request(const std::string& _request_name,
+                                std::string& _body,
+                                std::string& _response_body,
+                                MessageEncoding _encoding,
+                                int* _attached_fd)
 {
-  if (m_client || m_server) {
-    std::cerr << DEBUG() << "Client or server already started" << std::endl;
-    return;
-  }
-
-  m_debug_prefix = "Server";
-  // Create the server instance
-  m_server = std::make_unique<httplib::Server>();
-
-  if (!m_server->is_valid()){
-    std::cerr << DEBUG() << "Server is not valid" << std::endl;
-    return;
+  uint32_t endpoint;
+  if (!find_endpoint(_request_name, endpoint)) {
+    nlohmann::json err = {
+        {"error", "Unknown request title: " + _request_name}
+    };
+    _response_body = err.dump(2);
+    return 404;
   }
+  return process_request(endpoint, _body, _response_body, _encoding, _attached_fd);
+}
 
+int NuDockBase::process_request(uint32_t _endpoint,
+                                std::string& _body,
+                                std::string& _response_body,
+                                MessageEncoding _encoding,
+                                int* _attached_fd)
+{
   // Checks the served does upon receiving "validate_start" message: checks
   // clients version against its own, crashes if needed, but not before
   // sending an appropriate response.
-  m_server->Post("/validate_start", [&](const httplib::Request& req, httplib::Response& res) {
+  if (_endpoint == VALIDATE_START_ENDPOINT) {
     try {
       std::cout << "Server received request for /validate_start" << std::endl;
 
       // deserialize
-      nlohmann::json req_json = nlohmann::json::parse(req.body);
+      nlohmann::json req_json = nlohmann::json::parse(_body);
       bool validated = validate_start(req_json);
       std::cout << DEBUG() << "Server validated, sending validation response to the client to validate it" << std::endl;
 
-      m_response.clear();
-      m_response["version"] = m_version;
-
-      res.set_content(m_response.dump(), "application/json");
-
-      if (!validated) {
-        m_server->stop();
+      nlohmann::json response;
+      response["version"] = m_version;
+      response["endpoints"] = m_endpoint_ids;
+      if (!m_parameter_layout.groups().empty()) {
+        response["parameters"] = m_parameter_layout.names();
       }
-    }
-    catch (const std::exception& e) {
-      std::cout << DEBUG() << "Exception caught: \"" << e.what() << "\" Setting response to 400" << std::endl;
-      ERROR_RESPONSE(res, e.what());
-    }
-  });
-
-  // Iterate over and listen to the registered requests
-  for (const auto& [request_name, handler]: m_request_handlers) {
-    m_server->Post(request_name.c_str(), [request_name, handler, this](const httplib::Request& req, httplib::Response& res) {
-      try {
-        m_request_counter++;
-        // Validating the request
-        m_request.clear();
-        m_request = nlohmann::json::parse(req.body);
-
-        if (m_debug) {
-          try {
-            m_schema_validator[request_name].request_validator->validate(m_request, m_err);
-          }
-          catch (const std::exception& e) {
-            std::cout << DEBUG() << "Validating the request with name \"" << request_name << "\" failed! Here is why: " << e.what() << std::endl;
-            std::cout << DEBUG() << " -- Expected format : " << m_schema_validator[request_name].schema["request"].dump() << std::endl;
-            std::cout << DEBUG() << " -- Request received: " << m_request.dump() << std::endl;
-            std::cout << DEBUG() << " -- Aborting" << std::endl;
-            ERROR_RESPONSE(res, "Server request validation failed: " + std::string(e.what()));
+      if (req_json.value("request_schemas", false)) {
+        // Validating clients check their requests against the schemas used here, custom ones included
+        nlohmann::json& schemas = response["request_schemas"] = nlohmann::json::object();
+        for (uint32_t id = 1; id < m_endpoints.size(); ++id) {
+          const nlohmann::json& schema = m_endpoints[id].validator.schema;
+          if (schema.contains("request")) {
+            schemas[m_endpoints[id].name] = schema["request"];
           }
         }
+      }
 
-        // Getting the response
-        //m_response.clear();
-        m_response = handler(m_request);
-
-        // Validating the response
-        if (m_debug) {
-          try {
-            m_schema_validator[request_name].response_validator->validate(m_response, m_err);
-          }
-          catch (const std::exception& e) {
-            std::cout << DEBUG() << "Validating the response failed! Here is why: " << e.what() << std::endl;
-            std::cout << DEBUG() << "Expected format: " << m_schema_validator[request_name].schema["response"].dump() << std::endl;
-            std::cout << DEBUG() << "Response given : " << m_response.dump() << std::endl;
-            std::cout << DEBUG() << "Aborting" << std::endl;
-            ERROR_RESPONSE(res, "Server response validation failed: " + std::string(e.what()));
-          }
+      // Agree on the first encoding of the client's list we know, clients not sending any get json
+      response["encoding"] = encoding_name(MessageEncoding::JSON);
+      for (const auto& name : req_json.value("encodings", nlohmann::json::array())) {
+        MessageEncoding encoding;
+        if (name.is_string() && encoding_from_name(name.get<std::string>(), encoding)) {
+          response["encoding"] = encoding_name(encoding);
+          break;
         }
+      }
 
-        // Sending the response back to the client
-        res.set_content(m_response.dump(), "application/json");
-        std::cout << DEBUG() << "Request counter: " << m_request_counter << std::endl;
-      } 
-      catch (const std::exception& e) {
-        std::cout << DEBUG() << "Exception caught for request \"" << request_name << "\" : \"" << e.what() << "\" Setting response to 400" << std::endl;
-        ERROR_RESPONSE(res, e.what());
+      // Same for the compression, taking the first one of the client's list this build has
+      response["compression"] = compression_name(Compression::NONE);
+      for (const auto& name : req_json.value("compressions", nlohmann::json::array())) {
+        Compression compression;
+        if (name.is_string() && compression_from_name(name.get<std::string>(), compression) && compression_available(compression)) {
+          response["compression"] = compression_name(compression);
+          break;
+        }
       }
-    });
-  }
 
-  m_server->Post(R"(/.*)", [&](const httplib::Request& req, httplib::Response& res) {
-    const std::string& path = req.path;
-    if (m_request_handlers.count(path)) {
-        // Let the registered handler deal with it.
-        return;
+      _response_body = response.dump();
+
+      if (!validated) {
+        stop_server();
+      }
+      return 200;
+    }
+    catch (const std::exception& e) {
+      std::cout << DEBUG() << "Exception caught: \"" << e.what() << "\" Setting response to 400" << std::endl;
+      ERROR_RESPONSE(_response_body, e.what());
     }
+  }
 
+  if (_endpoint >= m_endpoints.size()) {
     nlohmann::json err = {
-        {"error", "Unknown request title: " + path}
+        {"error", "Unknown endpoint id: " + std::to_string(_endpoint)}
     };
-    res.status = 404;
-    res.set_content(err.dump(2), "application/json");
-  });
-
-  std::cout << DEBUG() << "Registered requests handlers: " << std::endl;
-  for (const auto& request_name: m_request_handlers) {
-    std::cout << DEBUG() << request_name.first << std::endl;
+    _response_body = err.dump(2);
+    return 404;
   }
+  const EndpointEntry& endpoint = m_endpoints[_endpoint];
 
-  std::cout << DEBUG() << "VERSION: " << m_version << " started" << std::endl;
+  nlohmann::json response;
+  const int status = (this->*m_process_message)(_endpoint, _body, _encoding, response);
+  if (status != 200) {
+    _response_body = response.is_string() ? response.get<std::string>() : response.dump(2);
+    return status;
+  }
+  if (_encoding == MessageEncoding::BSON && !response.is_object()) {
+    // The client's choice of encoding, not the server's fault
+    nlohmann::json err = {
+        {"error", "The response to \"" + endpoint.name + "\" isn't a json object, which BSON requires"}
+    };
+    _response_body = err.dump(2);
+    return 400;
+  }
 
-  switch (m_comm_type) {
-    case CommunicationType::UNIX_DOMAIN_SOCKET:
-      std::cout << DEBUG() << "Using UNIX domain socket for communication" << std::endl;
-      // Clean up the old socket file, if any
-      unlink(("/tmp/nudock_" +  std::to_string(m_port) + ".sock").c_str());
-      m_server->set_address_family(AF_UNIX).listen(("/tmp/nudock_" +  std::to_string(m_port) + ".sock").c_str(), m_port);
-      break;
-    case CommunicationType::LOCALHOST:
-      std::cout << DEBUG() << "Using localhost for communication" << std::endl;
-      m_server->listen("localhost", m_port);
-      break;
-    case CommunicationType::TCP:
-      std::cout << DEBUG() << "TCP for communication not supported!" << std::endl;
-    default:
-      std::cerr << DEBUG() << "Unsupported ucommunication type!" << std::endl;
-      return;
+  // Sending the response back to the client, large arrays out of line if possible
+  if (_attached_fd) {
+    *_attached_fd = move_arrays_to_memfd(response);
+  }
+  try {
+    encode_message(response, _encoding, _response_body);
+  }
+  catch (const std::exception& e) {
+    std::cout << DEBUG() << "Could not encode the response to \"" << endpoint.name << "\" : \"" << e.what() << "\" Setting response to 400" << std::endl;
+    ERROR_RESPONSE(_response_body, e.what());
   }
+  if (m_asynchronous_validation) {
+    // The response is encoded already and the transport is done with the request body,
+    // so the validation thread takes both over instead of copies, decoding the request again
+    ValidationJob job;
+    job.endpoint = _endpoint;
+    job.body.swap(_body);
+    job.encoding = _encoding;
+    job.response = std::move(response);
+    if (_attached_fd && *_attached_fd >= 0) {
+      // The transport closes its own once sent, the arrays are restored on the validation thread
+      job.attached_fd = dup(*_attached_fd);
+    }
+    queue_validation(std::move(job));
+  }
+  return 200;
 }
 
-void NuDock::start_client()
+int NuDockBase::process_request(uint32_t _endpoint,
+                                const nlohmann::json& _request,
+                                std::shared_ptr<nlohmann::json>& _response)
 {
-  if (m_client || m_server) {
-    std::cerr << DEBUG() << "Client or server already started" << std::endl;
-    return;
+  if (_endpoint == VALIDATE_START_ENDPOINT || _endpoint >= m_endpoints.size()) {
+    _response = std::make_shared<nlohmann::json>(nlohmann::json{
+        {"error", "Unknown endpoint id: " + std::to_string(_endpoint)}
+    });
+    return 404;
   }
+  return (this->*m_process_value)(_endpoint, _request, _response);
+}
 
-  m_debug_prefix = "Client";
-  std::cout << DEBUG() << "Starting the client" << std::endl;
-
-  switch (m_comm_type) {
-    case CommunicationType::UNIX_DOMAIN_SOCKET:
-      std::cout << DEBUG() << "Using UNIX domain socket for communication" << std::endl;
-      m_client = std::make_unique<httplib::Client>("/tmp/nudock_" +  std::to_string(m_port) + ".sock");
-      m_client->set_address_family(AF_UNIX);
-      break;
-    case CommunicationType::LOCALHOST:
-      std::cout << DEBUG() << "Using localhost for communication" << std::endl;
-      m_client = std::make_unique<httplib::Client>("localhost", m_port);
-      break;
-    case CommunicationType::TCP:
-      std::cout << DEBUG() << "TCP for communication not supported!" << std::endl;
-    default:
-      std::cerr << DEBUG() << "Unsupported communication type!" << std::endl;
-      return;
+template <class ValidationPolicy>
+bool NuDockBase::validates_next_request([[maybe_unused]] uint32_t _endpoint)
+{
+  if constexpr (!ValidationPolicy::requests && !ValidationPolicy::responses) {
+    return false;
   }
+  else {
+    EndpointValidation& validation = *m_endpoints[_endpoint].validation;
+    bool validate = true;
+    if constexpr (ValidationPolicy::debug_only) {
+      validate = m_debug;
+  }
+  else if constexpr (ValidationPolicy::sampled) {
+      // Every request of the warm-up, then one in every period, until enough passed in a row
+      const ValidationSampling& sampling = m_validation_sampling;
+      const uint64_t request = validation.requests++;
+      if (sampling.stop_after_passes > 0 && validation.consecutive_passes >= sampling.stop_after_passes) {
+        validate = false;
+  }
+      else if (request >= sampling.warm_up) {
+        validate = sampling.period > 0 && (request - sampling.warm_up) % sampling.period == 0;
+      }
+    }
+    if (!validate) {
+      ++validation.skipped;
+    }
+    return validate;
+  }
+}
 
-  std::cout << DEBUG() << "Client started! Waiting for the server..." << std::endl;
-
-  // Since we just started the client, we will validate it against the server
-  // straight away by sending a request to the server with the version of the
-  // client.
-  /// @todo: Change this to use the send_request function
-  nlohmann::json req_json_validate;
-  req_json_validate["version"] = m_version;
+template <class ValidationPolicy>
+int NuDockBase::process_message(uint32_t _endpoint,
+                                const std::string& _body,
+                                MessageEncoding _encoding,
+                                nlohmann::json& _response)
+{
+  if constexpr (ValidationPolicy::asynchronous) {
+    // Answered without validation, process_request() queues the validation once the response is encoded
+    return process_message<NoValidation>(_endpoint, _body, _encoding, _response);
+    }
+  else {
+  const EndpointEntry& endpoint = m_endpoints[_endpoint];
+  const bool validate = validates_next_request<ValidationPolicy>(_endpoint);
 
-  auto res = m_client->Post("/validate_start", req_json_validate.dump(), "application/json");
-  if (res && res->status == 200) {
-    auto res_json = nlohmann::json::parse(res->body);
-    validate_start(res_json);
-    std::cout << DEBUG() << "Client validated!" << std::endl;
+  // SAX and on-demand handlers read the message directly, unless the request has to be validated first
+  if (!validate && endpoint.sax_handler) {
+    return process_request_sax(_endpoint, _body, _encoding, _response);
   }
-  else {
-    std::cerr << DEBUG() << "Client failed to validate!" << std::endl;
-    std::cerr << DEBUG() << " -- The message was: " << req_json_validate.dump() << std::endl;
-    std::cerr << DEBUG() << "Request failed with status: " << (res ? res->status : 0) << " and error: " << res.error() << std::endl;
-    throw res.error();
+#ifdef NUDOCK_SIMDJSON
+  if (!validate && _encoding == MessageEncoding::JSON && endpoint.ondemand_handler) {
+    return process_request_ondemand(_endpoint, _body, _response);
+  }
+#endif
+  nlohmann::json request;
+  try {
+    request = decode_message(_body, _encoding);
+  }
+  catch (const std::exception& e) {
+    std::cout << DEBUG() << "Exception caught for request \"" << endpoint.name << "\" : \"" << e.what() << "\" Setting response to 400" << std::endl;
+    ERROR_RESPONSE(_response, e.what());
+  }
+  return call_handler<ValidationPolicy>(_endpoint, request, _response, validate);
   }
-
-  std::cout << DEBUG() << "VERSION: " << m_version << " started" << std::endl;
 }
 
-nlohmann::json NuDock::send_request(const std::string& _request, const nlohmann::json& _message)
+template <class ValidationPolicy>
+int NuDockBase::process_value(uint32_t _endpoint,
+                              const nlohmann::json& _request,
+                              std::shared_ptr<nlohmann::json>& _response)
 {
-  m_request_counter++;
-  if (!m_client) {
-    std::cerr << DEBUG() << "Client needs to be started first!" << std::endl;
-    std::abort();
+  _response = std::make_shared<nlohmann::json>();
+  if constexpr (ValidationPolicy::asynchronous) {
+    const int status = call_handler<NoValidation>(_endpoint, _request, *_response, false);
+    if (status == 200) {
+      ValidationJob job;
+      job.endpoint = _endpoint;
+      job.parsed = true;
+      // The only copy: the request is the client's, which may change it as soon as we return
+      job.request = _request;
+      job.shared_response = _response;
+      queue_validation(std::move(job));
+    }
+    return status;
   }
-
-  if (_request.empty()) {
-    std::cerr << DEBUG() << "Request name is empty!" << std::endl;
-    std::abort();
+  else {
+    return call_handler<ValidationPolicy>(_endpoint, _request, *_response, validates_next_request<ValidationPolicy>(_endpoint));
   }
+}
 
-  try{
-    httplib::Result res = m_client->Post(_request, _message.dump(), "application/json");
-
-    if (res && res->status == 200) {
-      m_response.clear();
-      m_response = nlohmann::json::parse(res->body);
-      std::cout << DEBUG() << "Received response: " << m_response << " from Server" << std::endl;
-      std::cout << DEBUG() << "Request counter: " << m_request_counter << std::endl;
-      return m_response;
-    } else {
-      std::cerr << DEBUG() << "Request failed with status: " << (res ? res->status : 0) 
-                << ", error: \"" << (res ? res->body : "") 
-                << "\", message: " << _message.dump() << std::endl;
-      std::cout << DEBUG() << "Request counter: " << m_request_counter << std::endl;
-      std::abort();
+template <class ValidationPolicy>
+int NuDockBase::call_handler(uint32_t _endpoint,
+                             const nlohmann::json& _request,
+                             nlohmann::json& _response,
+                             [[maybe_unused]] bool _validate)
+{
+  const std::string& request_name = m_endpoints[_endpoint].name;
+  const HandlerFunction& handler = m_endpoints[_endpoint].handler;
+  [[maybe_unused]] const SchemaValidator& schema_validator = m_endpoints[_endpoint].validator;
+  [[maybe_unused]] EndpointValidation* validation = m_endpoints[_endpoint].validation.get();
+
+  // Requests can be processed concurrently, so everything request-specific stays local
+  try {
+    uint64_t request_counter = ++m_request_counter;
+    // Validating the request
+    if constexpr (ValidationPolicy::requests) {
+      if (_validate) {
+      try {
+        schema_validator.request_validator->validate(_request, m_err);
+      }
+      catch (const std::exception& e) {
+          ++validation->failed;
+          validation->consecutive_passes = 0;
+        std::cout << DEBUG() << "Validating the request with name \"" << request_name << "\" failed! Here is why: " << e.what() << std::endl;
+        std::cout << DEBUG() << " -- Expected format : " << schema_validator.schema["request"].dump() << std::endl;
+        std::cout << DEBUG() << " -- Request received: " << _request.dump() << std::endl;
+        std::cout << DEBUG() << " -- Aborting" << std::endl;
+        ERROR_RESPONSE(_response, "Server request validation failed: " + std::string(e.what()));
+      }
     }
+    }
+
+    // Getting the response
+    _response = handler(_request);
+
+    // Validating the response
+    if constexpr (ValidationPolicy::responses) {
+      if (_validate) {
+      try {
+        schema_validator.response_validator->validate(_response, m_err);
+      }
+      catch (const std::exception& e) {
+          ++validation->failed;
+          validation->consecutive_passes = 0;
+        std::cout << DEBUG() << "Validating the response failed! Here is why: " << e.what() << std::endl;
+        std::cout << DEBUG() << "Expected format: " << schema_validator.schema["response"].dump() << std::endl;
+        std::cout << DEBUG() << "Response given : " << _response.dump() << std::endl;
+        std::cout << DEBUG() << "Aborting" << std::endl;
+        ERROR_RESPONSE(_response, "Server response validation failed: " + std::string(e.what()));
+      }
+    }
+    }
+
+    if constexpr (ValidationPolicy::requests || ValidationPolicy::responses) {
+      if (_validate) {
+        ++validation->validated;
+        ++validation->consecutive_passes;
+      }
+    }
+
+    std::cout << DEBUG() << "Request counter: " << request_counter << std::endl;
+    return 200;
+  }
+  catch (const std::exception& e) {
+    std::cout << DEBUG() << "Exception caught for request \"" << request_name << "\" : \"" << e.what() << "\" Setting response to 400" << std::endl;
+    ERROR_RESPONSE(_response, e.what());
+  }
+}
+
+template <class ValidationPolicy>
+void NuDockBase::validate_request([[maybe_unused]] uint32_t _endpoint, [[maybe_unused]] const nlohmann::json& _message)
+{
+  if constexpr (ValidationPolicy::requests) {
+    if constexpr (ValidationPolicy::debug_only) {
+      if (!m_debug) {
+        return;
+      }
+    }
+    if (_endpoint >= m_endpoints.size() || !m_endpoints[_endpoint].validator.request_validator) {
+      return;
+    }
+    const EndpointEntry& endpoint = m_endpoints[_endpoint];
+    EndpointValidation& validation = *endpoint.validation;
+
+    // Requests of a structure that passed before only differ by their values,
+    // which only matters to a schema constraining them
+    const bool cache_shapes = !endpoint.validator.request_validator->has_value_constraints();
+    const uint64_t shape = cache_shapes ? structural_fingerprint(_message) : 0;
+    if (cache_shapes) {
+      std::lock_guard<std::mutex> lock(validation.shapes_mutex);
+      if (validation.shapes.count(shape)) {
+        ++validation.skipped;
+        return;
+      }
+    }
+
+    try {
+      endpoint.validator.request_validator->validate(_message, m_err);
+    }
+    catch (const std::exception& e) {
+      ++validation.failed;
+      std::cerr << DEBUG() << "Validating the request with name \"" << endpoint.name << "\" failed! Here is why: " << e.what() << std::endl;
+      std::cerr << DEBUG() << " -- Expected format: " << endpoint.validator.schema["request"].dump() << std::endl;
+      std::cerr << DEBUG() << " -- Request sent   : " << _message.dump() << std::endl;
+      std::abort();
+    }
+    ++validation.validated;
+
+    if (!cache_shapes) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(validation.shapes_mutex);
+    if (validation.shapes.size() < EndpointValidation::MAX_SHAPES) {
+      validation.shapes.insert(shape);
+    }
+  }
+}
+
+// The policies NuDock can be instantiated with
+#define NUDOCK_INSTANTIATE_VALIDATION(POLICY) \
+  template int NuDockBase::process_message<POLICY>(uint32_t, const std::string&, MessageEncoding, nlohmann::json&); \
+  template int NuDockBase::process_value<POLICY>(uint32_t, const nlohmann::json&, std::shared_ptr<nlohmann::json>&); \
+  template void NuDockBase::validate_request<POLICY>(uint32_t, const nlohmann::json&);
+
+NUDOCK_INSTANTIATE_VALIDATION(NoValidation)
+NUDOCK_INSTANTIATE_VALIDATION(RequestValidation)
+NUDOCK_INSTANTIATE_VALIDATION(FullValidation)
+NUDOCK_INSTANTIATE_VALIDATION(SampledValidation)
+NUDOCK_INSTANTIATE_VALIDATION(DebugValidation)
+NUDOCK_INSTANTIATE_VALIDATION(AsyncValidation)
+
+#undef NUDOCK_INSTANTIATE_VALIDATION
+
+int NuDockBase::process_request_sax(uint32_t _endpoint,
+                                    const std::string& _body,
+                                    MessageEncoding _encoding,
+                                    nlohmann::json& _response)
+{
+  const SaxHandlerFactory& factory = m_endpoints[_endpoint].sax_handler;
+  try {
+    uint64_t request_counter = ++m_request_counter;
+    std::unique_ptr<SaxRequestHandler> handler = factory();
+    if (!sax_parse_message(_body, _encoding, handler.get())) {
+      throw std::invalid_argument("The SAX handler stopped reading the request");
+    }
+    _response = handler->finish();
+    std::cout << DEBUG() << "Request counter: " << request_counter << std::endl;
+    return 200;
+  }
+  catch (const std::exception& e) {
+    std::cout << DEBUG() << "Exception caught for request \"" << m_endpoints[_endpoint].name << "\" : \"" << e.what() << "\" Setting response to 400" << std::endl;
+    ERROR_RESPONSE(_response, e.what());
+  }
+}
+
+#ifdef NUDOCK_SIMDJSON
+int NuDockBase::process_request_ondemand(uint32_t _endpoint,
+                                         const std::string& _body,
+                                         nlohmann::json& _response)
+{
+  const OnDemandHandlerFunction& handler = m_endpoints[_endpoint].ondemand_handler;
+  try {
+    uint64_t request_counter = ++m_request_counter;
+    simdjson::padded_string body(_body);
+    simdjson::ondemand::document document = ondemand_parser().iterate(body);
+    _response = handler(document);
+    std::cout << DEBUG() << "Request counter: " << request_counter << std::endl;
+    return 200;
+  }
+  catch (const std::exception& e) {
+    std::cout << DEBUG() << "Exception caught for request \"" << m_endpoints[_endpoint].name << "\" : \"" << e.what() << "\" Setting response to 400" << std::endl;
+    ERROR_RESPONSE(_response, e.what());
+  }
+}
+#endif
+
+void NuDockBase::stop_server()
+{
+  m_running = false;
+  if (m_in_process_port >= 0) {
+    std::lock_guard<std::mutex> lock(in_process_servers_mutex);
+    in_process_servers.erase(m_in_process_port);
+  }
+  for (auto& server : m_servers) {
+    server->stop();
+  }
+  for (auto& framed_server : m_framed_servers) {
+    framed_server->stop();
+  }
+}
+
+httplib::Server* NuDockBase::setup_http_server()
+{
+  // Create the server instance
+  auto server = std::make_unique<httplib::Server>();
+
+  if (!server->is_valid()){
+    std::cerr << DEBUG() << "Server is not valid" << std::endl;
+    return nullptr;
+  }
+  server->set_payload_max_length(m_max_payload_size);
+
+  // Every request, including /validate_start and unknown ones, goes through
+  // the same transport-independent processing
+  auto route = [this](const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
+    // httplib serves each connection from one thread, the buffers are reused from one request to the next
+    thread_local std::string received_body;
+    thread_local std::string request_body;
+    thread_local std::string response_body;
+    thread_local std::string compressed_body;
+    // Requests without a known Content-Type, e.g. from curl, are taken as json
+    MessageEncoding encoding = MessageEncoding::JSON;
+    encoding_from_content_type(req.get_header_value("Content-Type"), encoding);
+
+    // Read into a buffer of ours rather than the const req.body, so AsyncValidation can take it over
+    received_body.clear();
+    content_reader([](const char* _data, size_t _length) {
+      received_body.append(_data, _length);
+      return true;
+    });
+
+    // Large payloads of clients that agreed on a compression come compressed
+    Compression compression = Compression::NONE;
+    if (req.has_header(COMPRESSION_HEADER)) {
+      try {
+        if (!compression_from_name(req.get_header_value(COMPRESSION_HEADER), compression)) {
+          throw std::invalid_argument("Unknown compression " + req.get_header_value(COMPRESSION_HEADER));
+        }
+        decompress_payload(received_body, compression, request_body, m_max_payload_size);
+      }
+      catch (const std::exception& e) {
+        res.status = 400;
+        res.set_content(std::string("Could not decompress the request: ") + e.what(), "text/plain");
+        return;
+      }
+    }
+    res.status = process_request(req.path, compression != Compression::NONE ? request_body : received_body, response_body, encoding);
+    const char* content_type = "application/json";
+    if (res.status == 400) {
+      content_type = "text/plain";
+    }
+    else if (res.status == 200 && req.path != "/validate_start") {
+      content_type = encoding_content_type(encoding);
+    }
+
+    Compression accepted_compression = Compression::NONE;
+    if (res.status == 200 && response_body.size() >= m_compression_threshold &&
+        compression_from_name(req.get_header_value(ACCEPT_COMPRESSION_HEADER), accepted_compression) &&
+        accepted_compression != Compression::NONE && compression_available(accepted_compression)) {
+      compress_payload(response_body, accepted_compression, compressed_body);
+      // Payloads that don't compress (e.g. binary noise) go out as they are
+      if (compressed_body.size() < response_body.size()) {
+        res.set_header(COMPRESSION_HEADER, compression_name(accepted_compression));
+        res.set_content(compressed_body, content_type);
+        return;
+      }
+    }
+    res.set_content(response_body, content_type);
+  };
+
+  server->Post("/validate_start", route);
+
+  // Iterate over and listen to the registered requests
+  for (size_t endpoint = 1; endpoint < m_endpoints.size(); ++endpoint) {
+    server->Post(m_endpoints[endpoint].name.c_str(), route);
+  }
+
+  server->Post(R"(/.*)", route);
+  m_servers.push_back(std::move(server));
+  return m_servers.back().get();
+}
+
+FramedServer* NuDockBase::setup_framed_server(CommunicationType _comm_type)
+{
+  SocketOptionsFunction socket_options;
+  if (_comm_type == CommunicationType::TCP) {
+    TcpOptions options = m_tcp_options;
+    socket_options = [options](int sock) { apply_tcp_options(sock, options); };
+  }
+
+  // Only unix domain sockets can pass the memfds along
+  bool pass_fds = _comm_type == CommunicationType::UNIX_DOMAIN_SOCKET;
+  m_framed_servers.push_back(std::make_unique<FramedServer>(
+      [this, pass_fds](uint32_t endpoint, uint8_t encoding, std::string& body,
+                       std::string& response_body, int& attached_fd) {
+        MessageEncoding message_encoding;
+        if (!encoding_from_byte(encoding, message_encoding)) {
+          return unknown_encoding(encoding, response_body);
+        }
+        return process_request(endpoint, body, response_body, message_encoding, pass_fds ? &attached_fd : nullptr);
+      },
+      socket_options, m_max_concurrent_requests));
+  m_framed_servers.back()->set_compression_threshold(m_compression_threshold);
+  m_framed_servers.back()->set_max_payload_size(m_max_payload_size);
+  return m_framed_servers.back().get();
+}
+
+int NuDockBase::unknown_encoding(uint8_t _encoding, std::string& _response_body)
+{
+  // Only this request is refused, the server keeps serving the other clients
+  nlohmann::json err = {
+      {"error", "Unknown message encoding: " + std::to_string(_encoding)}
+  };
+  _response_body = err.dump(2);
+  return 400;
+}
+
+void NuDockBase::serve_shared_memory()
+{
+  std::string request_name;
+  std::string request_body;
+  std::string response_body;
+  uint8_t encoding;
+  bool too_large;
+  while (m_running && m_shm_channel->receive_request(request_name, request_body, m_running, &encoding, &too_large)) {
+    MessageEncoding message_encoding;
+    int status;
+    if (too_large) {
+      // The body was skipped, only this request is refused
+      nlohmann::json err = {
+          {"error", "Request body is above the maximum payload size of " + std::to_string(m_max_payload_size) + " bytes"}
+      };
+      response_body = err.dump(2);
+      status = 413;
+    }
+    else {
+      status = encoding_from_byte(encoding, message_encoding)
+                   ? process_request(request_name, request_body, response_body, message_encoding)
+                   : unknown_encoding(encoding, response_body);
+    }
+    try {
+      m_shm_channel->send_response(status, response_body, encoding);
+    }
+    catch (const std::exception& e) {
+      std::cerr << DEBUG() << "Could not send the response: " << e.what() << std::endl;
+    }
+  }
+
+  m_shm_channel.reset();
+}
+
+std::function<void()> NuDockBase::open_transport(CommunicationType _comm_type, int _port)
+{
+  const std::string socket_path = "/tmp/nudock_" + std::to_string(_port) + ".sock";
+  switch (_comm_type) {
+    case CommunicationType::UNIX_DOMAIN_SOCKET: {
+      if (m_wire_protocol == WireProtocol::NUDOCK) {
+        FramedServer* framed_server = setup_framed_server(_comm_type);
+        std::cout << DEBUG() << "Using NuDock frames over UNIX domain socket " << socket_path << std::endl;
+        return [framed_server, socket_path]() { framed_server->listen_unix(socket_path); };
+      }
+      httplib::Server* server = setup_http_server();
+      if (!server) {
+        return nullptr;
+      }
+      std::cout << DEBUG() << "Using UNIX domain socket " << socket_path << " for communication" << std::endl;
+      // Clean up the old socket file, if any
+      unlink(socket_path.c_str());
+      if (!server->set_address_family(AF_UNIX).bind_to_port(socket_path, _port)) {
+        std::cerr << DEBUG() << "Could not listen on " << socket_path << std::endl;
+        return nullptr;
+      }
+      return [server]() { server->listen_after_bind(); };
+    }
+    case CommunicationType::LOCALHOST: {
+      httplib::Server* server = setup_http_server();
+      if (!server) {
+        return nullptr;
+      }
+      std::cout << DEBUG() << "Using localhost:" << _port << " for communication" << std::endl;
+      if (!server->bind_to_port("localhost", _port)) {
+        std::cerr << DEBUG() << "Could not listen on localhost:" << _port << std::endl;
+        return nullptr;
+      }
+      return [server]() { server->listen_after_bind(); };
+    }
+    case CommunicationType::SHARED_MEMORY: {
+      if (m_shm_channel) {
+        std::cerr << DEBUG() << "Only one shared memory transport can be served at a time" << std::endl;
+        return nullptr;
+      }
+      const std::string shm_name = "/nudock_" + std::to_string(_port);
+      m_shm_channel = SharedMemoryChannel::create(shm_name, m_shm_capacity);
+      m_shm_channel->set_max_payload_size(m_max_payload_size);
+      std::cout << DEBUG() << "Using shared memory " << shm_name << " with " << m_shm_capacity << " bytes per ring" << std::endl;
+      return [this]() { serve_shared_memory(); };
+    }
+    case CommunicationType::TCP: {
+      if (m_wire_protocol == WireProtocol::NUDOCK) {
+        FramedServer* framed_server = setup_framed_server(_comm_type);
+        std::cout << DEBUG() << "Using NuDock frames over TCP, listening on " << m_tcp_options.address << ":" << _port << std::endl;
+        const std::string address = m_tcp_options.address;
+        return [framed_server, address, _port]() { framed_server->listen_tcp(address, _port); };
+      }
+      httplib::Server* server = setup_http_server();
+      if (!server) {
+        return nullptr;
+      }
+      std::cout << DEBUG() << "Using TCP for communication, listening on " << m_tcp_options.address << ":" << _port
+                << (m_tcp_options.interface.empty() ? "" : " (" + m_tcp_options.interface + ")") << std::endl;
+      TcpOptions options = m_tcp_options;
+      server->set_tcp_nodelay(options.nodelay);
+      server->set_socket_options([options](httplib::socket_t sock) { apply_tcp_options(sock, options); });
+      if (options.keep_alive) {
+        server->set_keep_alive_max_count(std::numeric_limits<size_t>::max());
+        server->set_keep_alive_timeout(options.keep_alive_timeout);
+      }
+      if (!server->bind_to_port(options.address, _port)) {
+        std::cerr << DEBUG() << "Could not listen on " << options.address << ":" << _port << std::endl;
+        return nullptr;
+      }
+      return [server]() { server->listen_after_bind(); };
+    }
+    case CommunicationType::IN_PROCESS: {
+      std::lock_guard<std::mutex> lock(in_process_servers_mutex);
+      if (m_in_process_port >= 0 || !in_process_servers.emplace(_port, this).second) {
+        std::cerr << DEBUG() << "There is already an in-process server on port " << _port << std::endl;
+        return nullptr;
+      }
+      m_in_process_port = _port;
+      std::cout << DEBUG() << "Available to in-process clients on port " << _port << std::endl;
+      // Nothing to serve, the clients call process_request() themselves
+      return []() {};
+    }
+    default:
+      std::cerr << DEBUG() << "Unsupported ucommunication type!" << std::endl;
+      return nullptr;
+  }
+}
+
+void NuDockBase::start_server()
+{
+  if (m_client || !m_servers.empty() || m_shm_channel || m_framed_client || !m_framed_servers.empty() ||
+      m_in_process_server || m_in_process_port >= 0) {
+    std::cerr << DEBUG() << "Client or server already started" << std::endl;
+    return;
+  }
+
+  m_debug_prefix = "Server";
+  m_running = true;
+
+  std::cout << DEBUG() << "Registered requests handlers: " << std::endl;
+  for (size_t endpoint = 1; endpoint < m_endpoints.size(); ++endpoint) {
+    std::cout << DEBUG() << m_endpoints[endpoint].name << std::endl;
+  }
+
+  std::cout << DEBUG() << "VERSION: " << m_version << " started" << std::endl;
+
+  // Set up all the transports before serving any, so that stop_server() reaches all of them
+  std::vector<std::pair<CommunicationType, int>> comm_types = {{m_comm_type, m_port}};
+  comm_types.insert(comm_types.end(), m_additional_transports.begin(), m_additional_transports.end());
+  std::vector<std::function<void()>> transports;
+  for (const auto& [comm_type, port] : comm_types) {
+    std::function<void()> serve = open_transport(comm_type, port);
+    if (!serve) {
+      stop_server();
+      return;
+    }
+    // In-process clients don't need anything to be served
+    if (comm_type != CommunicationType::IN_PROCESS) {
+      transports.push_back(std::move(serve));
+    }
+  }
+
+  if (transports.empty()) {
+    return;
+  }
+  if (transports.size() == 1) {
+    transports.front()();
+    return;
+  }
+
+  // Serve each transport from its own thread, stopping all of them once one stops
+  std::vector<std::thread> threads;
+  for (const auto& serve : transports) {
+    threads.emplace_back([this, serve]() {
+      serve();
+      stop_server();
+    });
+  }
+  for (auto& server : m_servers) {
+    server->wait_until_ready();
+  }
+  // httplib misses a stop that comes before it's ready
+  if (!m_running) {
+    stop_server();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void NuDockBase::start_client()
+{
+  if (m_client || !m_servers.empty() || m_shm_channel || m_framed_client || !m_framed_servers.empty() ||
+      m_in_process_server || m_in_process_port >= 0) {
+    std::cerr << DEBUG() << "Client or server already started" << std::endl;
+    return;
+  }
+
+  m_debug_prefix = "Client";
+  std::cout << DEBUG() << "Starting the client" << std::endl;
+
+  switch (m_comm_type) {
+    case CommunicationType::UNIX_DOMAIN_SOCKET:
+      if (m_wire_protocol == WireProtocol::NUDOCK) {
+        std::cout << DEBUG() << "Using NuDock frames over UNIX domain socket" << std::endl;
+        m_framed_client = FramedClient::connect_unix("/tmp/nudock_" + std::to_string(m_port) + ".sock");
+        break;
+      }
+      std::cout << DEBUG() << "Using UNIX domain socket for communication" << std::endl;
+      m_client = std::make_unique<httplib::Client>("/tmp/nudock_" +  std::to_string(m_port) + ".sock");
+      m_client->set_address_family(AF_UNIX);
+      break;
+    case CommunicationType::LOCALHOST:
+      std::cout << DEBUG() << "Using localhost for communication" << std::endl;
+      m_client = std::make_unique<httplib::Client>("localhost", m_port);
+      break;
+    case CommunicationType::SHARED_MEMORY:
+      std::cout << DEBUG() << "Using shared memory for communication" << std::endl;
+      m_shm_channel = SharedMemoryChannel::attach("/nudock_" + std::to_string(m_port));
+      m_shm_channel->set_max_payload_size(m_max_payload_size);
+      break;
+    case CommunicationType::TCP: {
+      TcpOptions options = m_tcp_options;
+      if (m_wire_protocol == WireProtocol::NUDOCK) {
+        std::cout << DEBUG() << "Using NuDock frames over TCP, server at " << options.address << ":" << m_port << std::endl;
+        m_framed_client = FramedClient::connect_tcp(options.address, m_port,
+                                                    [options](int sock) { apply_tcp_options(sock, options); });
+        break;
+      }
+      std::cout << DEBUG() << "Using TCP for communication, server at " << options.address << ":" << m_port << std::endl;
+      m_client = std::make_unique<httplib::Client>(options.address, m_port);
+      m_client->set_tcp_nodelay(options.nodelay);
+      m_client->set_keep_alive(options.keep_alive);
+      m_client->set_socket_options([options](httplib::socket_t sock) { apply_tcp_options(sock, options); });
+      break;
+    }
+    case CommunicationType::IN_PROCESS: {
+      std::cout << DEBUG() << "Using in-process calls for communication" << std::endl;
+      std::lock_guard<std::mutex> lock(in_process_servers_mutex);
+      auto server_it = in_process_servers.find(m_port);
+      if (server_it == in_process_servers.end()) {
+        throw std::runtime_error("No in-process server on port " + std::to_string(m_port));
+      }
+      m_in_process_server = server_it->second;
+      break;
+    }
+    default:
+      std::cerr << DEBUG() << "Unsupported communication type!" << std::endl;
+      return;
+  }
+
+  if (m_framed_client) {
+    m_framed_client->set_max_payload_size(m_max_payload_size);
+  }
+
+  std::cout << DEBUG() << "Client started! Waiting for the server..." << std::endl;
+
+  // Since we just started the client, we will validate it against the server
+  // straight away by sending a request to the server with the version of the
+  // client.
+  /// @todo: Change this to use the send_request function
+  nlohmann::json req_json_validate;
+  req_json_validate["version"] = m_version;
+  req_json_validate["encodings"] = {encoding_name(m_preferred_encoding), encoding_name(MessageEncoding::JSON)};
+  if (m_validate_request) {
+    req_json_validate["request_schemas"] = true;
+  }
+  // Other transports don't go over the network, compressing would only cost time
+  if (m_comm_type == CommunicationType::TCP && m_preferred_compression != Compression::NONE) {
+    req_json_validate["compressions"] = {compression_name(m_preferred_compression)};
+  }
+
+  std::string response_body;
+  int attached_fd = -1;
+  int status = transmit(VALIDATE_START_ENDPOINT, req_json_validate.dump(), response_body, attached_fd);
+  if (status == 200) {
+    auto res_json = nlohmann::json::parse(response_body);
+    validate_start(res_json);
+    if (res_json.contains("endpoints")) {
+      m_endpoint_ids = res_json["endpoints"].get<std::unordered_map<std::string, uint32_t>>();
+      for (const auto& [request_name, endpoint] : m_endpoint_ids) {
+        if (endpoint >= m_endpoints.size()) {
+          m_endpoints.resize(endpoint + 1);
+        }
+        m_endpoints[endpoint].name = request_name;
+      }
+    }
+    if (m_validate_request) {
+      // Requests are validated against the schemas the server validates them with,
+      // which aren't necessarily the default ones of the request names
+      const nlohmann::json schemas = res_json.value("request_schemas", nlohmann::json::object());
+      for (uint32_t id = 1; id < m_endpoints.size(); ++id) {
+        EndpointEntry& endpoint = m_endpoints[id];
+        auto schema_it = schemas.find(endpoint.name);
+        if (endpoint.name.empty() || schema_it == schemas.end()) {
+          std::cout << DEBUG() << "No schema for \"" << endpoint.name << "\", its requests aren't validated" << std::endl;
+          continue;
+        }
+        endpoint.validator.schema = {{"request", *schema_it}};
+        endpoint.validator.request_validator = std::make_shared<CompiledSchema>(*schema_it);
+        endpoint.validation = std::make_unique<EndpointValidation>();
+      }
+    }
+    if (res_json.contains("parameters")) {
+      m_parameter_layout = ParameterLayout(res_json["parameters"]);
+    }
+    if (!res_json.contains("encoding") || !encoding_from_name(res_json["encoding"].get<std::string>(), m_encoding)) {
+      m_encoding = MessageEncoding::JSON;
+    }
+    if (!res_json.contains("compression") || !compression_from_name(res_json["compression"].get<std::string>(), m_compression) ||
+        !compression_available(m_compression)) {
+      m_compression = Compression::NONE;
+    }
+    if (m_framed_client) {
+      m_framed_client->set_encoding(static_cast<uint8_t>(m_encoding));
+      m_framed_client->set_compression(m_compression, m_compression_threshold);
+    }
+    std::cout << DEBUG() << "Using " << encoding_name(m_encoding) << " encoding" << std::endl;
+    if (m_compression != Compression::NONE) {
+      std::cout << DEBUG() << "Using " << compression_name(m_compression) << " compression from " << m_compression_threshold << " bytes" << std::endl;
+    }
+    std::cout << DEBUG() << "Client validated!" << std::endl;
+  }
+  else {
+    std::cerr << DEBUG() << "Client failed to validate!" << std::endl;
+    std::cerr << DEBUG() << " -- The message was: " << req_json_validate.dump() << std::endl;
+    std::cerr << DEBUG() << "Request failed with status: " << status << " and error: " << response_body << std::endl;
+    throw std::runtime_error("Client failed to validate: " + response_body);
+  }
+
+  std::cout << DEBUG() << "VERSION: " << m_version << " started" << std::endl;
+}
+
+bool NuDockBase::find_endpoint(const std::string& _request_name, uint32_t& _endpoint) const
+{
+  if (_request_name == "/validate_start") {
+    _endpoint = VALIDATE_START_ENDPOINT;
+    return true;
+  }
+  auto endpoint_it = m_endpoint_ids.find(_request_name);
+  if (endpoint_it == m_endpoint_ids.end()) {
+    return false;
+  }
+  _endpoint = endpoint_it->second;
+  return true;
+}
+
+int NuDockBase::transmit(uint32_t _endpoint,
+                         const std::string& _body,
+                         std::string& _response_body,
+                         int& _attached_fd)
+{
+  _attached_fd = -1;
+  if (_endpoint >= m_endpoints.size()) {
+    nlohmann::json err = {
+        {"error", "Unknown endpoint id: " + std::to_string(_endpoint)}
+    };
+    _response_body = err.dump(2);
+    return 404;
+  }
+
+  if (m_in_process_server) {
+    // The ids are the in-process server's own. Only /validate_start comes
+    // this way, the other requests are handed over as json values
+    std::string body = _body;
+    return m_in_process_server->process_request(_endpoint, body, _response_body);
+  }
+
+  if (m_shm_channel) {
+    std::lock_guard<std::mutex> lock(m_shm_mutex);
+    try {
+      m_shm_channel->send_request(m_endpoints[_endpoint].name, _body, static_cast<uint8_t>(m_encoding));
+      return m_shm_channel->receive_response(_response_body);
+    }
+    catch (const std::exception& e) {
+      // The server is gone, failing the request like a dropped connection
+      _response_body = e.what();
+      return 0;
+    }
+  }
+
+  if (m_framed_client) {
+    return m_framed_client->call(_endpoint, _body, _response_body, &_attached_fd);
+  }
+
+  httplib::Result res;
+  if (m_compression == Compression::NONE) {
+    res = m_client->Post(m_endpoints[_endpoint].name, _body, encoding_content_type(m_encoding));
+  }
+  else {
+    // Only the large payloads are compressed, the server does the same with the responses
+    thread_local std::string compressed_body;
+    httplib::Headers headers = {{ACCEPT_COMPRESSION_HEADER, compression_name(m_compression)}};
+    const std::string* payload = &_body;
+    if (_body.size() >= m_compression_threshold) {
+      compress_payload(_body, m_compression, compressed_body);
+      if (compressed_body.size() < _body.size()) {
+        payload = &compressed_body;
+        headers.emplace(COMPRESSION_HEADER, compression_name(m_compression));
+      }
+    }
+    res = m_client->Post(m_endpoints[_endpoint].name, headers, *payload, encoding_content_type(m_encoding));
+  }
+  if (!res) {
+    std::stringstream error;
+    error << res.error();
+    _response_body = "httplib error " + error.str();
+    return 0;
+  }
+  Compression compression;
+  if (res->has_header(COMPRESSION_HEADER) && compression_from_name(res->get_header_value(COMPRESSION_HEADER), compression)) {
+    decompress_payload(res->body, compression, _response_body, m_max_payload_size);
+  }
+  else {
+  _response_body = std::move(res->body);
+  }
+  return res->status;
+}
+
+nlohmann::json NuDockBase::parse_response(int _status,
+                                          const std::string& _response_body,
+                                          const nlohmann::json& _message,
+                                          int _attached_fd)
+{
+  try {
+    return decode_response(_status, _response_body, _attached_fd);
+  } catch (const std::exception& e) {
+    std::cerr << DEBUG() << e.what() << ", message: " << _message.dump() << std::endl;
+    std::abort();
+  }
+}
+
+nlohmann::json NuDockBase::decode_response(int _status,
+                                           const std::string& _response_body,
+                                           int _attached_fd)
+{
+  if (_status == 200) {
+    nlohmann::json response = decode_message(_response_body, m_encoding);
+    if (_attached_fd >= 0) {
+      restore_arrays_from_memfd(response, _attached_fd);
+    }
+    if (m_debug) {
+      // Printing out responses with large arrays would cost more than sending them
+      std::cout << DEBUG() << "Received response: " << response << " from Server" << std::endl;
+    }
+    std::cout << DEBUG() << "Request counter: " << m_request_counter << std::endl;
+    return response;
+  } else {
+    std::cout << DEBUG() << "Request counter: " << m_request_counter << std::endl;
+    throw std::runtime_error("Request failed with status: " + std::to_string(_status) + ", error: \"" + _response_body + "\"");
+  }
+}
+
+EndpointHandle NuDockBase::endpoint(const std::string& _request_name) const
+{
+  EndpointHandle handle;
+  if (!find_endpoint(_request_name, handle.id)) {
+    std::cerr << DEBUG() << "Unknown request title: " << _request_name << ", is the client started?" << std::endl;
+    std::abort();
+  }
+  return handle;
+}
+
+ParameterHandle NuDockBase::param(const std::string& _parameter_name) const
+{
+  if (m_parameter_layout.groups().empty()) {
+    std::cerr << DEBUG() << "The server didn't announce its parameter layout, looking up " << _parameter_name << std::endl;
+    std::abort();
+  }
+  try {
+    return m_parameter_layout.handle(_parameter_name);
+  } catch (const std::exception& e) {
+    std::cerr << DEBUG() << e.what() << std::endl;
+    std::abort();
+  }
+}
+
+nlohmann::json NuDockBase::send_request(const std::string& _request, const nlohmann::json& _message)
+{
+  if (_request.empty()) {
+    std::cerr << DEBUG() << "Request name is empty!" << std::endl;
+    std::abort();
+  }
+
+  return send_request(endpoint(_request), _message);
+}
+
+nlohmann::json NuDockBase::send_request(EndpointHandle _endpoint, const nlohmann::json& _message)
+{
+  try {
+    return exchange(_endpoint, _message);
+  } catch (const std::exception& e) {
+    std::cerr << DEBUG() << "Exception caught while sending request: " << e.what() << ", message: " << _message.dump() << std::endl;
+    std::abort();
+  }
+}
+
+MappedResponse NuDockBase::send_request_mapped(EndpointHandle _endpoint, const nlohmann::json& _message)
+{
+  try {
+    int attached_fd = -1;
+    nlohmann::json response = exchange(_endpoint, _message, &attached_fd);
+    return MappedResponse(std::move(response), attached_fd);
+  } catch (const std::exception& e) {
+    std::cerr << DEBUG() << "Exception caught while sending request: " << e.what() << ", message: " << _message.dump() << std::endl;
+    std::abort();
+  }
+}
+
+nlohmann::json NuDockBase::exchange(EndpointHandle _endpoint, const nlohmann::json& _message, int* _attached_fd)
+{
+  m_request_counter++;
+  if (!m_client && !m_shm_channel && !m_framed_client && !m_in_process_server) {
+    std::cerr << DEBUG() << "Client needs to be started first!" << std::endl;
+    std::abort();
+  }
+  if (m_validate_request) {
+    (this->*m_validate_request)(_endpoint.id, _message);
+  }
+
+  if (m_in_process_server) {
+    // No serialisation at all, the server's handler gets our message as is
+    std::shared_ptr<nlohmann::json> response;
+    int status = m_in_process_server->process_request(_endpoint.id, _message, response);
+    if (status == 200) {
+      // Copied only while the server's validation thread still holds it, see AsyncValidation
+      return response.use_count() == 1 ? std::move(*response) : *response;
+    }
+    return decode_response(status, response->is_string() ? response->get<std::string>() : response->dump(2));
+  }
+
+  // Buffers reused from one request to the next, send_request() can be called from several threads
+  thread_local std::string request_body;
+  thread_local std::string response_body;
+  encode_message(_message, m_encoding, request_body);
+  int attached_fd;
+  int status = transmit(_endpoint.id, request_body, response_body, attached_fd);
+  if (_attached_fd) {
+    // The caller maps the memfd, the arrays stay placeholders
+    nlohmann::json response = decode_response(status, response_body);
+    *_attached_fd = attached_fd;
+    return response;
+  }
+  return decode_response(status, response_body, attached_fd);
+}
+
+bool NuDockBase::send_request_sax(EndpointHandle _endpoint,
+                                  const nlohmann::json& _message,
+                                  nlohmann::json_sax<nlohmann::json>& _handler)
+{
+  m_request_counter++;
+  if (!m_client && !m_shm_channel && !m_framed_client && !m_in_process_server) {
+    std::cerr << DEBUG() << "Client needs to be started first!" << std::endl;
+    std::abort();
+  }
+  if (m_validate_request) {
+    (this->*m_validate_request)(_endpoint.id, _message);
+  }
+
+  try {
+    if (m_in_process_server) {
+      std::shared_ptr<nlohmann::json> response;
+      int status = m_in_process_server->process_request(_endpoint.id, _message, response);
+      if (status != 200) {
+        parse_response(status, response->is_string() ? response->get<std::string>() : response->dump(2), _message);
+      }
+      return replay_sax(*response, &_handler);
+    }
+
+    thread_local std::string request_body;
+    thread_local std::string response_body;
+    encode_message(_message, m_encoding, request_body);
+    int attached_fd;
+    int status = transmit(_endpoint.id, request_body, response_body, attached_fd);
+    if (status != 200 || attached_fd >= 0) {
+      // Failures are reported as usual, arrays sent in a memfd are put back into the json value
+      return replay_sax(parse_response(status, response_body, _message, attached_fd), &_handler);
+    }
+    if (m_debug) {
+      std::cout << DEBUG() << "Received response of " << response_body.size() << " bytes from Server" << std::endl;
+    }
+    std::cout << DEBUG() << "Request counter: " << m_request_counter << std::endl;
+    return sax_parse_message(response_body, m_encoding, &_handler);
   } catch (const std::exception& e) {
     std::cerr << DEBUG() << "Exception caught while sending request: " << e.what() << std::endl;
     std::abort();
   }
-}
\ No newline at end of file
+}
+
+#ifdef NUDOCK_SIMDJSON
+void NuDockBase::send_request_ondemand(const std::string& _request,
+                                       const nlohmann::json& _message,
+                                       const OnDemandReader& _reader)
+{
+  std::string response_body;
+  if (m_in_process_server || m_encoding != MessageEncoding::JSON) {
+    // The response doesn't come as json text
+    response_body = send_request(_request, _message).dump();
+  } else {
+    m_request_counter++;
+    if (!m_client && !m_shm_channel && !m_framed_client) {
+      std::cerr << DEBUG() << "Client needs to be started first!" << std::endl;
+      std::abort();
+    }
+
+    if (_request.empty()) {
+      std::cerr << DEBUG() << "Request name is empty!" << std::endl;
+      std::abort();
+    }
+
+    const EndpointHandle handle = endpoint(_request);
+    if (m_validate_request) {
+      (this->*m_validate_request)(handle.id, _message);
+    }
+    try {
+      int attached_fd;
+      int status = transmit(handle.id, _message.dump(), response_body, attached_fd);
+      if (status != 200 || attached_fd >= 0) {
+        // Failures are reported as usual, arrays sent in a memfd are put back into the json text
+        response_body = parse_response(status, response_body, _message, attached_fd).dump();
+      } else {
+        if (m_debug) {
+          std::cout << DEBUG() << "Received response: " << response_body << " from Server" << std::endl;
+        }
+        std::cout << DEBUG() << "Request counter: " << m_request_counter << std::endl;
+      }
+    } catch (const std::exception& e) {
+      std::cerr << DEBUG() << "Exception caught while sending request: " << e.what() << std::endl;
+      std::abort();
+    }
+  }
+
+  try {
+    simdjson::padded_string body(response_body);
+    simdjson::ondemand::document document = ondemand_parser().iterate(body);
+    _reader(document);
+  } catch (const std::exception& e) {
+    std::cerr << DEBUG() << "Exception caught while reading the response: " << e.what() << std::endl;
+    std::abort();
+  }
+}
+#endif
+
+std::vector<nlohmann::json> NuDockBase::send_requests(const std::vector<std::pair<std::string, nlohmann::json>>& _requests)
+{
+  std::vector<nlohmann::json> responses;
+  responses.reserve(_requests.size());
+
+  if (!m_framed_client) {
+    for (const auto& [request_name, message] : _requests) {
+      responses.push_back(send_request(request_name, message));
+    }
+    return responses;
+  }
+
+  try {
+    // Write out all the requests first, then collect the responses
+    std::vector<uint64_t> request_ids;
+    request_ids.reserve(_requests.size());
+    for (const auto& [request_name, message] : _requests) {
+      m_request_counter++;
+      uint32_t endpoint;
+      if (!find_endpoint(request_name, endpoint)) {
+        std::cerr << DEBUG() << "Unknown request title: " << request_name << std::endl;
+        std::abort();
+      }
+      if (m_validate_request) {
+        (this->*m_validate_request)(endpoint, message);
+      }
+      request_ids.push_back(m_framed_client->submit(endpoint, encode_message(message, m_encoding)));
+    }
+
+    std::string response_body;
+    for (size_t i = 0; i < _requests.size(); ++i) {
+      int attached_fd;
+      int status = m_framed_client->wait(request_ids[i], response_body, &attached_fd);
+      responses.push_back(parse_response(status, response_body, _requests[i].second, attached_fd));
+    }
+  } catch (const std::exception& e) {
+    std::cerr << DEBUG() << "Exception caught while sending requests: " << e.what() << std::endl;
+    std::abort();
+  }
+  return responses;
+}
+
+std::future<nlohmann::json> NuDockBase::send_request_async(const std::string& _request, const nlohmann::json& _message)
+{
+  auto promise = std::make_shared<std::promise<nlohmann::json>>();
+  std::future<nlohmann::json> future = promise->get_future();
+  send_request_async(_request, _message,
+                     [promise](nlohmann::json response) { promise->set_value(std::move(response)); },
+                     [promise](std::exception_ptr error) { promise->set_exception(error); });
+  return future;
+}
+
+void NuDockBase::send_request_async(const std::string& _request,
+                                    const nlohmann::json& _message,
+                                    ResponseCallback _callback)
+{
+  send_request_async(_request, _message, std::move(_callback), nullptr);
+}
+
+void NuDockBase::send_request_async(const std::string& _request,
+                                    const nlohmann::json& _message,
+                                    ResponseCallback _callback,
+                                    FailureCallback _on_failure)
+{
+  if (!m_client && !m_shm_channel && !m_framed_client && !m_in_process_server) {
+    std::cerr << DEBUG() << "Client needs to be started first!" << std::endl;
+    std::abort();
+  }
+
+  if (_request.empty()) {
+    std::cerr << DEBUG() << "Request name is empty!" << std::endl;
+    std::abort();
+  }
+
+  if (m_framed_client) {
+    m_request_counter++;
+    uint32_t endpoint;
+    if (!find_endpoint(_request, endpoint)) {
+      std::cerr << DEBUG() << "Unknown request title: " << _request << std::endl;
+      std::abort();
+    }
+    if (m_validate_request) {
+      (this->*m_validate_request)(endpoint, _message);
+    }
+    // The message is encoded already, only its name is kept for the error output
+    m_framed_client->submit(endpoint, encode_message(_message, m_encoding),
+        [this, _request, callback = std::move(_callback), on_failure = std::move(_on_failure)](int status, std::string& response_body, int attached_fd) {
+          nlohmann::json response;
+          try {
+            response = decode_response(status, response_body, attached_fd);
+          } catch (const std::exception& e) {
+            fail_async_request(_request, e, on_failure);
+            return;
+          }
+          callback(std::move(response));
+        });
+    return;
+  }
+
+  // The other transports carry one request at a time, so a single background
+  // thread sends them in order, the message is kept until then
+  EndpointHandle handle = endpoint(_request);
+  {
+    std::lock_guard<std::mutex> lock(m_async_mutex);
+    m_async_requests.emplace_back([this, handle, _request, _message, callback = std::move(_callback), on_failure = std::move(_on_failure)]() {
+      nlohmann::json response;
+      try {
+        response = exchange(handle, _message);
+      } catch (const std::exception& e) {
+        fail_async_request(_request, e, on_failure);
+        return;
+      }
+      callback(std::move(response));
+    });
+    if (!m_async_thread.joinable()) {
+      m_async_thread = std::thread(&NuDockBase::run_async_requests, this);
+    }
+  }
+  m_async_cv.notify_one();
+}
+
+void NuDockBase::fail_async_request(const std::string& _request,
+                                    const std::exception& _error,
+                                    const FailureCallback& _on_failure)
+{
+  if (_on_failure) {
+    _on_failure(std::make_exception_ptr(std::runtime_error(_request + ": " + _error.what())));
+    return;
+  }
+  std::cerr << DEBUG() << "Exception caught while receiving the response to " << _request << ": " << _error.what() << std::endl;
+  std::abort();
+}
+
+ParameterLayout NuDockBase::fetch_parameter_layout()
+{
+  if (!m_parameter_layout.groups().empty()) {
+    return m_parameter_layout;
+  }
+  nlohmann::json parameter_names = send_request("/get_parameter_names", "");
+  try {
+    return ParameterLayout(parameter_names);
+  } catch (const std::exception& e) {
+    std::cerr << DEBUG() << "Invalid parameter layout from the server: " << e.what() << std::endl;
+    std::abort();
+  }
+}
+
+void NuDockBase::run_async_requests()
+{
+  while (true) {
+    std::function<void()> request;
+    {
+      std::unique_lock<std::mutex> lock(m_async_mutex);
+      m_async_cv.wait(lock, [this]() { return m_async_done || !m_async_requests.empty(); });
+      if (m_async_done) {
+        return;
+      }
+      request = std::move(m_async_requests.front());
+      m_async_requests.pop_front();
+    }
+    request();
+  }
+}
+
+void NuDockBase::queue_validation(ValidationJob&& _job)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_validation_mutex);
+    if (m_validation_jobs.size() >= MAX_QUEUED_VALIDATIONS) {
+      // Never holding up the requests for the validation to catch up
+      ++m_endpoints[_job.endpoint].validation->skipped;
+      if (_job.attached_fd >= 0) {
+        close(_job.attached_fd);
+      }
+      return;
+    }
+    m_validation_jobs.push_back(std::move(_job));
+    if (!m_validation_thread.joinable()) {
+      m_validation_thread = std::thread(&NuDockBase::run_validations, this);
+    }
+  }
+  m_validation_cv.notify_one();
+}
+
+void NuDockBase::run_validations()
+{
+  while (true) {
+    ValidationJob job;
+    {
+      std::unique_lock<std::mutex> lock(m_validation_mutex);
+      m_validation_cv.wait(lock, [this]() { return m_validation_done || !m_validation_jobs.empty(); });
+      if (m_validation_jobs.empty()) {
+        return;
+      }
+      job = std::move(m_validation_jobs.front());
+      m_validation_jobs.pop_front();
+    }
+    validate_job(job);
+  }
+}
+
+void NuDockBase::validate_job(ValidationJob& _job)
+{
+  const EndpointEntry& endpoint = m_endpoints[_job.endpoint];
+  EndpointValidation& validation = *endpoint.validation;
+  const nlohmann::json& response = _job.shared_response ? *_job.shared_response : _job.response;
+
+  std::string error;
+  try {
+    if (!_job.parsed) {
+      _job.request = decode_message(_job.body, _job.encoding);
+    }
+    endpoint.validator.request_validator->validate(_job.request, m_err);
+  }
+  catch (const std::exception& e) {
+    error = "Request validation failed: " + std::string(e.what());
+  }
+  if (_job.attached_fd >= 0) {
+    try {
+      // Closes the memfd, whether the arrays could be restored or not
+      restore_arrays_from_memfd(_job.response, _job.attached_fd);
+    }
+    catch (const std::exception& e) {
+      std::cerr << DEBUG() << "Could not restore the arrays of the response to \"" << endpoint.name << "\" : " << e.what() << std::endl;
+    }
+  }
+  if (error.empty()) {
+    try {
+      endpoint.validator.response_validator->validate(response, m_err);
+    }
+    catch (const std::exception& e) {
+      error = "Response validation failed: " + std::string(e.what());
+    }
+  }
+
+  if (error.empty()) {
+    ++validation.validated;
+    ++validation.consecutive_passes;
+    return;
+  }
+  ++validation.failed;
+  validation.consecutive_passes = 0;
+  std::cerr << DEBUG() << "Validating the already answered request \"" << endpoint.name << "\" failed! " << error << std::endl;
+  std::cerr << DEBUG() << " -- Request : " << _job.request.dump() << std::endl;
+  std::cerr << DEBUG() << " -- Response: " << response.dump() << std::endl;
+  if (m_validation_failure_hook && m_validation_failure_hook(endpoint.name, error)) {
+    std::cerr << DEBUG() << " -- Stopping the server" << std::endl;
+    stop_server();
+  }
+}
@@ -5,8 +5,6 @@
  * 
  * @todo: Add debugging that prints out all the json messages into a file.
  * @todo: Sort out the debugging define, should be more descriptive.
- * @todo: Add schema validation layers on the client side too.
- * @todo: The validation should be a compile-time option? Or better, templated. E.g. NuDock<true> for validation, NuDock<false> for no validation.
  * @todo: All functions should have documentation. More comments.
  * @todo: Rethink abort(). 
  * @todo: Add versioning to the schemas, so that client and server can negotiate which version to use.
@@ -22,37 +20,105 @@
 #include <nlohmann/json.hpp>
 #include <nlohmann/json-schema.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <future>
+#include <limits>
 #include <string>
 #include <sstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "nudock_compression.hpp"
 #include "nudock_config.hpp"
+#include "nudock_encoding.hpp"
+#include "nudock_memfd.hpp"
+#include "nudock_parameters.hpp"
+#include "nudock_sax.hpp"
+#include "nudock_schema.hpp"
+#include "nudock_shm.hpp"
+#include "nudock_validation.hpp"
+#include "nudock_wire.hpp"
+
+#ifdef NUDOCK_SIMDJSON
+#include <simdjson.h>
+#endif
 
 //using nlohmann::json;
 using nlohmann::json_schema::json_validator;
 using HandlerFunction = std::function<nlohmann::json(const nlohmann::json&)>;
+using ResponseCallback = std::function<void(nlohmann::json)>;
+#ifdef NUDOCK_SIMDJSON
+using OnDemandHandlerFunction = std::function<nlohmann::json(simdjson::ondemand::document&)>;
+using OnDemandReader = std::function<void(simdjson::ondemand::document&)>;
+#endif
 
 // Debugging macro to print debug messages with function name and line number
 #define DEBUG() (this->m_debug_prefix + "::" + __func__ + "::L" + std::to_string(__LINE__) + " ")
 
 // Macro to set an error response and stop the server
-#define ERROR_RESPONSE(res, message) \
-  res.status = 400; \
-  res.set_content(message, "text/plain"); \
-  m_server->stop(); \
-  return;
-
-// SchemaValidator struct to hold request and response validators along with the
-// full schema
+#define ERROR_RESPONSE(out, message) \
+  out = message; \
+  stop_server(); \
+  return 400;
+
+// SchemaValidator struct to hold request and response validators, compiled
+// when the endpoint is registered, along with the full schema
 struct SchemaValidator {
-  std::shared_ptr<json_validator> request_validator;
-  std::shared_ptr<json_validator> response_validator;
+  std::shared_ptr<CompiledSchema> request_validator;
+  std::shared_ptr<CompiledSchema> response_validator;
   nlohmann::json schema;
 };
 
+/**
+ * @brief Client: endpoint id the server gave to a request name in /validate_start, see NuDockBase::endpoint().
+ *
+ * Requests sent through a handle skip the lookup of the request name, on the
+ * client and, with WireProtocol::NUDOCK and IN_PROCESS, on the server too.
+ */
+struct EndpointHandle {
+  uint32_t id = VALIDATE_START_ENDPOINT;
+};
+
+/// @brief Request and response types of a typed handler, see NuDockBase::register_response()
+template <class Signature>
+struct HandlerSignature {};
+
+template <class Response, class Request>
+struct HandlerSignature<Response (*)(Request)> {
+  using request = std::decay_t<Request>;
+  using response = Response;
+};
+
+template <class Response, class Class, class Request>
+struct HandlerSignature<Response (Class::*)(Request)> : HandlerSignature<Response (*)(Request)> {};
+
+template <class Response, class Class, class Request>
+struct HandlerSignature<Response (Class::*)(Request) const> : HandlerSignature<Response (*)(Request)> {};
+
+/// @brief Function pointers, and lambdas / functors with a single operator()
+template <class Handler, class = void>
+struct HandlerTraits : HandlerSignature<std::decay_t<Handler>> {};
+
+template <class Handler>
+struct HandlerTraits<Handler, std::void_t<decltype(&Handler::operator())>> : HandlerSignature<decltype(&Handler::operator())> {};
+
+/// @brief Whether the handler takes a request type of its own, rather than a nlohmann::json
+template <class Handler, class = void>
+constexpr bool is_typed_handler = false;
+
+template <class Handler>
+constexpr bool is_typed_handler<Handler, std::void_t<typename HandlerTraits<Handler>::request>> =
+    !std::is_same_v<typename HandlerTraits<Handler>::request, nlohmann::json>;
+
 // Custom error handler that throws exceptions on validation errors
 class custom_throwing_error_handler : public nlohmann::json_schema::error_handler
 {
@@ -67,32 +133,186 @@ enum class CommunicationType {
   UNIX_DOMAIN_SOCKET,
   LOCALHOST,
   TCP,
+  /// POSIX shared-memory ring buffers, server and client must be on the same machine
+  SHARED_MEMORY,
+  /// Direct calls, server and client must be in the same process
+  IN_PROCESS,
+};
+
+/// @brief Socket settings for CommunicationType::TCP
+struct TcpOptions {
+  /// @brief Server: address to bind to ("0.0.0.0" for all). Client: address or hostname of the server.
+  std::string address = "0.0.0.0";
+  /// @brief Network interface to bind the sockets to, e.g. "ib0". Empty to let the routing decide.
+  std::string interface;
+  /// @brief Disable Nagle's algorithm, small requests are sent straight away
+  bool nodelay = true;
+  /// @brief SO_SNDBUF / SO_RCVBUF sizes in bytes, 0 keeps the system defaults
+  int send_buffer_size = 4 * 1024 * 1024;
+  int receive_buffer_size = 4 * 1024 * 1024;
+  /// @brief Keep the connection open between requests, probing the peer when idle
+  bool keep_alive = true;
+  /// @brief Seconds an idle connection stays open between two requests
+  int keep_alive_timeout = 3600;
+  /// @brief Seconds of silence before the first keep-alive probe
+  int keep_alive_idle = 60;
 };
 
-class NuDock
+/**
+ * @brief Everything of a NuDock server / client but the validation policy, see NuDock.
+ *
+ * Code that only needs a NuDock instance, whatever its policy, takes a NuDockBase&.
+ */
+class NuDockBase
 {
   // Public member functions
   public:
     /**
-     * @brief NuDock constructor
-     * 
-     * Constructor for NuDock api instance, which can be used as a server or a client.
-     * 
-     * @param _debug Whether to print extra debug messages & do extra validations (not implemented yet)
-     * @param _default_schemas_location Default location of the json schemas. Using NuDock install folder if not specified.
-     * @param _comm_type Communication type between server and client, default is localhost. Unix domain sockets are faster, but only work on the same machine. TCP not implemented.
-     * @param _port Port number for communication, default is 1234. Not important if using unix domain socket.
+     * @brief NuDock destructor
+     *
+     * Asynchronous requests that haven't been answered yet are dropped.
+     */
+    virtual ~NuDockBase();
+
+    /**
+     * @brief Sets the socket options used with CommunicationType::TCP.
+     *
+     * Must be called before start_server() / start_client().
+     *
+     * @param _options Bind / server address, interface and socket tuning
+     */
+    void set_tcp_options(const TcpOptions& _options);
+
+    /**
+     * @brief Sets the protocol spoken over unix domain sockets and TCP.
+     *
+     * HTTP (default) can be talked to with any HTTP tool, WireProtocol::NUDOCK
+     * uses compact binary frames with integer endpoint ids instead. Server and
+     * client must use the same protocol. Must be called before start_server() / start_client().
+     *
+     * @param _protocol Wire protocol to use
+     */
+    void set_wire_protocol(WireProtocol _protocol);
+
+    /**
+     * @brief Client: sets the encoding to use for the messages, if the server agrees.
+     *
+     * The encoding is negotiated with the server in /validate_start, falling
+     * back to json with servers that don't know it. The binary encodings skip
+     * the text formatting and parsing of every double, BSON only takes json
+     * objects as messages. Must be called before start_client().
+     *
+     * @param _encoding Preferred encoding, json by default
+     */
+    void set_encoding(MessageEncoding _encoding);
+
+    /**
+     * @brief Sets the compression of the large payloads with CommunicationType::TCP.
+     *
+     * Client: asks for the compression in /validate_start, the payloads then
+     * stay uncompressed with servers built without it. Server: compressions
+     * are agreed on with the clients asking for one, this only sets the size
+     * from which the responses are compressed. Must be called before
+     * start_server() / start_client(). See nudock_compression.hpp.
+     *
+     * @param _compression Compression to ask for, must be available in this build
+     * @param _threshold Payloads smaller than this many bytes are sent uncompressed
+     */
+    void set_compression(Compression _compression, size_t _threshold = DEFAULT_COMPRESSION_THRESHOLD);
+
+    /**
+     * @brief Server: sets which requests of every endpoint SampledValidation validates.
+     *
+     * Must be called before start_server().
+     *
+     * @param _sampling Warm-up, period and number of passes after which validation stops
+     */
+    void set_validation_sampling(const ValidationSampling& _sampling);
+
+    /**
+     * @brief Number of requests to an endpoint validated, skipped or failed so far.
+     *
+     * Server: the requests received. Client: the requests sent, skipping those
+     * of a structure that passed before. Always zero with NoValidation, which
+     * doesn't count.
+     *
+     * @param _request Request name, e.g. "/log_likelihood"
+     * @return The counters, all zero if the endpoint isn't registered
+     */
+    ValidationCounters validation_counters(const std::string& _request) const;
+
+    /**
+     * @brief Server: sets the hook called on the violations found by AsyncValidation.
+     *
+     * Without a hook, violations are only logged and counted. Must be called
+     * before start_server().
+     *
+     * @param _hook Called on the validation thread, returns whether to stop the server
+     */
+    void set_validation_failure_hook(ValidationFailureHook _hook);
+
+    /**
+     * @brief Server: number of requests processed at the same time with WireProtocol::NUDOCK.
+     *
+     * Connections are served by a single event loop, and requests are
+     * processed by a separate pool of workers, so a slow handler doesn't hold
+     * up the I/O of the other connections. With the default of 1, requests
+     * are processed one after the other. With more, they are answered out of
+     * order, so the registered handlers must be thread-safe.
+     *
+     * @param _max_concurrent_requests Number of worker threads processing requests
+     */
+    void set_max_concurrent_requests(unsigned _max_concurrent_requests);
+
+    /**
+     * @brief Sets the largest payload accepted from the peer, like httplib's set_payload_max_length().
+     *
+     * Server: requests announcing a larger payload are refused, with
+     * WireProtocol::NUDOCK by closing their connection, over shared memory
+     * with status 413. Client: the connection fails on larger NuDock frame
+     * responses, a larger shared-memory response fails its request. Compressed
+     * payloads announcing a larger original size are refused before they are
+     * decompressed, on both sides and with both protocols. Must be called
+     * before start_server() / start_client().
+     *
+     * @param _max_payload_size Size of the payload in bytes, MAX_FRAME_PAYLOAD by default
      */
-    NuDock(bool _debug=true, 
-           const std::string& _default_schemas_location=NUDOCK_SCHEMAS_DIR,
-           const CommunicationType& _comm_type=CommunicationType::LOCALHOST,
-           const int& _port=1234);
+    void set_max_payload_size(uint64_t _max_payload_size);
+
+    /**
+     * @brief Server: also serves the registered requests over another transport.
+     *
+     * start_server() then serves on the constructor's transport and all the
+     * added ones at the same time, e.g. unix domain sockets for a local fitter
+     * and TCP for remote ones. Each transport is served from its own thread,
+     * so the registered handlers must be thread-safe. Must be called before start_server().
+     *
+     * @param _comm_type Communication type to serve on
+     * @param _port Port number, or name of the socket file / memory region. -1 to use the constructor's one.
+     */
+    void add_transport(const CommunicationType& _comm_type, int _port = -1);
+
+    /**
+     * @brief Server: announces the parameter layout to the clients in /validate_start.
+     *
+     * Clients then get the ids of the parameters, see param(), without
+     * fetching the layout through /get_parameter_names. Must be called before start_server().
+     *
+     * @param _layout Ordered parameter names of each group, as taken by the positional /set_parameters requests
+     */
+    void set_parameter_layout(const ParameterLayout& _layout);
 
     /** 
      * @brief Server: responds to requests from the client
      * 
      * Blocking function, meaning software execution stops here until the server is stopped.
-     * It starts the server, waits for requests from the client and responds to them.
+     * It starts the server, waits for requests from the client and responds to them,
+     * on all the transports added with add_transport().
+     *
+     * With CommunicationType::IN_PROCESS, the server is only made available to the
+     * clients in the same process, and the function returns straight away if
+     * there's no other transport to serve. The server must then outlive its
+     * clients, which call the handlers from their own threads.
      */ 
     void start_server();
 
@@ -126,6 +346,100 @@ class NuDock
                            HandlerFunction _handler_function,
                            const std::string& _schema_path = "");
 
+    /**
+     * @brief Registers a handler taking and returning plain C++ structs.
+     *
+     * The response needs a nlohmann::json conversion, e.g. from
+     * NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE, and fields matching the schema.
+     * A request whose fields are also listed with NUDOCK_SAX_FIELDS is decoded
+     * straight from the received message into the struct, without a json
+     * value, see nudock_sax.hpp. Other request types are converted from the
+     * json request, which only saves the handler from walking it.
+     *
+     * @code
+     *   struct SetSystematics { std::vector<double> values; };
+     *   NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(SetSystematics, values)
+     *   NUDOCK_SAX_FIELDS(SetSystematics, values)
+     *
+     *   dock.register_response<SetSystematics, nlohmann::json>("/set_systematics", set_systematics);
+     * @endcode
+     *
+     * @param _request Request ID name, including the leading slash, e.g. "/set_parameters"
+     * @param _handler_function Function to handle the request
+     * @param _schema_path Path of the schema file for the request and response validation.
+     */
+    template <class Request, class Response>
+    void register_response(const std::string& _request_name,
+                           std::function<Response(const Request&)> _handler_function,
+                           const std::string& _schema_path = "");
+
+    /**
+     * @brief Same as above, with the request and response types taken from the handler.
+     *
+     * @code
+     *   dock.register_response("/set_systematics", [&](const SetSystematics& _request) -> nlohmann::json { ... });
+     * @endcode
+     *
+     * @param _request Request ID name, including the leading slash, e.g. "/set_parameters"
+     * @param _handler_function Function, lambda or functor taking the request type, other than nlohmann::json
+     * @param _schema_path Path of the schema file for the request and response validation.
+     */
+    template <class Handler, std::enable_if_t<is_typed_handler<Handler>, int> = 0>
+    void register_response(const std::string& _request_name,
+                           Handler _handler_function,
+                           const std::string& _schema_path = "");
+
+    /**
+     * @brief Registers a handler receiving its request as SAX events, see nudock_sax.hpp.
+     *
+     * The request is decoded straight from the received message into the
+     * handler, without building a json value. With validation on and with
+     * IN_PROCESS, the handler gets the events of the json request value instead.
+     *
+     * @param _request Request ID name, including the leading slash, e.g. "/set_parameters"
+     * @param _handler_factory Function making a new SAX handler for each request
+     * @param _schema_path Path of the schema file for the request and response validation.
+     */
+    void register_response_sax(const std::string& _request_name,
+                               SaxHandlerFactory _handler_factory,
+                               const std::string& _schema_path = "");
+
+#ifdef NUDOCK_SIMDJSON
+    /**
+     * @brief Registers a handler reading the request with simdjson's on-demand parser.
+     *
+     * Only available when NuDock is built with -DNUDOCK_ENABLE_SIMDJSON=ON.
+     * The handler only decodes the fields it reads, straight from the json
+     * text, instead of the whole request being parsed into a nlohmann::json
+     * value first. With validation on, binary encodings and IN_PROCESS the
+     * request is still parsed (or written) as json text first, so handlers work
+     * the same on every transport.
+     *
+     * @param _request Request ID name, including the leading slash, e.g. "/set_parameters"
+     * @param _handler_function Function to handle the request, takes the on-demand json document and returns a json response
+     * @param _schema_path Path of the schema file for the request and response validation.
+     */
+    void register_response_ondemand(const std::string& _request_name,
+                                    OnDemandHandlerFunction _handler_function,
+                                    const std::string& _schema_path = "");
+#endif
+
+    /**
+     * @brief Registers a handler for an endpoint generated by nudock_codegen, see nudock_schemas.hpp.
+     *
+     * @code
+     *   dock.register_response<LogLikelihoodEndpoint>([](const LogLikelihoodRequest&) {
+     *     LogLikelihoodResponse response;
+     *     response.log_likelihood = compute_log_likelihood();
+     *     return response;
+     *   });
+     * @endcode
+     *
+     * @param _handler_function Function to handle the request
+     */
+    template <class Endpoint>
+    void register_response(std::function<typename Endpoint::Response(const typename Endpoint::Request&)> _handler_function);
+
     /**
      * @brief Function for the client to send a request to the server.
      * 
@@ -136,6 +450,217 @@ class NuDock
     nlohmann::json send_request(const std::string& _request_name,
                                 const nlohmann::json& _message);
 
+    /**
+     * @brief Function for the client to send a request to an endpoint looked up once with endpoint().
+     *
+     * @code
+     *   const EndpointHandle log_likelihood = client.endpoint("/log_likelihood");
+     *   while (sampling) {
+     *     ...
+     *     nlohmann::json response = client.send_request(log_likelihood, "");
+     *   }
+     * @endcode
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _message json object with the request message
+     * @return json object with the response from the server
+     */
+    nlohmann::json send_request(EndpointHandle _endpoint,
+                                const nlohmann::json& _message);
+
+    /**
+     * @brief Function for the client to send a request whose response carries large arrays, read in place.
+     *
+     * The arrays the server passed in a memfd (NuDock frames over a unix
+     * domain socket) aren't copied into the response, they are read from the
+     * mapped pages through MappedResponse::array(). See nudock_memfd.hpp.
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _message json object with the request message
+     * @return Response from the server, keeping the memfd mapped
+     */
+    MappedResponse send_request_mapped(EndpointHandle _endpoint,
+                                       const nlohmann::json& _message);
+
+    /**
+     * @brief Function for the client to look up the endpoint id the server gave to a request name.
+     *
+     * Aborts if the server doesn't know the request. Must be called after start_client().
+     *
+     * @param _request_name Request ID name, e.g. "/log_likelihood"
+     * @return Handle to send the requests through
+     */
+    EndpointHandle endpoint(const std::string& _request_name) const;
+
+    /**
+     * @brief Function for the client to look up a parameter in the layout announced by the server.
+     *
+     * Aborts if the server didn't announce a layout with set_parameter_layout(),
+     * or if the name isn't in exactly one of its groups. See ParameterValues.
+     *
+     * @param _parameter_name Parameter name, e.g. "Theta23"
+     * @return Group and position of the parameter in the positional /set_parameters requests
+     */
+    ParameterHandle param(const std::string& _parameter_name) const;
+
+    /**
+     * @brief Function for the client to send a struct request and read the response into a struct.
+     *
+     * The request needs a nlohmann::json conversion. A response whose fields
+     * are listed with NUDOCK_SAX_FIELDS is decoded straight from the received
+     * message, without a json value, other types are converted from the json
+     * response, see register_response(). The response type must be given
+     * explicitly, e.g. `send_request<LogLikelihood>("/log_likelihood", "")`.
+     *
+     * @param _request Request ID name
+     * @param _message Request message
+     * @return Response from the server
+     */
+    template <class Response, class Request>
+    Response send_request(const std::string& _request_name,
+                          const Request& _message);
+
+    /**
+     * @brief Function for the client to send a struct request to an endpoint looked up with endpoint().
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _message Request message
+     * @return Response from the server
+     */
+    template <class Response, class Request>
+    Response send_request(EndpointHandle _endpoint,
+                          const Request& _message);
+
+    /**
+     * @brief Function for the client to send a request and read the response as SAX events.
+     *
+     * The response is decoded straight from the received message into the
+     * handler, e.g. a SaxDecoder filling a struct, without building a json
+     * value. With IN_PROCESS or arrays sent in a memfd, the handler gets the
+     * events of the json response value instead. Aborts if the request fails.
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _message json object with the request message
+     * @param _handler SAX handler reading the response
+     * @return false if the handler stopped reading the response
+     */
+    bool send_request_sax(EndpointHandle _endpoint,
+                          const nlohmann::json& _message,
+                          nlohmann::json_sax<nlohmann::json>& _handler);
+
+#ifdef NUDOCK_SIMDJSON
+    /**
+     * @brief Function for the client to send a request and read the response with simdjson's on-demand parser.
+     *
+     * Only available when NuDock is built with -DNUDOCK_ENABLE_SIMDJSON=ON.
+     * The reader only decodes the fields it reads, e.g. a large spectrum,
+     * without the response being parsed into a nlohmann::json value first.
+     * The document is only valid during the call to the reader, which must not
+     * send on-demand requests itself. With a binary
+     * encoding, IN_PROCESS or arrays sent in a memfd, the response is turned
+     * back into json text first.
+     *
+     * @param _request Request ID name
+     * @param _message json object with the request message
+     * @param _reader Function reading the response document
+     */
+    void send_request_ondemand(const std::string& _request_name,
+                               const nlohmann::json& _message,
+                               const OnDemandReader& _reader);
+#endif
+
+    /**
+     * @brief Function for the client to send a request to an endpoint generated by nudock_codegen.
+     *
+     * @param _message Request message
+     * @return Response from the server, checked against the schema while decoding it
+     */
+    template <class Endpoint>
+    typename Endpoint::Response send_request(const typename Endpoint::Request& _message);
+
+    /**
+     * @brief Function for the client to send several requests at once.
+     *
+     * With WireProtocol::NUDOCK all the requests are written out before
+     * waiting for any response, so they are in flight together on the one
+     * connection (e.g. one likelihood per ensemble walker). With the other
+     * transports they are sent one after the other.
+     *
+     * send_request() and send_requests() can be called from several threads
+     * at once, e.g. one per chain, sharing the same connection.
+     *
+     * @param _requests Pairs of request ID name and json request message
+     * @return json responses from the server, in the same order as the requests
+     */
+    std::vector<nlohmann::json> send_requests(const std::vector<std::pair<std::string, nlohmann::json>>& _requests);
+
+    /**
+     * @brief Function for the client to send a request without waiting for the response.
+     *
+     * The caller can carry on (e.g. propose the next step, evaluate the priors)
+     * while the server is working, and collect the response from the future.
+     *
+     * If the request fails, the future throws a std::runtime_error instead of
+     * the client aborting.
+     *
+     * @param _request Request ID name
+     * @param _message json object with the request message
+     * @return future holding the json response from the server
+     */
+    std::future<nlohmann::json> send_request_async(const std::string& _request_name,
+                                                   const nlohmann::json& _message);
+
+    /**
+     * @brief Function for the client to send a request and get the response through a callback.
+     *
+     * With WireProtocol::NUDOCK the callback runs on the client's I/O thread
+     * (or on a thread waiting in send_request()). With the other transports
+     * the requests are sent in order by a background thread, which also runs
+     * the callbacks. Callbacks should be short and must not block on other
+     * asynchronous requests. The client aborts if the request fails, exceptions
+     * thrown by the callback are the caller's to handle.
+     *
+     * @param _request Request ID name
+     * @param _message json object with the request message
+     * @param _callback Function receiving the json response from the server
+     */
+    void send_request_async(const std::string& _request_name,
+                            const nlohmann::json& _message,
+                            ResponseCallback _callback);
+
+    /**
+     * @brief Function for the client to fetch the server's parameter layout through /get_parameter_names.
+     *
+     * Called once after start_client(). From then on /set_parameters can send
+     * each group as an array of values in the layout's order, instead of an
+     * object keyed by parameter name. See nudock_parameters.hpp. If the server
+     * announced its layout in /validate_start, that one is returned without a request.
+     *
+     * @return Ordered parameter names of each group
+     */
+    ParameterLayout fetch_parameter_layout();
+
+  protected:
+    /**
+     * @brief NuDock constructor, see NuDock.
+     *
+     * The requests are not validated until the derived BasicNuDock sets its policy.
+     */
+    NuDockBase(bool _debug,
+               const std::string& _default_schemas_location,
+               const CommunicationType& _comm_type,
+               const int& _port);
+
+    /// @brief Processes the requests with the validation of the policy, one of those in nudock_validation.hpp
+    template <class ValidationPolicy>
+    void use_validation_policy()
+    {
+      m_process_message = &NuDockBase::process_message<ValidationPolicy>;
+      m_process_value = &NuDockBase::process_value<ValidationPolicy>;
+      m_validate_request = ValidationPolicy::requests ? &NuDockBase::validate_request<ValidationPolicy> : nullptr;
+      m_asynchronous_validation = ValidationPolicy::asynchronous;
+    }
+
   // Private member functions
   private:
     /**
@@ -147,6 +672,302 @@ class NuDock
      */
     bool validate_start(const nlohmann::json& _message);
 
+    /**
+     * @brief Server: processes a single request, independently of the transport.
+     *
+     * Looks up the endpoint id of the request name, see the overload below.
+     *
+     * @param _request_name Request ID name, e.g. "/set_parameters"
+     * @param _body Serialised request message, taken over by AsyncValidation, see the overload below
+     * @param _response_body Filled with the serialised response, or the error message
+     * @param _encoding Encoding of the request, used for the response as well. /validate_start is always json.
+     * @param _attached_fd Given if the transport can pass file descriptors: the large binary
+     *        arrays of the response are then moved into a sealed memfd returned here, or -1
+     * @return Status code, following the HTTP ones: 200, 400 or 404
+     */
+    int process_request(const std::string& _request_name,
+                        std::string& _body,
+                        std::string& _response_body,
+                        MessageEncoding _encoding = MessageEncoding::JSON,
+                        int* _attached_fd = nullptr);
+
+    /**
+     * @brief Server: processes a single request to an endpoint id, independently of the transport.
+     *
+     * Parses the request, validates it (as the policy says), calls the
+     * registered handler and validates & serialises its response.
+     *
+     * With AsyncValidation, the body is swapped into the job of the validation
+     * thread instead of copied, so the transport must not read it afterwards.
+     *
+     * @param _endpoint Endpoint id of the request, 0 for /validate_start
+     * @param _body Serialised request message, left empty or unspecified if taken over
+     * @param _response_body Filled with the serialised response, or the error message
+     * @param _encoding Encoding of the request, used for the response as well. /validate_start is always json.
+     * @param _attached_fd Given if the transport can pass file descriptors: the large binary
+     *        arrays of the response are then moved into a sealed memfd returned here, or -1
+     * @return Status code, following the HTTP ones: 200, 400 or 404
+     */
+    int process_request(uint32_t _endpoint,
+                        std::string& _body,
+                        std::string& _response_body,
+                        MessageEncoding _encoding = MessageEncoding::JSON,
+                        int* _attached_fd = nullptr);
+
+    /**
+     * @brief Server: processes a single, already parsed, request.
+     *
+     * Validates the request (as the policy says), calls the registered handler
+     * and validates its response. Used as is by CommunicationType::IN_PROCESS.
+     *
+     * The response is shared with the validation thread under AsyncValidation,
+     * whose job holds a reference instead of a copy. The request stays the
+     * caller's, which may change it once this returns, so the job copies it.
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _request json request message
+     * @param _response Set to the json response, or the error message
+     * @return Status code, following the HTTP ones: 200, 400 or 404
+     */
+    int process_request(uint32_t _endpoint,
+                        const nlohmann::json& _request,
+                        std::shared_ptr<nlohmann::json>& _response);
+
+    /**
+     * @brief Server: processes the serialised request to a known endpoint, with the validation of the policy.
+     *
+     * Defined in nudock.cpp for the policies of nudock_validation.hpp only.
+     *
+     * @param _endpoint Endpoint id of the request, not /validate_start
+     * @param _body Serialised request message
+     * @param _encoding Encoding of the request
+     * @param _response Filled with the json response, or the error message
+     * @return Status code, following the HTTP ones: 200 or 400
+     */
+    template <class ValidationPolicy>
+    int process_message(uint32_t _endpoint,
+                        const std::string& _body,
+                        MessageEncoding _encoding,
+                        nlohmann::json& _response);
+
+    /// @brief Server: same as process_message() for an already parsed request
+    template <class ValidationPolicy>
+    int process_value(uint32_t _endpoint,
+                      const nlohmann::json& _request,
+                      std::shared_ptr<nlohmann::json>& _response);
+
+    /**
+     * @brief Server: calls the handler of a parsed request, validating it and its response if _validate.
+     *
+     * With a policy validating neither, the validation is compiled out.
+     */
+    template <class ValidationPolicy>
+    int call_handler(uint32_t _endpoint,
+                     const nlohmann::json& _request,
+                     nlohmann::json& _response,
+                     bool _validate);
+
+    /**
+     * @brief Client: validates an outgoing request against the server's schema of its endpoint, aborting if it fails.
+     *
+     * Requests of a structure that passed before are not validated again, see
+     * structural_fingerprint(), unless the schema has value constraints.
+     */
+    template <class ValidationPolicy>
+    void validate_request(uint32_t _endpoint, const nlohmann::json& _message);
+
+    /// @brief Server: whether the next request to the endpoint is validated under the policy, counting the skipped ones
+    template <class ValidationPolicy>
+    bool validates_next_request(uint32_t _endpoint);
+
+    /**
+     * @brief Server: sets up one transport, ready to be served.
+     *
+     * @param _comm_type Communication type to serve on
+     * @param _port Port number, or name of the socket file / memory region
+     * @return Blocking function serving the transport until stopped, empty if the transport could not be set up
+     */
+    std::function<void()> open_transport(CommunicationType _comm_type, int _port);
+
+    /**
+     * @brief Server: processes a serialised request with its SAX handler, without validation.
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _body Serialised request message
+     * @param _encoding Encoding of the request
+     * @param _response Filled with the json response, or the error message
+     * @return Status code, following the HTTP ones: 200 or 400
+     */
+    int process_request_sax(uint32_t _endpoint,
+                            const std::string& _body,
+                            MessageEncoding _encoding,
+                            nlohmann::json& _response);
+
+#ifdef NUDOCK_SIMDJSON
+    /**
+     * @brief Server: processes a json text request with its on-demand handler, without validation.
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _body json text of the request message
+     * @param _response Filled with the json response, or the error message
+     * @return Status code, following the HTTP ones: 200 or 400
+     */
+    int process_request_ondemand(uint32_t _endpoint,
+                                 const std::string& _body,
+                                 nlohmann::json& _response);
+#endif
+
+    /**
+     * @brief Server: creates an httplib server and routes all the requests to process_request().
+     *
+     * @return The server, nullptr if it could not be created
+     */
+    httplib::Server* setup_http_server();
+
+    /**
+     * @brief Server: creates a server for NuDock frames on a unix domain socket or TCP.
+     *
+     * @param _comm_type CommunicationType::UNIX_DOMAIN_SOCKET or CommunicationType::TCP
+     * @return The server, to listen on
+     */
+    FramedServer* setup_framed_server(CommunicationType _comm_type);
+
+    /**
+     * @brief Server: answers a request of an encoding value this build doesn't know with 400.
+     *
+     * @return The status code, 400
+     */
+    int unknown_encoding(uint8_t _encoding, std::string& _response_body);
+
+    /**
+     * @brief Server: serves requests from the shared-memory rings until stopped.
+     */
+    void serve_shared_memory();
+
+    /**
+     * @brief Server: stops serving requests, whichever transport is used.
+     */
+    void stop_server();
+
+    /**
+     * @brief Client: sends a serialised request over the selected transport.
+     *
+     * @param _endpoint Endpoint id of the request
+     * @param _body Serialised request message
+     * @param _response_body Filled with the serialised response
+     * @param _attached_fd Filled with the memfd passed along with the response, or -1
+     * @return Status code of the response, 0 if there was no response at all
+     */
+    int transmit(uint32_t _endpoint,
+                 const std::string& _body,
+                 std::string& _response_body,
+                 int& _attached_fd);
+
+    /**
+     * @brief Looks up the endpoint id of a request name: on the server the one
+     *        it registered, on the client the one the server announced.
+     *
+     * @param _request_name Request ID name
+     * @param _endpoint Filled with the endpoint id
+     * @return false if the server doesn't know the request
+     */
+    bool find_endpoint(const std::string& _request_name, uint32_t& _endpoint) const;
+
+    /**
+     * @brief Client: background thread sending the asynchronous requests over transports without multiplexing.
+     */
+    void run_async_requests();
+
+    /// @brief Server, AsyncValidation: request and response waiting to be validated
+    struct ValidationJob {
+      uint32_t endpoint;
+      /// @brief serialised request, unless it came already parsed
+      std::string body;
+      MessageEncoding encoding = MessageEncoding::JSON;
+      bool parsed = false;
+      nlohmann::json request;
+      nlohmann::json response;
+      /// @brief IN_PROCESS response, shared with the client instead of response
+      std::shared_ptr<const nlohmann::json> shared_response;
+      /// @brief memfd holding the large binary arrays moved out of the response, or -1
+      int attached_fd = -1;
+    };
+
+    /// @brief Server, AsyncValidation: queues a processed request for the validation thread, skipping it if the queue is full
+    void queue_validation(ValidationJob&& _job);
+
+    /// @brief Server, AsyncValidation: background thread validating the queued requests and responses
+    void run_validations();
+
+    /// @brief Server, AsyncValidation: validates one queued request and its response, reporting a violation
+    void validate_job(ValidationJob& _job);
+
+    /**
+     * @brief Client: parses a response, aborting if the request failed.
+     *
+     * @param _status Status code of the response
+     * @param _response_body Serialised response message
+     * @param _message json request message, printed if the request failed
+     * @param _attached_fd memfd passed along with the response holding its large binary arrays, or -1
+     * @return json response message
+     */
+    nlohmann::json parse_response(int _status,
+                                  const std::string& _response_body,
+                                  const nlohmann::json& _message,
+                                  int _attached_fd = -1);
+
+    /**
+     * @brief Client: parses a response, throwing a std::runtime_error if the request failed.
+     *
+     * @param _status Status code of the response
+     * @param _response_body Serialised response message
+     * @param _attached_fd memfd passed along with the response holding its large binary arrays, or -1
+     * @return json response message
+     */
+    nlohmann::json decode_response(int _status,
+                                   const std::string& _response_body,
+                                   int _attached_fd = -1);
+
+    /**
+     * @brief Client: sends a request and waits for its response, throwing if it failed.
+     *
+     * send_request() without the abort, for the asynchronous requests.
+     *
+     * @param _endpoint Endpoint of the request
+     * @param _message json object with the request message
+     * @param _attached_fd If given, filled with the memfd passed along with the response,
+     *        or -1, instead of restoring its arrays into the response
+     * @return json response from the server
+     */
+    nlohmann::json exchange(EndpointHandle _endpoint, const nlohmann::json& _message, int* _attached_fd = nullptr);
+
+    /// @brief Client: receives the failure of an asynchronous request
+    using FailureCallback = std::function<void(std::exception_ptr)>;
+
+    /**
+     * @brief Client: send_request_async() passing the failures to _on_failure instead of aborting.
+     *
+     * @param _request Request ID name
+     * @param _message json object with the request message
+     * @param _callback Function receiving the json response from the server
+     * @param _on_failure Function receiving the failure, nullptr to abort
+     */
+    void send_request_async(const std::string& _request_name,
+                            const nlohmann::json& _message,
+                            ResponseCallback _callback,
+                            FailureCallback _on_failure);
+
+    /**
+     * @brief Client: reports the failure of an asynchronous request to _on_failure, or aborts without one.
+     *
+     * @param _request Request ID name
+     * @param _error Failure of the request
+     * @param _on_failure Function receiving the failure, or nullptr
+     */
+    void fail_async_request(const std::string& _request,
+                            const std::exception& _error,
+                            const FailureCallback& _on_failure);
+
     /**
      * @brief Loads json object from a given file path.
      * 
@@ -160,24 +981,105 @@ class NuDock
     /// @brief version of the server/client.
     std::string m_version = NUDOCK_VERSION;
 
-    /// @brief server object with external experiment
-    std::unique_ptr<httplib::Server> m_server;
+    /// @brief server objects with external experiment, one per transport
+    std::vector<std::unique_ptr<httplib::Server>> m_servers;
 
     /// @brief client requesting responses from external experiment
     std::unique_ptr<httplib::Client> m_client;
 
-    /// @brief map of request names to their handler functions
-    std::unordered_map<std::string, HandlerFunction> m_request_handlers;
+    /// @brief servers / client speaking NuDock frames with WireProtocol::NUDOCK
+    std::vector<std::unique_ptr<FramedServer>> m_framed_servers;
+    std::unique_ptr<FramedClient> m_framed_client;
+
+    /// @brief server called directly by the client with CommunicationType::IN_PROCESS
+    NuDockBase* m_in_process_server = nullptr;
+
+    /// @brief port under which the server is available to in-process clients, -1 if it isn't
+    int m_in_process_port = -1;
 
-    /// @brief map of request names to their schema validators
-    std::unordered_map<std::string, SchemaValidator> m_schema_validator;
+    /// @brief shared-memory channel, used by both server and client with CommunicationType::SHARED_MEMORY
+    std::unique_ptr<SharedMemoryChannel> m_shm_channel;
 
-    nlohmann::json m_request;
-    nlohmann::json m_response;
+    /// @brief the shared-memory rings carry one request at a time
+    std::mutex m_shm_mutex;
 
-    /// @brief whether we want to print debug messages
+    /// @brief queue of asynchronous requests for transports that can't multiplex them
+    std::thread m_async_thread;
+    std::mutex m_async_mutex;
+    std::condition_variable m_async_cv;
+    std::deque<std::function<void()>> m_async_requests;
+    bool m_async_done = false;
+
+    /// @brief size of each of the shared-memory rings in bytes
+    uint64_t m_shm_capacity = 16 * 1024 * 1024;
+
+    /// @brief whether the server is (still) serving requests
+    std::atomic<bool> m_running;
+
+    /// @brief Validation state of one endpoint, see ValidationCounters
+    struct EndpointValidation {
+      std::atomic<uint64_t> requests{0};
+      std::atomic<uint64_t> validated{0};
+      std::atomic<uint64_t> skipped{0};
+      std::atomic<uint64_t> failed{0};
+      /// @brief requests that passed since the last failure
+      std::atomic<uint64_t> consecutive_passes{0};
+      /// @brief client: structural fingerprints of the requests that passed, at most MAX_SHAPES
+      std::mutex shapes_mutex;
+      std::unordered_set<uint64_t> shapes;
+      static constexpr size_t MAX_SHAPES = 1024;
+    };
+
+    /// @brief Everything about one endpoint, found by id without hashing the request name
+    struct EndpointEntry {
+      std::string name;
+      /// @brief server: handler function and schema validators, empty on the client
+      HandlerFunction handler;
+      SchemaValidator validator;
+      /// @brief server: handler decoding the request as SAX events instead, if any
+      SaxHandlerFactory sax_handler;
+#ifdef NUDOCK_SIMDJSON
+      /// @brief server: handler reading json text requests on demand instead, if any
+      OnDemandHandlerFunction ondemand_handler;
+#endif
+      /// @brief validation counters, updated by concurrent requests
+      std::unique_ptr<EndpointValidation> validation;
+    };
+
+    /// @brief endpoints by id, id 0 is reserved for /validate_start. On the client only the names announced by the server.
+    std::vector<EndpointEntry> m_endpoints;
+
+    /// @brief endpoint ids by request name, as announced by the server in /validate_start
+    std::unordered_map<std::string, uint32_t> m_endpoint_ids;
+
+    /// @brief server: parameter layout announced in /validate_start. Client: the announced one, if any.
+    ParameterLayout m_parameter_layout;
+
+    /// @brief whether we want to print debug messages, and validate with DebugValidation if that's the policy
     bool m_debug;
 
+    /// @brief request processing of the validation policy, see use_validation_policy()
+    int (NuDockBase::*m_process_message)(uint32_t, const std::string&, MessageEncoding, nlohmann::json&);
+    int (NuDockBase::*m_process_value)(uint32_t, const nlohmann::json&, std::shared_ptr<nlohmann::json>&);
+    /// @brief client: request validation of the policy, nullptr if it doesn't validate requests
+    void (NuDockBase::*m_validate_request)(uint32_t, const nlohmann::json&);
+    /// @brief server: the serialised requests are queued for the validation thread once answered, see AsyncValidation
+    bool m_asynchronous_validation = false;
+
+    /// @brief requests of every endpoint validated by SampledValidation
+    ValidationSampling m_validation_sampling;
+
+    /// @brief AsyncValidation: queue of the validation thread, bounded by MAX_QUEUED_VALIDATIONS
+    std::thread m_validation_thread;
+    std::mutex m_validation_mutex;
+    std::condition_variable m_validation_cv;
+    std::deque<ValidationJob> m_validation_jobs;
+    bool m_validation_done = false;
+    static constexpr size_t MAX_QUEUED_VALIDATIONS = 1024;
+
+    /// @brief AsyncValidation: called on the violations, see set_validation_failure_hook()
+    ValidationFailureHook m_validation_failure_hook;
+
     /// @brief string prefix for debugging messages
     std::string m_debug_prefix;
 
@@ -187,8 +1089,159 @@ class NuDock
     custom_throwing_error_handler m_err;
 
     /// @brief Counter for the number of requests sent / processed
-    uint64_t m_request_counter;
+    std::atomic<uint64_t> m_request_counter;
 
     CommunicationType m_comm_type;
     int m_port;
-};
\ No newline at end of file
+
+    /// @brief transports served on top of m_comm_type, with their ports
+    std::vector<std::pair<CommunicationType, int>> m_additional_transports;
+
+    /// @brief socket settings for CommunicationType::TCP
+    TcpOptions m_tcp_options;
+
+    /// @brief client: encoding asked for in /validate_start, and the one agreed with the server
+    MessageEncoding m_preferred_encoding;
+    MessageEncoding m_encoding;
+
+    /// @brief client: compression asked for in /validate_start, and the one agreed with the server
+    Compression m_preferred_compression = Compression::NONE;
+    Compression m_compression = Compression::NONE;
+
+    /// @brief payloads smaller than this many bytes are sent uncompressed
+    size_t m_compression_threshold = DEFAULT_COMPRESSION_THRESHOLD;
+
+    /// @brief protocol spoken over unix domain sockets and TCP
+    WireProtocol m_wire_protocol;
+
+    /// @brief number of requests the server processes at the same time with WireProtocol::NUDOCK
+    unsigned m_max_concurrent_requests;
+
+    /// @brief largest payload accepted from the peer
+    uint64_t m_max_payload_size = MAX_FRAME_PAYLOAD;
+};
+
+/**
+ * @brief NuDock server / client, validating the messages as set by the policy.
+ *
+ * Constructor for NuDock api instance, which can be used as a server or a
+ * client. The validation policy is one of those in nudock_validation.hpp,
+ * NuDock itself doesn't validate:
+ *
+ * @code
+ *   NuDock dock(true, "", CommunicationType::TCP);                         // logging, no validation
+ *   BasicNuDock<FullValidation> dock(false, "", CommunicationType::TCP);   // quiet, but checking every message
+ * @endcode
+ *
+ * @tparam ValidationPolicy Schema validation done by the server
+ */
+template <class ValidationPolicy>
+class BasicNuDock : public NuDockBase
+{
+  public:
+    /**
+     * @brief NuDock constructor
+     *
+     * @param _debug Whether to print extra debug messages. Only validates as well with DebugValidation.
+     * @param _default_schemas_location Default location of the json schemas. Using NuDock install folder if not specified.
+     * @param _comm_type Communication type between server and client, default is localhost. Unix domain sockets and shared memory are faster, but only work on the same machine. TCP works across machines, see set_tcp_options(). In-process calls the server's handlers directly, with no serialisation at all.
+     * @param _port Port number for communication, default is 1234. For unix domain sockets and shared memory it only names the socket file / memory region.
+     */
+    BasicNuDock(bool _debug=true,
+                const std::string& _default_schemas_location=NUDOCK_SCHEMAS_DIR,
+                const CommunicationType& _comm_type=CommunicationType::LOCALHOST,
+                const int& _port=1234)
+        : NuDockBase(_debug, _default_schemas_location, _comm_type, _port)
+    {
+      use_validation_policy<ValidationPolicy>();
+    }
+};
+
+/**
+ * @brief NuDock server / client without schema validation, _debug only turns the logging on.
+ *
+ * A class rather than an alias, so that it can still be forward declared.
+ */
+class NuDock : public BasicNuDock<NoValidation>
+{
+  public:
+    using BasicNuDock<NoValidation>::BasicNuDock;
+};
+
+template <class Request, class Response>
+void NuDockBase::register_response(const std::string& _request_name,
+                               std::function<Response(const Request&)> _handler_function,
+                               const std::string& _schema_path)
+{
+  if constexpr (is_sax_decodable<Request>) {
+    // Decoded straight into the request struct, shared by the handlers of all the requests
+    auto function = std::make_shared<const std::function<Response(const Request&)>>(std::move(_handler_function));
+    register_response_sax(_request_name,
+        [function]() -> std::unique_ptr<SaxRequestHandler> {
+          return std::make_unique<StructRequestHandler<Request, Response>>(function);
+        },
+        _schema_path);
+  }
+  else {
+    register_response(_request_name,
+        [handler = std::move(_handler_function)](const nlohmann::json& _request) -> nlohmann::json {
+          return handler(_request.get<Request>());
+        },
+        _schema_path);
+  }
+}
+
+template <class Handler, std::enable_if_t<is_typed_handler<Handler>, int>>
+void NuDockBase::register_response(const std::string& _request_name,
+                               Handler _handler_function,
+                               const std::string& _schema_path)
+{
+  using Request = typename HandlerTraits<Handler>::request;
+  using Response = std::decay_t<typename HandlerTraits<Handler>::response>;
+  register_response<Request, Response>(_request_name,
+                                       std::function<Response(const Request&)>(std::move(_handler_function)),
+                                       _schema_path);
+}
+
+template <class Response, class Request>
+Response NuDockBase::send_request(const std::string& _request_name,
+                              const Request& _message)
+{
+  return send_request<Response>(endpoint(_request_name), _message);
+}
+
+template <class Response, class Request>
+Response NuDockBase::send_request(EndpointHandle _endpoint,
+                              const Request& _message)
+{
+  if constexpr (is_sax_decodable<Response>) {
+    Response response{};
+    SaxDecoder decoder(response);
+    if (!send_request_sax(_endpoint, nlohmann::json(_message), decoder) || !decoder.done()) {
+      std::cerr << DEBUG() << "Unexpected response to " << m_endpoints[_endpoint.id].name << std::endl;
+      std::abort();
+    }
+    return response;
+  }
+  else {
+    nlohmann::json response = send_request(_endpoint, nlohmann::json(_message));
+    try {
+      return response.get<Response>();
+    } catch (const std::exception& e) {
+      std::cerr << DEBUG() << "Unexpected response to " << m_endpoints[_endpoint.id].name << ": " << e.what() << std::endl;
+      std::abort();
+    }
+  }
+}
+
+template <class Endpoint>
+void NuDockBase::register_response(std::function<typename Endpoint::Response(const typename Endpoint::Request&)> _handler_function)
+{
+  register_response<typename Endpoint::Request, typename Endpoint::Response>(Endpoint::name, std::move(_handler_function));
+}
+
+template <class Endpoint>
+typename Endpoint::Response NuDockBase::send_request(const typename Endpoint::Request& _message)
+{
+  return send_request<typename Endpoint::Response>(Endpoint::name, _message);
+}
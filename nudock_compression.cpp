@@ -0,0 +1,201 @@
+#include "nudock_compression.hpp"
+
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#ifdef NUDOCK_LZ4
+#include <lz4.h>
+#endif
+#ifdef NUDOCK_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+/// @brief The decompressed size is the sender's word, checked before allocating anything
+void check_payload_size(uint64_t _size, uint64_t _max_size)
+{
+  if (_size > _max_size) {
+    throw std::invalid_argument("Decompressed payload of " + std::to_string(_size) +
+                                " bytes is above the maximum payload size of " + std::to_string(_max_size) + " bytes");
+  }
+}
+
+#ifdef NUDOCK_LZ4
+/// @brief LZ4 blocks don't record their original size, so it goes in front of them
+using Lz4SizePrefix = uint64_t;
+
+void lz4_compress(const std::string& _payload, std::string& _compressed)
+{
+  if (_payload.size() > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) {
+    throw std::invalid_argument("Payload of " + std::to_string(_payload.size()) + " bytes is too large for LZ4");
+  }
+  const int bound = LZ4_compressBound(static_cast<int>(_payload.size()));
+  _compressed.resize(sizeof(Lz4SizePrefix) + bound);
+  const Lz4SizePrefix size = _payload.size();
+  std::memcpy(&_compressed[0], &size, sizeof(size));
+  const int compressed_size = LZ4_compress_default(_payload.data(), &_compressed[sizeof(Lz4SizePrefix)],
+                                                   static_cast<int>(_payload.size()), bound);
+  if (compressed_size <= 0) {
+    throw std::runtime_error("LZ4 compression failed");
+  }
+  _compressed.resize(sizeof(Lz4SizePrefix) + compressed_size);
+}
+
+void lz4_decompress(const std::string& _compressed, std::string& _payload, uint64_t _max_size)
+{
+  Lz4SizePrefix size;
+  if (_compressed.size() < sizeof(size)) {
+    throw std::invalid_argument("Truncated LZ4 payload");
+  }
+  std::memcpy(&size, _compressed.data(), sizeof(size));
+  if (size > static_cast<Lz4SizePrefix>(LZ4_MAX_INPUT_SIZE)) {
+    throw std::invalid_argument("Invalid LZ4 payload size " + std::to_string(size));
+  }
+  check_payload_size(size, _max_size);
+  _payload.resize(size);
+  const int decompressed_size = LZ4_decompress_safe(_compressed.data() + sizeof(size), &_payload[0],
+                                                    static_cast<int>(_compressed.size() - sizeof(size)),
+                                                    static_cast<int>(size));
+  if (decompressed_size < 0 || static_cast<Lz4SizePrefix>(decompressed_size) != size) {
+    throw std::invalid_argument("Corrupted LZ4 payload");
+  }
+}
+#endif
+
+#ifdef NUDOCK_ZSTD
+/// @brief The links are bandwidth-bound, so the level stays low to keep up with them
+constexpr int ZSTD_LEVEL = 1;
+
+void zstd_compress(const std::string& _payload, std::string& _compressed)
+{
+  // Contexts made once per thread, reused from one payload to the next
+  thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+  _compressed.resize(ZSTD_compressBound(_payload.size()));
+  const size_t compressed_size = ZSTD_compressCCtx(context.get(), &_compressed[0], _compressed.size(),
+                                                   _payload.data(), _payload.size(), ZSTD_LEVEL);
+  if (ZSTD_isError(compressed_size)) {
+    throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(compressed_size));
+  }
+  _compressed.resize(compressed_size);
+}
+
+void zstd_decompress(const std::string& _compressed, std::string& _payload, uint64_t _max_size)
+{
+  thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+  const unsigned long long size = ZSTD_getFrameContentSize(_compressed.data(), _compressed.size());
+  if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > std::numeric_limits<size_t>::max()) {
+    throw std::invalid_argument("Invalid zstd payload");
+  }
+  check_payload_size(size, _max_size);
+  _payload.resize(size);
+  const size_t decompressed_size = ZSTD_decompressDCtx(context.get(), &_payload[0], _payload.size(),
+                                                       _compressed.data(), _compressed.size());
+  if (ZSTD_isError(decompressed_size) || decompressed_size != size) {
+    throw std::invalid_argument("Corrupted zstd payload");
+  }
+}
+#endif
+
+/// @brief Compressions by name, for the /validate_start negotiation
+struct CompressionInfo {
+  Compression compression;
+  const char* name;
+};
+
+constexpr CompressionInfo COMPRESSIONS[] = {
+  {Compression::NONE, "none"},
+  {Compression::LZ4, "lz4"},
+  {Compression::ZSTD, "zstd"},
+};
+
+} // namespace
+
+bool compression_available(Compression _compression)
+{
+  switch (_compression) {
+    case Compression::NONE:
+      return true;
+    case Compression::LZ4:
+#ifdef NUDOCK_LZ4
+      return true;
+#else
+      return false;
+#endif
+    case Compression::ZSTD:
+#ifdef NUDOCK_ZSTD
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+const char* compression_name(Compression _compression)
+{
+  for (const auto& info : COMPRESSIONS) {
+    if (info.compression == _compression) {
+      return info.name;
+    }
+  }
+  throw std::invalid_argument("Unknown compression " + std::to_string(static_cast<int>(_compression)));
+}
+
+bool compression_from_name(const std::string& _name, Compression& _compression)
+{
+  for (const auto& info : COMPRESSIONS) {
+    if (_name == info.name) {
+      _compression = info.compression;
+      return true;
+    }
+  }
+  return false;
+}
+
+void compress_payload(const std::string& _payload, Compression _compression, std::string& _compressed)
+{
+  switch (_compression) {
+    case Compression::NONE:
+      _compressed = _payload;
+      return;
+#ifdef NUDOCK_LZ4
+    case Compression::LZ4:
+      lz4_compress(_payload, _compressed);
+      return;
+#endif
+#ifdef NUDOCK_ZSTD
+    case Compression::ZSTD:
+      zstd_compress(_payload, _compressed);
+      return;
+#endif
+    default:
+      break;
+  }
+  throw std::invalid_argument("NuDock was built without compression " + std::to_string(static_cast<int>(_compression)));
+}
+
+void decompress_payload(const std::string& _compressed, Compression _compression, std::string& _payload, uint64_t _max_size)
+{
+  switch (_compression) {
+    case Compression::NONE:
+      check_payload_size(_compressed.size(), _max_size);
+      _payload = _compressed;
+      return;
+#ifdef NUDOCK_LZ4
+    case Compression::LZ4:
+      lz4_decompress(_compressed, _payload, _max_size);
+      return;
+#endif
+#ifdef NUDOCK_ZSTD
+    case Compression::ZSTD:
+      zstd_decompress(_compressed, _payload, _max_size);
+      return;
+#endif
+    default:
+      break;
+  }
+  throw std::invalid_argument("NuDock was built without compression " + std::to_string(static_cast<int>(_compression)));
+}
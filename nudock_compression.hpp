@@ -0,0 +1,74 @@
+/**
+ * @file nudock_compression.hpp
+ *
+ * @brief Compression of large message payloads on TCP links.
+ *
+ * Over a shared network, requests and responses carrying per-bin spectra,
+ * batches of parameter sets or toy datasets are limited by the bandwidth.
+ * Client and server can agree on a compression during /validate_start, after
+ * which payloads at or above a size threshold are compressed, and the small
+ * ones (e.g. a likelihood call) go through unchanged. Each compressed payload
+ * is marked as such: in the FrameHeader flags with NuDock frames, in the
+ * X-NuDock-Compression header over HTTP.
+ *
+ * The compressions are only available if NuDock is built with them, see the
+ * NUDOCK_ENABLE_LZ4 and NUDOCK_ENABLE_ZSTD CMake options.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// @brief Compression of a message payload
+enum class Compression : uint8_t {
+  NONE = 0,
+  /// Fastest, for links where the compression itself must not cost more than it saves
+  LZ4 = 1,
+  /// Better ratio, still fast at the level used
+  ZSTD = 2,
+};
+
+/// @brief Payloads smaller than this many bytes are not compressed by default
+constexpr size_t DEFAULT_COMPRESSION_THRESHOLD = 16 * 1024;
+
+/// @brief HTTP headers marking a compressed payload, and the compression a client takes for the response
+constexpr const char* COMPRESSION_HEADER = "X-NuDock-Compression";
+constexpr const char* ACCEPT_COMPRESSION_HEADER = "X-NuDock-Accept-Compression";
+
+/// @brief Whether NuDock was built with the compression
+bool compression_available(Compression _compression);
+
+/// @brief Name of the compression used in the /validate_start negotiation, e.g. "lz4"
+const char* compression_name(Compression _compression);
+
+/**
+ * @brief Looks up a compression by the name used in the /validate_start negotiation.
+ *
+ * @return false if the compression is unknown
+ */
+bool compression_from_name(const std::string& _name, Compression& _compression);
+
+/**
+ * @brief Compresses a payload into an existing buffer.
+ *
+ * @param _payload Payload to compress
+ * @param _compression Compression to use, must be available
+ * @param _compressed Filled with the compressed payload, its capacity is kept
+ */
+void compress_payload(const std::string& _payload, Compression _compression, std::string& _compressed);
+
+/**
+ * @brief Decompresses a payload into an existing buffer.
+ *
+ * The original size recorded by the sender is checked against _max_size
+ * before the buffer is resized, so a small payload can't make the receiver
+ * allocate gigabytes.
+ *
+ * @param _compressed Compressed payload
+ * @param _compression Compression used by the sender
+ * @param _payload Filled with the original payload, its capacity is kept
+ * @param _max_size Largest original payload accepted, in bytes, e.g. MAX_FRAME_PAYLOAD
+ */
+void decompress_payload(const std::string& _compressed, Compression _compression, std::string& _payload, uint64_t _max_size);
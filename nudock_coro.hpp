@@ -0,0 +1,228 @@
+/**
+ * @file nudock_coro.hpp
+ *
+ * @brief C++20 coroutine client interface on top of NuDock's asynchronous requests.
+ *
+ * Only available when NuDock is built with -DNUDOCK_ENABLE_COROUTINES=ON.
+ * One client thread can drive many chains (or sampler walkers) at once, each
+ * of them a coroutine suspended while its request is with the server:
+ *
+ * @code
+ *   NuDockTask chain(AsyncDock& dock, int id) {
+ *     for (int step = 0; step < 1000; ++step) {
+ *       co_await dock.call("/set_parameters", propose(id));
+ *       nlohmann::json logl = co_await dock.call("/log_likelihood", "");
+ *     }
+ *   }
+ *
+ *   AsyncDock dock(client);
+ *   for (int id = 0; id < 200; ++id) dock.spawn(chain(dock, id));
+ *   dock.run();
+ * @endcode
+ */
+
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "nudock_coro.hpp requires C++20 coroutines, build with -DNUDOCK_ENABLE_COROUTINES=ON"
+#endif
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "nudock.hpp"
+
+class AsyncDock;
+
+/// @brief Coroutine started with AsyncDock::spawn(), e.g. one MCMC chain
+class NuDockTask
+{
+  public:
+    struct promise_type {
+      AsyncDock* dock = nullptr;
+
+      NuDockTask get_return_object()
+      {
+        return NuDockTask(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+      // Tasks only start running once spawned on the event loop
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      auto final_suspend() noexcept;
+      void return_void() {}
+      void unhandled_exception();
+    };
+
+    NuDockTask(NuDockTask&& _other) noexcept : m_handle(std::exchange(_other.m_handle, nullptr)) {}
+    NuDockTask(const NuDockTask&) = delete;
+    NuDockTask& operator=(const NuDockTask&) = delete;
+    ~NuDockTask()
+    {
+      if (m_handle) {
+        m_handle.destroy();
+      }
+    }
+
+  private:
+    friend class AsyncDock;
+    explicit NuDockTask(std::coroutine_handle<promise_type> _handle) : m_handle(_handle) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+/// @brief Event loop resuming the coroutines waiting on NuDock requests
+class AsyncDock
+{
+  public:
+    /// @brief Awaitable returned by call(), resumes with the json response
+    class CallAwaitable
+    {
+      public:
+        CallAwaitable(AsyncDock& _dock, std::string _request_name, nlohmann::json _message)
+            : m_dock(_dock), m_request_name(std::move(_request_name)), m_message(std::move(_message)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::coroutine_handle<> _handle)
+        {
+          {
+            std::lock_guard<std::mutex> lock(m_dock.m_mutex);
+            m_dock.m_pending_calls++;
+          }
+          m_dock.m_dock.send_request_async(m_request_name, m_message, [this, _handle](nlohmann::json response) {
+            m_response = std::move(response);
+            m_dock.post(_handle, true);
+          });
+        }
+
+        nlohmann::json await_resume() { return std::move(m_response); }
+
+      private:
+        AsyncDock& m_dock;
+        std::string m_request_name;
+        nlohmann::json m_message;
+        nlohmann::json m_response;
+    };
+
+    /**
+     * @brief AsyncDock constructor
+     *
+     * @param _dock NuDock instance with the client already started
+     */
+    explicit AsyncDock(NuDockBase& _dock) : m_dock(_dock), m_active_tasks(0) {}
+
+    /**
+     * @brief Sends a request, to be co_await-ed inside a NuDockTask.
+     *
+     * @param _request_name Request ID name, e.g. "/log_likelihood"
+     * @param _message json object with the request message
+     */
+    CallAwaitable call(std::string _request_name, nlohmann::json _message)
+    {
+      return CallAwaitable(*this, std::move(_request_name), std::move(_message));
+    }
+
+    /**
+     * @brief Schedules a coroutine to run on the event loop.
+     *
+     * @param _task Coroutine, started on the next run()
+     */
+    void spawn(NuDockTask _task)
+    {
+      auto handle = std::exchange(_task.m_handle, nullptr);
+      handle.promise().dock = this;
+      m_active_tasks++;
+      post(handle);
+    }
+
+    /**
+     * @brief Runs the coroutines on the calling thread until all of them have finished.
+     *
+     * Rethrows the first exception escaping from a coroutine, once the requests
+     * of the other coroutines have been answered and their frames destroyed.
+     * The AsyncDock and its NuDock must outlive run().
+     */
+    void run()
+    {
+      while (m_active_tasks > 0) {
+        std::coroutine_handle<> handle;
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_cv.wait(lock, [this]() { return !m_ready.empty(); });
+          handle = m_ready.front();
+          m_ready.pop_front();
+        }
+        handle.resume();
+        if (m_exception) {
+          drop_tasks();
+          std::rethrow_exception(std::exchange(m_exception, nullptr));
+        }
+      }
+    }
+
+  private:
+    friend struct NuDockTask::promise_type;
+
+    /// @brief Queues a coroutine to be resumed by run(), can be called from any thread
+    void post(std::coroutine_handle<> _handle, bool _call_done = false)
+    {
+      // Notified under the lock, run() may destroy the dock as soon as the last call is done
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_ready.push_back(_handle);
+      if (_call_done) {
+        m_pending_calls--;
+      }
+      m_cv.notify_one();
+    }
+
+    /// @brief Destroys the coroutines that haven't finished, after their requests were answered
+    void drop_tasks()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      // The callbacks of the requests still write into the frames
+      m_cv.wait(lock, [this]() { return m_pending_calls == 0; });
+      // All the unfinished coroutines are waiting to be resumed now
+      for (std::coroutine_handle<> handle : m_ready) {
+        handle.destroy();
+        m_active_tasks--;
+      }
+      m_ready.clear();
+    }
+
+    NuDockBase& m_dock;
+    size_t m_active_tasks;
+    std::exception_ptr m_exception;
+    /// @brief Requests sent by the coroutines and not answered yet, guarded by m_mutex
+    size_t m_pending_calls = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::coroutine_handle<>> m_ready;
+};
+
+inline auto NuDockTask::promise_type::final_suspend() noexcept
+{
+  // Tell the event loop the task is done and free its frame
+  struct TaskDone {
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<promise_type> _handle) const noexcept
+    {
+      AsyncDock* dock = _handle.promise().dock;
+      _handle.destroy();
+      dock->m_active_tasks--;
+    }
+    void await_resume() const noexcept {}
+  };
+  return TaskDone{};
+}
+
+inline void NuDockTask::promise_type::unhandled_exception()
+{
+  if (!dock->m_exception) {
+    dock->m_exception = std::current_exception();
+  }
+}
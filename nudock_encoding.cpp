@@ -0,0 +1,232 @@
+#include "nudock_encoding.hpp"
+
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <vector>
+
+namespace {
+
+struct EncodingInfo {
+  MessageEncoding encoding;
+  const char* name;
+  const char* content_type;
+};
+
+const EncodingInfo ENCODINGS[] = {
+    {MessageEncoding::JSON, "json", "application/json"},
+    {MessageEncoding::CBOR, "cbor", "application/cbor"},
+    {MessageEncoding::MSGPACK, "msgpack", "application/msgpack"},
+    {MessageEncoding::UBJSON, "ubjson", "application/ubjson"},
+    {MessageEncoding::BSON, "bson", "application/bson"},
+};
+
+const EncodingInfo& encoding_info(MessageEncoding _encoding)
+{
+  for (const auto& info : ENCODINGS) {
+    if (info.encoding == _encoding) {
+      return info;
+    }
+  }
+  throw std::invalid_argument("Unknown message encoding " + std::to_string(static_cast<int>(_encoding)));
+}
+
+bool contains_binary(const nlohmann::json& _value)
+{
+  if (_value.is_binary()) {
+    return true;
+  }
+  if (_value.is_structured()) {
+    for (const auto& element : _value) {
+      if (contains_binary(element)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/// @brief Turns binary values into the same objects json text gives them
+void binary_to_objects(nlohmann::json& _value)
+{
+  if (_value.is_binary()) {
+    const nlohmann::json::binary_t& binary = _value.get_binary();
+    nlohmann::json bytes = {
+        {"bytes", static_cast<const std::vector<uint8_t>&>(binary)},
+        {"subtype", binary.has_subtype() ? nlohmann::json(binary.subtype()) : nlohmann::json(nullptr)}
+    };
+    _value = std::move(bytes);
+    return;
+  }
+  if (_value.is_structured()) {
+    for (auto& element : _value) {
+      binary_to_objects(element);
+    }
+  }
+}
+
+/// @brief Stream buffer appending to whichever string the next message goes into
+class StringAppendBuffer : public std::streambuf
+{
+  public:
+    std::string* m_target = nullptr;
+
+  protected:
+    int_type overflow(int_type _c) override
+    {
+      if (!traits_type::eq_int_type(_c, traits_type::eof())) {
+        m_target->push_back(traits_type::to_char_type(_c));
+      }
+      return traits_type::not_eof(_c);
+    }
+    std::streamsize xsputn(const char* _s, std::streamsize _length) override
+    {
+      m_target->append(_s, static_cast<size_t>(_length));
+      return _length;
+    }
+};
+
+/**
+ * @brief Serialiser of the messages of one thread.
+ *
+ * nlohmann::json's dump() returns a new string for every message. Here the
+ * json text goes through a stream kept from one message to the next, and
+ * the binary encodings through the to_cbor() etc. overloads taking a string,
+ * so the message is written into a string whose capacity is kept. Only the
+ * public nlohmann::json interface is used.
+ */
+class MessageEncoder
+{
+  public:
+    MessageEncoder() : m_stream(&m_buffer) {}
+
+    void encode(const nlohmann::json& _message, MessageEncoding _encoding, std::string& _body)
+    {
+      _body.clear();
+      switch (_encoding) {
+        case MessageEncoding::JSON:
+          m_buffer.m_target = &_body;
+          // No width set, so compact json as dump() writes it
+          m_stream << _message;
+          return;
+        case MessageEncoding::CBOR:
+          nlohmann::json::to_cbor(_message, _body);
+          return;
+        case MessageEncoding::MSGPACK:
+          nlohmann::json::to_msgpack(_message, _body);
+          return;
+        case MessageEncoding::UBJSON:
+          // UBJSON has no binary type, binary values would come back as plain arrays of numbers
+          if (contains_binary(_message)) {
+            nlohmann::json message = _message;
+            binary_to_objects(message);
+            nlohmann::json::to_ubjson(message, _body);
+            return;
+          }
+          nlohmann::json::to_ubjson(_message, _body);
+          return;
+        case MessageEncoding::BSON:
+          nlohmann::json::to_bson(_message, _body);
+          return;
+      }
+      throw std::invalid_argument("Unknown message encoding " + std::to_string(static_cast<int>(_encoding)));
+    }
+
+  private:
+    StringAppendBuffer m_buffer;
+    std::ostream m_stream;
+};
+
+} // namespace
+
+void encode_message(const nlohmann::json& _message, MessageEncoding _encoding, std::string& _body)
+{
+  thread_local MessageEncoder encoder;
+  encoder.encode(_message, _encoding, _body);
+}
+
+std::string encode_message(const nlohmann::json& _message, MessageEncoding _encoding)
+{
+  std::string body;
+  encode_message(_message, _encoding, body);
+  return body;
+}
+
+nlohmann::json decode_message(const std::string& _body, MessageEncoding _encoding)
+{
+  switch (_encoding) {
+    case MessageEncoding::JSON:
+      return nlohmann::json::parse(_body);
+    case MessageEncoding::CBOR:
+      // Binary values with a subtype are written as tagged byte strings, keep the tag as their subtype
+      return nlohmann::json::from_cbor(_body, true, true, nlohmann::json::cbor_tag_handler_t::store);
+    case MessageEncoding::MSGPACK:
+      return nlohmann::json::from_msgpack(_body);
+    case MessageEncoding::UBJSON:
+      return nlohmann::json::from_ubjson(_body);
+    case MessageEncoding::BSON:
+      return nlohmann::json::from_bson(_body);
+  }
+  throw std::invalid_argument("Unknown message encoding " + std::to_string(static_cast<int>(_encoding)));
+}
+
+bool sax_parse_message(const std::string& _body, MessageEncoding _encoding, nlohmann::json_sax<nlohmann::json>* _sax)
+{
+  switch (_encoding) {
+    case MessageEncoding::JSON:
+      return nlohmann::json::sax_parse(_body, _sax, nlohmann::json::input_format_t::json);
+    case MessageEncoding::CBOR:
+      return nlohmann::json::sax_parse(_body, _sax, nlohmann::json::input_format_t::cbor);
+    case MessageEncoding::MSGPACK:
+      return nlohmann::json::sax_parse(_body, _sax, nlohmann::json::input_format_t::msgpack);
+    case MessageEncoding::UBJSON:
+      return nlohmann::json::sax_parse(_body, _sax, nlohmann::json::input_format_t::ubjson);
+    case MessageEncoding::BSON:
+      return nlohmann::json::sax_parse(_body, _sax, nlohmann::json::input_format_t::bson);
+  }
+  throw std::invalid_argument("Unknown message encoding " + std::to_string(static_cast<int>(_encoding)));
+}
+
+const char* encoding_name(MessageEncoding _encoding)
+{
+  return encoding_info(_encoding).name;
+}
+
+bool encoding_from_name(const std::string& _name, MessageEncoding& _encoding)
+{
+  for (const auto& info : ENCODINGS) {
+    if (_name == info.name) {
+      _encoding = info.encoding;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool encoding_from_byte(uint8_t _byte, MessageEncoding& _encoding)
+{
+  for (const auto& info : ENCODINGS) {
+    if (_byte == static_cast<uint8_t>(info.encoding)) {
+      _encoding = info.encoding;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* encoding_content_type(MessageEncoding _encoding)
+{
+  return encoding_info(_encoding).content_type;
+}
+
+bool encoding_from_content_type(const std::string& _content_type, MessageEncoding& _encoding)
+{
+  const std::string media_type = _content_type.substr(0, _content_type.find(';'));
+  for (const auto& info : ENCODINGS) {
+    if (media_type == info.content_type) {
+      _encoding = info.encoding;
+      return true;
+    }
+  }
+  return false;
+}
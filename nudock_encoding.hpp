@@ -0,0 +1,101 @@
+/**
+ * @file nudock_encoding.hpp
+ *
+ * @brief Encodings of the request and response messages.
+ *
+ * Messages are json text by default. Client and server can agree on one of
+ * the binary encodings supported by nlohmann::json during /validate_start,
+ * which spares the text formatting and parsing of every double on both
+ * sides. Each request carries its encoding: in the Content-Type over HTTP,
+ * in the FrameHeader with NuDock frames and in the message header over
+ * shared memory. Responses use the encoding of their request.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+/// @brief Encoding of a request or response message
+enum class MessageEncoding : uint8_t {
+  /// json text, the default, readable by any tool
+  JSON = 0,
+  CBOR = 1,
+  MSGPACK = 2,
+  UBJSON = 3,
+  /// Only takes json objects as messages
+  BSON = 4,
+};
+
+/**
+ * @brief Serialises a message.
+ *
+ * @param _message json message
+ * @param _encoding Encoding to use
+ * @return Serialised message
+ */
+std::string encode_message(const nlohmann::json& _message, MessageEncoding _encoding);
+
+/**
+ * @brief Serialises a message into an existing buffer.
+ *
+ * The buffer's content is replaced but its capacity is kept, so a buffer
+ * reused from one message to the next stops allocating once it is large
+ * enough.
+ *
+ * @param _message json message
+ * @param _encoding Encoding to use
+ * @param _body Filled with the serialised message
+ */
+void encode_message(const nlohmann::json& _message, MessageEncoding _encoding, std::string& _body);
+
+/**
+ * @brief Deserialises a message.
+ *
+ * @param _body Serialised message
+ * @param _encoding Encoding used by the sender
+ * @return json message
+ */
+nlohmann::json decode_message(const std::string& _body, MessageEncoding _encoding);
+
+/**
+ * @brief Deserialises a message as SAX events, without building a json value.
+ *
+ * Unlike decode_message(), CBOR binary values with a subtype (tagged byte strings)
+ * are refused: nlohmann::json::sax_parse() has no way to accept their tags.
+ *
+ * @param _body Serialised message
+ * @param _encoding Encoding used by the sender
+ * @param _sax Receiver of the events
+ * @return false if the receiver stopped the parsing
+ */
+bool sax_parse_message(const std::string& _body, MessageEncoding _encoding, nlohmann::json_sax<nlohmann::json>* _sax);
+
+/// @brief Name of the encoding used in the /validate_start negotiation, e.g. "cbor"
+const char* encoding_name(MessageEncoding _encoding);
+
+/**
+ * @brief Looks up an encoding by the name used in the /validate_start negotiation.
+ *
+ * @return false if the encoding is unknown
+ */
+bool encoding_from_name(const std::string& _name, MessageEncoding& _encoding);
+
+/**
+ * @brief Looks up an encoding by the value sent in the FrameHeader or shared-memory message header.
+ *
+ * @return false if the value isn't a known encoding, e.g. one of a newer client
+ */
+bool encoding_from_byte(uint8_t _byte, MessageEncoding& _encoding);
+
+/// @brief HTTP Content-Type of the encoding, e.g. "application/cbor"
+const char* encoding_content_type(MessageEncoding _encoding);
+
+/**
+ * @brief Looks up an encoding by HTTP Content-Type, ignoring any parameters.
+ *
+ * @return false if the Content-Type doesn't name a known encoding
+ */
+bool encoding_from_content_type(const std::string& _content_type, MessageEncoding& _encoding);
@@ -0,0 +1,169 @@
+#include "nudock_memfd.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+/// @brief Key of the placeholder objects left in the message
+const char* const MEMFD_PLACEHOLDER = "$nudock_memfd";
+
+/// @brief Arrays start on cache line boundaries inside the memfd
+constexpr size_t MEMFD_ALIGNMENT = 64;
+
+/// @brief The client only maps memfds the server can no longer change
+constexpr int MEMFD_SEALS = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+
+void collect_arrays(nlohmann::json& _value, size_t _threshold, std::vector<nlohmann::json*>& _arrays)
+{
+  if (_value.is_binary()) {
+    if (_value.get_binary().size() >= _threshold) {
+      _arrays.push_back(&_value);
+    }
+    return;
+  }
+  if (_value.is_structured()) {
+    for (auto& element : _value) {
+      collect_arrays(element, _threshold, _arrays);
+    }
+  }
+}
+
+bool is_placeholder(const nlohmann::json& _value)
+{
+  return _value.is_object() && _value.size() == 1 && _value.contains(MEMFD_PLACEHOLDER);
+}
+
+/// @brief Bytes of the array a placeholder points at, checked against the bounds of the memfd
+const uint8_t* placeholder_bytes(const nlohmann::json& _placeholder, const uint8_t* _data, size_t _size, size_t& _array_size)
+{
+  size_t offset = _placeholder.at("offset").get<size_t>();
+  _array_size = _placeholder.at("size").get<size_t>();
+  if (offset > _size || _array_size > _size - offset) {
+    throw std::runtime_error("Array out of the bounds of the received memfd");
+  }
+  return _data + offset;
+}
+
+void restore_arrays(nlohmann::json& _value, const uint8_t* _data, size_t _size)
+{
+  if (is_placeholder(_value)) {
+    const nlohmann::json& placeholder = _value[MEMFD_PLACEHOLDER];
+    size_t size;
+    const uint8_t* bytes_begin = placeholder_bytes(placeholder, _data, _size, size);
+    std::vector<uint8_t> bytes(bytes_begin, bytes_begin + size);
+    if (placeholder.at("subtype").is_null()) {
+      _value = nlohmann::json::binary(std::move(bytes));
+    }
+    else {
+      _value = nlohmann::json::binary(std::move(bytes), placeholder["subtype"].get<nlohmann::json::binary_t::subtype_type>());
+    }
+    return;
+  }
+  if (_value.is_structured()) {
+    for (auto& element : _value) {
+      restore_arrays(element, _data, _size);
+    }
+  }
+}
+
+} // namespace
+
+int move_arrays_to_memfd(nlohmann::json& _message, size_t _threshold)
+{
+  std::vector<nlohmann::json*> arrays;
+  collect_arrays(_message, _threshold, arrays);
+  if (arrays.empty()) {
+    return -1;
+  }
+
+  int fd = memfd_create("nudock_arrays", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    // Not fatal, the arrays just stay in the body
+    return -1;
+  }
+
+  std::vector<size_t> offsets;
+  offsets.reserve(arrays.size());
+  size_t size = 0;
+  for (nlohmann::json* array : arrays) {
+    size = (size + MEMFD_ALIGNMENT - 1) / MEMFD_ALIGNMENT * MEMFD_ALIGNMENT;
+    offsets.push_back(size);
+    size += array->get_binary().size();
+  }
+
+  bool ok = ftruncate(fd, size) == 0;
+  for (size_t i = 0; ok && i < arrays.size(); ++i) {
+    const std::vector<uint8_t>& bytes = arrays[i]->get_binary();
+    size_t written = 0;
+    while (ok && written < bytes.size()) {
+      ssize_t n = pwrite(fd, bytes.data() + written, bytes.size() - written, offsets[i] + written);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      ok = n > 0;
+      written += std::max<ssize_t>(n, 0);
+    }
+  }
+  ok = ok && fcntl(fd, F_ADD_SEALS, MEMFD_SEALS) == 0;
+  if (!ok) {
+    close(fd);
+    return -1;
+  }
+
+  for (size_t i = 0; i < arrays.size(); ++i) {
+    const nlohmann::json::binary_t& binary = arrays[i]->get_binary();
+    nlohmann::json placeholder = {
+        {"offset", offsets[i]},
+        {"size", binary.size()},
+        {"subtype", binary.has_subtype() ? nlohmann::json(binary.subtype()) : nlohmann::json(nullptr)}
+    };
+    *arrays[i] = {{MEMFD_PLACEHOLDER, std::move(placeholder)}};
+  }
+  return fd;
+}
+
+MemfdMapping::MemfdMapping(int _fd)
+{
+  struct stat info;
+  if (fstat(_fd, &info) != 0 || (fcntl(_fd, F_GET_SEALS) & MEMFD_SEALS) != MEMFD_SEALS) {
+    close(_fd);
+    throw std::runtime_error("Received a memfd that is not sealed");
+  }
+
+  // The seals guarantee the pages don't change under the reader anymore
+  size_t size = info.st_size;
+  void* data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, _fd, 0) : nullptr;
+  close(_fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error(std::string("Could not map the received memfd: ") + std::strerror(errno));
+  }
+  m_data = static_cast<const uint8_t*>(data);
+  m_size = size;
+}
+
+MemfdMapping::~MemfdMapping()
+{
+  if (m_data) {
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+  }
+}
+
+const uint8_t* MemfdMapping::array_bytes(const nlohmann::json& _value, size_t& _size) const
+{
+  if (!is_placeholder(_value)) {
+    return nullptr;
+  }
+  return placeholder_bytes(_value[MEMFD_PLACEHOLDER], m_data, m_size, _size);
+}
+
+void restore_arrays_from_memfd(nlohmann::json& _message, int _fd)
+{
+  MemfdMapping mapping(_fd);
+  restore_arrays(_message, mapping.data(), mapping.size());
+}
@@ -0,0 +1,232 @@
+/**
+ * @file nudock_memfd.hpp
+ *
+ * @brief Out-of-line exchange of large numeric arrays through sealed memfds.
+ *
+ * Handlers return large blocks (predicted spectra, per-bin contributions,
+ * covariance matrices, ...) as json binary values, made with
+ * make_binary_array(). Over NuDock frames on a unix domain socket, binary
+ * values above a threshold never become text: the server moves them into a
+ * sealed memfd passed along with the response through SCM_RIGHTS. Over the
+ * other transports they are written out as plain json.
+ *
+ * The server copies an array twice, into the binary value and into the memfd.
+ * NuDockBase::send_request_mapped() reads the arrays in place, in the pages of
+ * the memfd mapped by the client, without any further copy:
+ *
+ * @code
+ *   // server
+ *   server.register_response("/spectrum", [](const nlohmann::json&) {
+ *     return nlohmann::json{{"spectrum", make_binary_array(predict())}};
+ *   });
+ *   // client
+ *   MappedResponse response = client.send_request_mapped(spectrum_endpoint, "");
+ *   MappedArray<double> spectrum = response.array<double>(response.message()["spectrum"]);
+ * @endcode
+ *
+ * send_request() instead copies the arrays out of the mapping into binary
+ * values, and read_binary_array() copies them once more into a std::vector.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+/// @brief Binary values at least this large are moved into the memfd, smaller ones stay in the body
+constexpr size_t MEMFD_ARRAY_THRESHOLD = 64 * 1024;
+
+/**
+ * @brief Wraps a numeric array into a json binary value, without going through text.
+ *
+ * @param _values Array to wrap
+ */
+template <typename T>
+nlohmann::json make_binary_array(const std::vector<T>& _values)
+{
+  static_assert(std::is_arithmetic<T>::value, "make_binary_array() only takes numeric arrays");
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(_values.data());
+  return nlohmann::json::binary(std::vector<uint8_t>(data, data + _values.size() * sizeof(T)));
+}
+
+/**
+ * @brief Reads back a numeric array made with make_binary_array().
+ *
+ * Also takes the plain json form the binary values take over transports
+ * that can't pass memfds, and ordinary json arrays of numbers.
+ *
+ * @param _value json value holding the array
+ */
+template <typename T>
+std::vector<T> read_binary_array(const nlohmann::json& _value)
+{
+  static_assert(std::is_arithmetic<T>::value, "read_binary_array() only returns numeric arrays");
+  if (_value.is_array()) {
+    return _value.get<std::vector<T>>();
+  }
+
+  std::vector<uint8_t> bytes;
+  const std::vector<uint8_t>* source = &bytes;
+  if (_value.is_binary()) {
+    source = &_value.get_binary();
+  }
+  else if (_value.is_object() && _value.contains("bytes")) {
+    bytes = _value["bytes"].get<std::vector<uint8_t>>();
+  }
+  else {
+    throw std::runtime_error("Not a binary array: " + _value.dump());
+  }
+
+  if (source->size() % sizeof(T) != 0) {
+    throw std::runtime_error("Binary array of " + std::to_string(source->size()) +
+                             " bytes does not hold whole elements of " + std::to_string(sizeof(T)) + " bytes");
+  }
+  std::vector<T> values(source->size() / sizeof(T));
+  if (!values.empty()) {
+    std::memcpy(values.data(), source->data(), source->size());
+  }
+  return values;
+}
+
+/**
+ * @brief Moves the large binary values of a message into a sealed memfd.
+ *
+ * Each moved value is replaced by a small placeholder object pointing at its
+ * place in the memfd.
+ *
+ * @param _message Message to strip of its large binary values
+ * @param _threshold Size in bytes from which binary values are moved
+ * @return The sealed memfd, or -1 if there was nothing to move
+ */
+int move_arrays_to_memfd(nlohmann::json& _message, size_t _threshold = MEMFD_ARRAY_THRESHOLD);
+
+/**
+ * @brief Puts back the binary values moved by move_arrays_to_memfd().
+ *
+ * @param _message Message with the placeholders
+ * @param _fd memfd received with the message, always closed
+ */
+void restore_arrays_from_memfd(nlohmann::json& _message, int _fd);
+
+/// @brief Read-only mapping of a received memfd, unmapped when destroyed
+class MemfdMapping
+{
+  public:
+    /**
+     * @brief Maps a memfd, checking that it is sealed.
+     *
+     * @param _fd memfd received with a message, always closed
+     */
+    explicit MemfdMapping(int _fd);
+    ~MemfdMapping();
+    MemfdMapping(const MemfdMapping&) = delete;
+    MemfdMapping& operator=(const MemfdMapping&) = delete;
+
+    const uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    /**
+     * @brief Bytes of the array a placeholder left by move_arrays_to_memfd() points at.
+     *
+     * @param _value Value of the message, possibly a placeholder
+     * @param _size Filled with the size of the array in bytes
+     * @return Start of the array in the mapping, or nullptr if _value isn't a placeholder
+     */
+    const uint8_t* array_bytes(const nlohmann::json& _value, size_t& _size) const;
+
+  private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+/**
+ * @brief Numeric array read in place, keeping alive the memory it points into.
+ *
+ * The arrays start on 64 bytes boundaries in the memfd, so they can be read
+ * as T directly.
+ */
+template <typename T>
+class MappedArray
+{
+  public:
+    MappedArray() = default;
+    MappedArray(std::shared_ptr<const void> _owner, const T* _data, size_t _size)
+        : m_owner(std::move(_owner)), m_data(_data), m_size(_size) {}
+
+    const T* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+    const T& operator[](size_t _index) const { return m_data[_index]; }
+
+  private:
+    std::shared_ptr<const void> m_owner;
+    const T* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+/**
+ * @brief Response whose large arrays are left in the memfd they came in, see NuDockBase::send_request_mapped().
+ */
+class MappedResponse
+{
+  public:
+    /**
+     * @brief MappedResponse constructor
+     *
+     * @param _message Decoded response, with the placeholders of the arrays in the memfd
+     * @param _fd memfd passed along with the response, or -1
+     */
+    MappedResponse(nlohmann::json _message, int _fd)
+        : m_message(std::make_shared<const nlohmann::json>(std::move(_message))),
+          m_mapping(_fd >= 0 ? std::make_shared<const MemfdMapping>(_fd) : nullptr) {}
+
+    /// @brief Response message, the arrays in the memfd are placeholders
+    const nlohmann::json& message() const { return *m_message; }
+
+    /**
+     * @brief Numeric array made with make_binary_array(), read in place.
+     *
+     * Arrays in the memfd are read from the mapping, binary values from the
+     * message, both shared with the returned view. The plain json forms
+     * taken by read_binary_array() are copied.
+     *
+     * @param _value Value of message() holding the array
+     */
+    template <typename T>
+    MappedArray<T> array(const nlohmann::json& _value) const
+    {
+      static_assert(std::is_arithmetic<T>::value, "MappedResponse::array() only returns numeric arrays");
+      size_t size = 0;
+      const uint8_t* bytes = nullptr;
+      std::shared_ptr<const void> owner;
+      if (m_mapping && (bytes = m_mapping->array_bytes(_value, size))) {
+        owner = m_mapping;
+      }
+      else if (_value.is_binary() && reinterpret_cast<uintptr_t>(_value.get_binary().data()) % alignof(T) == 0) {
+        bytes = _value.get_binary().data();
+        size = _value.get_binary().size();
+        owner = m_message;
+      }
+      else {
+        auto values = std::make_shared<const std::vector<T>>(read_binary_array<T>(_value));
+        return MappedArray<T>(values, values->data(), values->size());
+      }
+      if (size % sizeof(T) != 0) {
+        throw std::runtime_error("Binary array of " + std::to_string(size) +
+                                 " bytes does not hold whole elements of " + std::to_string(sizeof(T)) + " bytes");
+      }
+      return MappedArray<T>(std::move(owner), reinterpret_cast<const T*>(bytes), size / sizeof(T));
+    }
+
+  private:
+    std::shared_ptr<const nlohmann::json> m_message;
+    std::shared_ptr<const MemfdMapping> m_mapping;
+};
@@ -0,0 +1,203 @@
+#include "nudock_parameters.hpp"
+
+#include <random>
+#include <stdexcept>
+
+ParameterLayout::ParameterLayout(const nlohmann::json& _parameter_names)
+    : m_parameter_names(_parameter_names)
+{
+  if (!m_parameter_names.is_object()) {
+    throw std::invalid_argument("Parameter names must be a json object of groups, got: " + m_parameter_names.dump());
+  }
+  for (const auto& [group_name, names] : m_parameter_names.items()) {
+    m_group_names.push_back(group_name);
+    Group& group = m_groups[group_name];
+    group.names = names.get<std::vector<std::string>>();
+    for (size_t i = 0; i < group.names.size(); ++i) {
+      if (!group.indices.emplace(group.names[i], i).second) {
+        throw std::invalid_argument("Parameter \"" + group.names[i] + "\" appears twice in group \"" + group_name + "\"");
+      }
+    }
+  }
+}
+
+const ParameterLayout::Group& ParameterLayout::group(const std::string& _group) const
+{
+  auto group_it = m_groups.find(_group);
+  if (group_it == m_groups.end()) {
+    throw std::out_of_range("Unknown parameter group \"" + _group + "\"");
+  }
+  return group_it->second;
+}
+
+const std::vector<std::string>& ParameterLayout::names(const std::string& _group) const
+{
+  return group(_group).names;
+}
+
+size_t ParameterLayout::index(const std::string& _group, const std::string& _name) const
+{
+  const Group& parameters = group(_group);
+  auto index_it = parameters.indices.find(_name);
+  if (index_it == parameters.indices.end()) {
+    throw std::out_of_range("Unknown parameter \"" + _name + "\" in group \"" + _group + "\"");
+  }
+  return index_it->second;
+}
+
+ParameterHandle ParameterLayout::handle(const std::string& _name) const
+{
+  ParameterHandle handle;
+  bool found = false;
+  for (size_t group_index = 0; group_index < m_group_names.size(); ++group_index) {
+    const Group& parameters = m_groups.at(m_group_names[group_index]);
+    auto index_it = parameters.indices.find(_name);
+    if (index_it == parameters.indices.end()) {
+      continue;
+    }
+    if (found) {
+      throw std::invalid_argument("Parameter \"" + _name + "\" is in several groups, look it up with its group instead");
+    }
+    handle.group = static_cast<uint32_t>(group_index);
+    handle.index = static_cast<uint32_t>(index_it->second);
+    found = true;
+  }
+  if (!found) {
+    throw std::out_of_range("Unknown parameter \"" + _name + "\"");
+  }
+  return handle;
+}
+
+nlohmann::json ParameterLayout::pack(const nlohmann::json& _parameters) const
+{
+  nlohmann::json packed = _parameters;
+  for (const auto& [group_name, parameters] : m_groups) {
+    auto values_it = packed.find(group_name);
+    if (values_it == packed.end() || !values_it->is_object()) {
+      continue;
+    }
+    nlohmann::json values = nlohmann::json::array();
+    for (const auto& name : parameters.names) {
+      auto value_it = values_it->find(name);
+      if (value_it == values_it->end()) {
+        throw std::invalid_argument("Missing parameter \"" + name + "\" in group \"" + group_name + "\"");
+      }
+      values.push_back(*value_it);
+    }
+    if (values.size() != values_it->size()) {
+      throw std::invalid_argument("Parameters of group \"" + group_name + "\" that are not in the layout");
+    }
+    *values_it = std::move(values);
+  }
+  return packed;
+}
+
+nlohmann::json ParameterLayout::unpack(const nlohmann::json& _parameters) const
+{
+  nlohmann::json unpacked = _parameters;
+  for (const auto& [group_name, parameters] : m_groups) {
+    auto values_it = unpacked.find(group_name);
+    if (values_it == unpacked.end() || !values_it->is_array()) {
+      continue;
+    }
+    if (values_it->size() != parameters.names.size()) {
+      throw std::invalid_argument("Got " + std::to_string(values_it->size()) + " values for the " +
+                                  std::to_string(parameters.names.size()) + " parameters of group \"" + group_name + "\"");
+    }
+    nlohmann::json values = nlohmann::json::object();
+    for (size_t i = 0; i < parameters.names.size(); ++i) {
+      values[parameters.names[i]] = (*values_it)[i];
+    }
+    *values_it = std::move(values);
+  }
+  return unpacked;
+}
+
+ParameterValues::ParameterValues(const ParameterLayout& _layout)
+    : m_groups(_layout.groups())
+{
+  for (const auto& group : m_groups) {
+    m_values.emplace_back(_layout.size(group), 0.0);
+  }
+}
+
+nlohmann::json ParameterValues::request() const
+{
+  nlohmann::json request = nlohmann::json::object();
+  for (size_t i = 0; i < m_groups.size(); ++i) {
+    request[m_groups[i]] = m_values[i];
+  }
+  return request;
+}
+
+ParameterDeltas::ParameterDeltas()
+{
+  // Below 2^62, so the numbers stay far from wrapping and fit the signed integers of BSON
+  std::random_device random;
+  m_sequence = ((static_cast<uint64_t>(random()) << 32) | random()) >> 2;
+}
+
+nlohmann::json ParameterDeltas::request(const nlohmann::json& _parameters)
+{
+  m_pending = _parameters;
+  if (!m_synchronised) {
+    nlohmann::json request = _parameters;
+    request["sequence"] = m_sequence + 1;
+    return request;
+  }
+
+  nlohmann::json changed = nlohmann::json::object();
+  for (const auto& [group_name, values] : _parameters.items()) {
+    if (!values.is_object()) {
+      throw std::invalid_argument("Delta requests take parameters keyed by name, got group \"" + group_name + "\": " + values.dump());
+    }
+    auto acknowledged_it = m_acknowledged.find(group_name);
+    for (const auto& [name, value] : values.items()) {
+      if (acknowledged_it == m_acknowledged.end() || !acknowledged_it->contains(name) || (*acknowledged_it)[name] != value) {
+        changed[group_name][name] = value;
+      }
+    }
+  }
+  return {{"sequence", m_sequence + 1}, {"changed", std::move(changed)}};
+}
+
+bool ParameterDeltas::acknowledge(const nlohmann::json& _response)
+{
+  auto sequence_it = _response.find("sequence");
+  if (sequence_it == _response.end() || !sequence_it->is_number_integer() || sequence_it->get<uint64_t>() != m_sequence + 1) {
+    m_synchronised = false;
+    return false;
+  }
+  m_sequence++;
+  if (m_synchronised) {
+    // Parameters left out of the request keep their acknowledged values on the server
+    for (const auto& [group_name, values] : m_pending.items()) {
+      for (const auto& [name, value] : values.items()) {
+        m_acknowledged[group_name][name] = value;
+      }
+    }
+  } else {
+    m_acknowledged = std::move(m_pending);
+    m_synchronised = true;
+  }
+  m_pending = nullptr;
+  return true;
+}
+
+bool ParameterSequence::accept(const nlohmann::json& _request)
+{
+  auto sequence_it = _request.find("sequence");
+  if (sequence_it != _request.end() &&
+      (!sequence_it->is_number_integer() || (!sequence_it->is_number_unsigned() && sequence_it->get<int64_t>() < 0))) {
+    // Refused like a gap instead of throwing out of the handler, requests may not be validated.
+    // Binary encodings and in-process requests carry non-negative integers as signed ones.
+    return false;
+  }
+  const uint64_t sequence = sequence_it != _request.end() ? sequence_it->get<uint64_t>() : 0;
+  if (!_request.contains("changed")) {
+    m_last.store(sequence);
+    return true;
+  }
+  uint64_t expected = sequence - 1;
+  return sequence != 0 && m_last.compare_exchange_strong(expected, sequence);
+}
@@ -0,0 +1,258 @@
+/**
+ * @file nudock_parameters.hpp
+ *
+ * @brief Positional parameter vectors, after a one-time exchange of the parameter names.
+ *
+ * Sending /set_parameters as objects keyed by parameter name costs a key
+ * string, a map insertion and a schema pattern check per parameter and per
+ * request. With a ParameterLayout, the client fetches the names once through
+ * /get_parameter_names and from then on sends plain arrays of values in that
+ * order:
+ *
+ * @code
+ *   ParameterLayout layout = client.fetch_parameter_layout();
+ *   std::vector<double> sys_pars(layout.size("sys_pars"));
+ *   ...
+ *   client.send_request("/set_parameters", {{"osc_pars", osc_pars}, {"sys_pars", sys_pars}});
+ * @endcode
+ *
+ * The server answers /get_parameter_names with names() of its own layout,
+ * and takes the values of a group in a /set_parameters request by position.
+ *
+ * A server can also announce its layout in /validate_start. The client then
+ * looks its parameters up once, and sets them through ParameterValues by
+ * their handle:
+ *
+ * @code
+ *   ParameterValues parameters(client.fetch_parameter_layout());
+ *   const ParameterHandle theta23 = client.param("Theta23");
+ *   ...
+ *   parameters[theta23] = 0.52;
+ *   client.send_request("/set_parameters", parameters.request());
+ * @endcode
+ *
+ * When a step only moves a handful of parameters (e.g. block-Gibbs updates),
+ * ParameterDeltas sends just the parameters that changed since the last
+ * acknowledged update, numbered so that the server's ParameterSequence can
+ * detect a missed update, or one made by another client in between:
+ *
+ * @code
+ *   {"sequence": 2, "changed": {"sys_pars": {"sys17": 0.3}}}
+ * @endcode
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+/// @brief Position of a parameter in the positional /set_parameters requests, see ParameterLayout::handle()
+struct ParameterHandle {
+  /// @brief Position of the group in ParameterLayout::groups()
+  uint32_t group = 0;
+  /// @brief Position of the parameter within its group
+  uint32_t index = 0;
+};
+
+class ParameterLayout
+{
+  public:
+    ParameterLayout() = default;
+
+    /**
+     * @brief ParameterLayout constructor
+     *
+     * @param _parameter_names json object with the ordered parameter names of each group, as
+     *        in the /get_parameter_names response, e.g. {"osc_pars": ["Theta23", ...], "sys_pars": [...]}
+     */
+    explicit ParameterLayout(const nlohmann::json& _parameter_names);
+
+    /// @brief Parameter names of all the groups, in the /get_parameter_names response format
+    const nlohmann::json& names() const { return m_parameter_names; }
+
+    /// @brief Ordered parameter names of a group, e.g. "sys_pars"
+    const std::vector<std::string>& names(const std::string& _group) const;
+
+    /// @brief Number of parameters in a group
+    size_t size(const std::string& _group) const { return names(_group).size(); }
+
+    /// @brief Names of the groups, in the order of ParameterHandle::group
+    const std::vector<std::string>& groups() const { return m_group_names; }
+
+    /**
+     * @brief Position of a parameter within its group.
+     *
+     * @param _group Group of the parameter, e.g. "osc_pars"
+     * @param _name Name of the parameter, e.g. "Theta23"
+     */
+    size_t index(const std::string& _group, const std::string& _name) const;
+
+    /**
+     * @brief Group and position of a parameter, looked up by name only.
+     *
+     * Throws if the name isn't in exactly one of the groups.
+     *
+     * @param _name Name of the parameter, e.g. "Theta23"
+     */
+    ParameterHandle handle(const std::string& _name) const;
+
+    /**
+     * @brief Turns parameters keyed by name into arrays of values in the layout's order.
+     *
+     * Groups that are already arrays, or aren't part of the layout, are left as they are.
+     *
+     * @param _parameters e.g. {"osc_pars": {"Theta23": 0.5, ...}, "sys_pars": {...}}
+     * @return e.g. {"osc_pars": [0.5, ...], "sys_pars": [...]}
+     */
+    nlohmann::json pack(const nlohmann::json& _parameters) const;
+
+    /**
+     * @brief Turns arrays of values back into parameters keyed by name, the inverse of pack().
+     *
+     * Groups that are already keyed by name, or aren't part of the layout, are left as they are.
+     *
+     * @param _parameters e.g. {"osc_pars": [0.5, ...], "sys_pars": [...]}
+     * @return e.g. {"osc_pars": {"Theta23": 0.5, ...}, "sys_pars": {...}}
+     */
+    nlohmann::json unpack(const nlohmann::json& _parameters) const;
+
+  private:
+    struct Group {
+      std::vector<std::string> names;
+      std::unordered_map<std::string, size_t> indices;
+    };
+
+    const Group& group(const std::string& _group) const;
+
+    nlohmann::json m_parameter_names;
+    std::vector<std::string> m_group_names;
+    std::unordered_map<std::string, Group> m_groups;
+};
+
+/**
+ * @brief Values of all the parameters of a layout, set by handle and sent positionally.
+ *
+ * All the values start at 0. The /set_parameters requests carry every group
+ * as an array of values, with no parameter name in them.
+ */
+class ParameterValues
+{
+  public:
+    explicit ParameterValues(const ParameterLayout& _layout);
+
+    double& operator[](ParameterHandle _parameter) { return m_values[_parameter.group][_parameter.index]; }
+    double operator[](ParameterHandle _parameter) const { return m_values[_parameter.group][_parameter.index]; }
+
+    /// @brief Values of a group, in the layout's order
+    std::vector<double>& values(uint32_t _group) { return m_values[_group]; }
+
+    /// @brief /set_parameters request with all the values, e.g. {"osc_pars": [0.5, ...], "sys_pars": [...]}
+    nlohmann::json request() const;
+
+  private:
+    std::vector<std::string> m_groups;
+    std::vector<std::vector<double>> m_values;
+};
+
+/**
+ * @brief Client side of the delta /set_parameters requests.
+ *
+ * The first request, and the first one after the server missed an update,
+ * carries all the parameters. The following ones only carry the parameters
+ * that changed since the last acknowledged request. Requests must be sent one
+ * at a time, passing each response to acknowledge() before the next request(),
+ * including the one resending all the parameters:
+ *
+ * @code
+ *   ParameterDeltas deltas;
+ *   while (sampling) {
+ *     ...
+ *     if (!deltas.acknowledge(client.send_request("/set_parameters", deltas.request(parameters)))) {
+ *       // All the parameters again
+ *       deltas.acknowledge(client.send_request("/set_parameters", deltas.request(parameters)));
+ *     }
+ *   }
+ * @endcode
+ *
+ * Each instance numbers its requests from a random start, so the sequence
+ * numbers of different clients don't collide, and a server shared by several
+ * clients rejects a delta if another client set the parameters since.
+ */
+class ParameterDeltas
+{
+  public:
+    /// @brief Starts the numbering of the requests at a random sequence number
+    ParameterDeltas();
+
+    /**
+     * @brief Builds the next /set_parameters request.
+     *
+     * @param _parameters All the parameters keyed by name, e.g. {"osc_pars": {...}, "sys_pars": {...}}
+     * @return Request with all the parameters, or {"sequence": n, "changed": {...}} with the changed ones only
+     */
+    nlohmann::json request(const nlohmann::json& _parameters);
+
+    /**
+     * @brief Takes the server's response to the last request().
+     *
+     * @param _response /set_parameters response, carrying the "sequence" the server accepted
+     * @return false if the server didn't apply the request, the next request() then carries all the parameters
+     */
+    bool acknowledge(const nlohmann::json& _response);
+
+    /// @brief Forgets the acknowledged parameters, e.g. after reconnecting to a restarted server
+    void reset() { m_synchronised = false; }
+
+  private:
+    /// @brief Parameters as last acknowledged by the server
+    nlohmann::json m_acknowledged;
+    /// @brief Parameters of the request waiting for acknowledge()
+    nlohmann::json m_pending;
+    /// @brief Sequence number of the last acknowledged request
+    uint64_t m_sequence = 0;
+    bool m_synchronised = false;
+};
+
+/**
+ * @brief Server side of the delta /set_parameters requests.
+ *
+ * Requests with all the parameters start a new sequence. Delta requests,
+ * carrying a "changed" object, are only accepted if their sequence number
+ * follows the last accepted one; otherwise the handler should reject them
+ * and answer with last(), so that the client sends all the parameters again.
+ * As each client numbers its requests from its own random start, a delta
+ * only follows the last accepted request if that came from the same client,
+ * so one ParameterSequence per server also serves several clients:
+ *
+ * @code
+ *   if (!m_sequence.accept(_request)) {
+ *     return {{"status", "sequence gap"}, {"sequence", m_sequence.last()}};
+ *   }
+ *   const nlohmann::json& parameters = _request.contains("changed") ? _request["changed"] : _request;
+ *   ...
+ *   return {{"status", "parameters set"}, {"sequence", m_sequence.last()}};
+ * @endcode
+ */
+class ParameterSequence
+{
+  public:
+    /**
+     * @brief Checks the sequence number of a /set_parameters request.
+     *
+     * @param _request /set_parameters request
+     * @return false if the request is a delta that doesn't follow the last accepted request,
+     *         or if its sequence number isn't a non-negative integer
+     */
+    bool accept(const nlohmann::json& _request);
+
+    /// @brief Sequence number of the last accepted request, 0 if it had none
+    uint64_t last() const { return m_last.load(); }
+
+  private:
+    std::atomic<uint64_t> m_last{0};
+};
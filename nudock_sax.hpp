@@ -0,0 +1,493 @@
+/**
+ * @file nudock_sax.hpp
+ *
+ * @brief Request handlers decoding their request through SAX events.
+ *
+ * A SaxRequestHandler receives the request as nlohmann::json SAX events,
+ * straight from the received message in any encoding, and can store the
+ * values directly into experiment-owned buffers. No json value is built for
+ * the request, which matters for large uploads (parameter batches, toy
+ * datasets). A new handler object is made for every request:
+ *
+ * @code
+ *   class SystematicsReader : public SaxRequestHandler {
+ *     public:
+ *       explicit SystematicsReader(std::vector<double>& _values) : m_values(_values) {}
+ *       bool start_array(std::size_t) override { m_values.clear(); return true; }
+ *       bool number_float(number_float_t _value, const string_t&) override { m_values.push_back(_value); return true; }
+ *       nlohmann::json finish() override { return {{"status", "parameters set"}}; }
+ *     private:
+ *       std::vector<double>& m_values;
+ *   };
+ *
+ *   dock.register_response_sax("/set_systematics", [&]() { return std::make_unique<SystematicsReader>(systematics); });
+ * @endcode
+ *
+ * Structs whose fields are listed with NUDOCK_SAX_FIELDS are filled the same
+ * way by SaxDecoder, which NuDockBase::register_response() and
+ * NuDockBase::send_request() use for typed requests and responses:
+ *
+ * @code
+ *   struct Spectrum { std::vector<double> bins; std::optional<std::string> label; };
+ *   NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Spectrum, bins, label)   // encoding
+ *   NUDOCK_SAX_FIELDS(Spectrum, bins, label)                    // decoding, without a json value
+ * @endcode
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+/**
+ * @brief Base of the SAX request handlers, ignoring every event by default.
+ *
+ * Handlers override the events they need and finish(). Integers are passed
+ * on to number_float() unless number_integer() / number_unsigned() are
+ * overridden, so handlers reading numbers only need number_float(). Returning
+ * false from an event stops the parsing and fails the request.
+ */
+class SaxRequestHandler : public nlohmann::json_sax<nlohmann::json>
+{
+  public:
+    /// @brief Called after the last event of the request, returns the response
+    virtual nlohmann::json finish() = 0;
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t _value) override { return number_float(static_cast<number_float_t>(_value), ""); }
+    bool number_unsigned(number_unsigned_t _value) override { return number_float(static_cast<number_float_t>(_value), ""); }
+    bool number_float(number_float_t, const string_t&) override { return true; }
+    bool string(string_t&) override { return true; }
+    bool binary(binary_t&) override { return true; }
+    bool start_object(std::size_t) override { return true; }
+    bool key(string_t&) override { return true; }
+    bool end_object() override { return true; }
+    bool start_array(std::size_t) override { return true; }
+    bool end_array() override { return true; }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& _error) override
+    {
+      throw std::invalid_argument(_error.what());
+    }
+};
+
+/// @brief Makes the SAX handler of a single request
+using SaxHandlerFactory = std::function<std::unique_ptr<SaxRequestHandler>()>;
+
+class SaxDecoder;
+
+/**
+ * @brief What a C++ type does with the SAX events of one of its values.
+ *
+ * Events a type can't take are nullptr, and fail the decoding.
+ */
+struct SaxOps {
+  bool (*null)(void* _target) = nullptr;
+  bool (*boolean)(void* _target, bool _value) = nullptr;
+  bool (*number_integer)(void* _target, std::int64_t _value) = nullptr;
+  bool (*number_unsigned)(void* _target, std::uint64_t _value) = nullptr;
+  bool (*number_float)(void* _target, double _value) = nullptr;
+  bool (*string)(void* _target, std::string& _value) = nullptr;
+  /// @brief Objects: key() pushes the value of each key onto the decoder
+  bool (*start_object)(void* _target) = nullptr;
+  void (*key)(void* _target, const std::string& _key, SaxDecoder& _decoder) = nullptr;
+  /// @brief Arrays: element() pushes a new element onto the decoder
+  bool (*start_array)(void* _target) = nullptr;
+  void (*element)(void* _target, SaxDecoder& _decoder) = nullptr;
+  /// @brief std::optional: anything but null makes the value, filled as `value` says
+  void* (*emplace)(void* _target) = nullptr;
+  const SaxOps* value = nullptr;
+};
+
+/// @brief Events taken by a type, make_ops() gives its SaxOps if SaxDecoder can fill it directly
+template <class T, class = void>
+struct SaxTraits {
+  static constexpr bool decodable = false;
+};
+
+/// @brief Whether SaxDecoder can fill T, otherwise it is decoded through a json value
+template <class T>
+constexpr bool is_sax_decodable = SaxTraits<T>::decodable;
+
+/// @brief SaxOps of a decodable type
+template <class T>
+inline constexpr SaxOps sax_ops = SaxTraits<T>::make_ops();
+
+/**
+ * @brief SAX handler filling a C++ value straight from the events, without building a json value.
+ *
+ * Takes numbers, booleans, strings, std::vector, std::map with string keys,
+ * std::optional and structs listed with NUDOCK_SAX_FIELDS. Unknown keys of
+ * a struct are skipped and missing ones keep their value, like the
+ * conversions of NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE. Events of the wrong type
+ * stop the parsing.
+ */
+class SaxDecoder : public nlohmann::json_sax<nlohmann::json>
+{
+  public:
+    template <class T>
+    explicit SaxDecoder(T& _value)
+    {
+      push(_value);
+    }
+
+    /// @brief The next value fills _value, called from SaxOps::key() / SaxOps::element()
+    template <class T>
+    void push(T& _value)
+    {
+      static_assert(is_sax_decodable<T>, "Type not decodable from SAX events, see NUDOCK_SAX_FIELDS");
+      m_stack.push_back({&_value, &sax_ops<T>});
+    }
+
+    /// @brief The next value is skipped, e.g. an unknown key
+    void skip() { m_stack.push_back({nullptr, nullptr}); }
+
+    /// @brief Whether the whole value has been read
+    bool done() const { return m_stack.empty(); }
+
+    bool null() override
+    {
+      return scalar(true, [](const SaxOps& _ops, void* _target) { return _ops.null && _ops.null(_target); });
+    }
+    bool boolean(bool _value) override
+    {
+      return scalar(false, [_value](const SaxOps& _ops, void* _target) { return _ops.boolean && _ops.boolean(_target, _value); });
+    }
+    bool number_integer(number_integer_t _value) override
+    {
+      return scalar(false, [_value](const SaxOps& _ops, void* _target) { return _ops.number_integer && _ops.number_integer(_target, _value); });
+    }
+    bool number_unsigned(number_unsigned_t _value) override
+    {
+      return scalar(false, [_value](const SaxOps& _ops, void* _target) { return _ops.number_unsigned && _ops.number_unsigned(_target, _value); });
+    }
+    bool number_float(number_float_t _value, const string_t&) override
+    {
+      return scalar(false, [_value](const SaxOps& _ops, void* _target) { return _ops.number_float && _ops.number_float(_target, _value); });
+    }
+    bool string(string_t& _value) override
+    {
+      return scalar(false, [&_value](const SaxOps& _ops, void* _target) { return _ops.string && _ops.string(_target, _value); });
+    }
+    bool binary(binary_t&) override
+    {
+      return scalar(false, [](const SaxOps&, void*) { return false; });
+    }
+
+    bool start_object(std::size_t) override
+    {
+      Frame* frame = next_value(false);
+      if (!frame) {
+        return false;
+      }
+      if (!frame->ops) {
+        ++frame->depth;
+        return true;
+      }
+      frame->open = frame->ops->start_object && frame->ops->start_object(frame->target);
+      return frame->open;
+    }
+    bool key(string_t& _key) override
+    {
+      if (m_stack.empty()) {
+        return false;
+      }
+      Frame& frame = m_stack.back();
+      if (frame.ops) {
+        frame.ops->key(frame.target, _key, *this);
+      }
+      return true;
+    }
+    bool end_object() override { return end(); }
+
+    bool start_array(std::size_t) override
+    {
+      Frame* frame = next_value(false);
+      if (!frame) {
+        return false;
+      }
+      if (!frame->ops) {
+        ++frame->depth;
+        return true;
+      }
+      frame->open = frame->ops->start_array && frame->ops->start_array(frame->target);
+      return frame->open;
+    }
+    bool end_array() override { return end(); }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& _error) override
+    {
+      throw std::invalid_argument(_error.what());
+    }
+
+  private:
+    /// @brief Value being filled, target and ops are nullptr for a skipped one
+    struct Frame {
+      void* target;
+      const SaxOps* ops;
+      /// @brief Whether the start of the object / array has been read
+      bool open = false;
+      /// @brief Skipped values: nesting level of the containers read so far
+      std::size_t depth = 0;
+    };
+
+    /// @brief Frame of the next value, making it first if it's an element of an array or an optional
+    Frame* next_value(bool _null)
+    {
+      if (m_stack.empty()) {
+        return nullptr;
+      }
+      if (m_stack.back().open) {
+        Frame& array = m_stack.back();
+        if (!array.ops->element) {
+          return nullptr;
+        }
+        array.ops->element(array.target, *this);
+      }
+      Frame* frame = &m_stack.back();
+      while (!_null && frame->ops && frame->ops->emplace) {
+        frame->target = frame->ops->emplace(frame->target);
+        frame->ops = frame->ops->value;
+      }
+      return frame;
+    }
+
+    template <class Apply>
+    bool scalar(bool _null, Apply _apply)
+    {
+      Frame* frame = next_value(_null);
+      if (!frame) {
+        return false;
+      }
+      if (!frame->ops) {
+        // Inside a skipped object / array, or a skipped value itself
+        if (frame->depth == 0) {
+          m_stack.pop_back();
+        }
+        return true;
+      }
+      const bool ok = _apply(*frame->ops, frame->target);
+      m_stack.pop_back();
+      return ok;
+    }
+
+    bool end()
+    {
+      if (m_stack.empty()) {
+        return false;
+      }
+      Frame& frame = m_stack.back();
+      if (!frame.ops && --frame.depth > 0) {
+        return true;
+      }
+      m_stack.pop_back();
+      return true;
+    }
+
+    std::vector<Frame> m_stack;
+};
+
+template <class T>
+struct SaxTraits<T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>> {
+  static constexpr bool decodable = true;
+
+  static bool number_integer(void* _target, std::int64_t _value) { *static_cast<T*>(_target) = static_cast<T>(_value); return true; }
+  static bool number_unsigned(void* _target, std::uint64_t _value) { *static_cast<T*>(_target) = static_cast<T>(_value); return true; }
+  static bool number_float(void* _target, double _value)
+  {
+    // Like nlohmann::json, integers don't take floating-point numbers
+    if constexpr (std::is_floating_point_v<T>) {
+      *static_cast<T*>(_target) = static_cast<T>(_value);
+      return true;
+    }
+    return false;
+  }
+
+  static constexpr SaxOps make_ops()
+  {
+    SaxOps ops;
+    ops.number_integer = &number_integer;
+    ops.number_unsigned = &number_unsigned;
+    ops.number_float = &number_float;
+    return ops;
+  }
+};
+
+template <>
+struct SaxTraits<bool> {
+  static constexpr bool decodable = true;
+
+  static bool boolean(void* _target, bool _value) { *static_cast<bool*>(_target) = _value; return true; }
+
+  static constexpr SaxOps make_ops()
+  {
+    SaxOps ops;
+    ops.boolean = &boolean;
+    return ops;
+  }
+};
+
+template <>
+struct SaxTraits<std::string> {
+  static constexpr bool decodable = true;
+
+  static bool string(void* _target, std::string& _value) { *static_cast<std::string*>(_target) = std::move(_value); return true; }
+
+  static constexpr SaxOps make_ops()
+  {
+    SaxOps ops;
+    ops.string = &string;
+    return ops;
+  }
+};
+
+// std::vector<bool> has no element references to fill
+template <class T>
+struct SaxTraits<std::vector<T>, std::enable_if_t<is_sax_decodable<T> && !std::is_same_v<T, bool>>> {
+  static constexpr bool decodable = true;
+
+  static bool start_array(void* _target) { static_cast<std::vector<T>*>(_target)->clear(); return true; }
+  static void element(void* _target, SaxDecoder& _decoder)
+  {
+    _decoder.push(static_cast<std::vector<T>*>(_target)->emplace_back());
+  }
+
+  static constexpr SaxOps make_ops()
+  {
+    SaxOps ops;
+    ops.start_array = &start_array;
+    ops.element = &element;
+    return ops;
+  }
+};
+
+template <class T>
+struct SaxTraits<std::map<std::string, T>, std::enable_if_t<is_sax_decodable<T>>> {
+  static constexpr bool decodable = true;
+
+  static bool start_object(void* _target) { static_cast<std::map<std::string, T>*>(_target)->clear(); return true; }
+  static void key(void* _target, const std::string& _key, SaxDecoder& _decoder)
+  {
+    _decoder.push((*static_cast<std::map<std::string, T>*>(_target))[_key]);
+  }
+
+  static constexpr SaxOps make_ops()
+  {
+    SaxOps ops;
+    ops.start_object = &start_object;
+    ops.key = &key;
+    return ops;
+  }
+};
+
+template <class T>
+struct SaxTraits<std::optional<T>, std::enable_if_t<is_sax_decodable<T>>> {
+  static constexpr bool decodable = true;
+
+  static bool null(void* _target) { static_cast<std::optional<T>*>(_target)->reset(); return true; }
+  static void* emplace(void* _target) { return &static_cast<std::optional<T>*>(_target)->emplace(); }
+
+  static constexpr SaxOps make_ops()
+  {
+    SaxOps ops;
+    ops.null = &null;
+    ops.emplace = &emplace;
+    ops.value = &sax_ops<T>;
+    return ops;
+  }
+};
+
+/// @brief Structs listed with NUDOCK_SAX_FIELDS
+template <class T>
+struct SaxTraits<T, std::void_t<decltype(nudock_sax_key(std::declval<T&>(), std::declval<const std::string&>(),
+                                                        std::declval<SaxDecoder&>()))>> {
+  static constexpr bool decodable = true;
+
+  static bool start_object(void*) { return true; }
+  static void key(void* _target, const std::string& _key, SaxDecoder& _decoder)
+  {
+    nudock_sax_key(*static_cast<T*>(_target), _key, _decoder);
+  }
+
+  static constexpr SaxOps make_ops()
+  {
+    SaxOps ops;
+    ops.start_object = &start_object;
+    ops.key = &key;
+    return ops;
+  }
+};
+
+#define NUDOCK_SAX_FIELD(_field) \
+  if (_key == #_field) {         \
+    _decoder.push(_value._field); \
+    return;                       \
+  }
+
+/**
+ * @brief Lists the fields of a struct for SaxDecoder, next to the struct like NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE.
+ *
+ * The json keys are the field names.
+ */
+#define NUDOCK_SAX_FIELDS(Type, ...)                                                        \
+  inline void nudock_sax_key(Type& _value, const std::string& _key, SaxDecoder& _decoder)   \
+  {                                                                                         \
+    NLOHMANN_JSON_EXPAND(NLOHMANN_JSON_PASTE(NUDOCK_SAX_FIELD, __VA_ARGS__))                \
+    _decoder.skip();                                                                        \
+  }
+
+/**
+ * @brief Request handler decoding its request straight into a struct, see NuDockBase::register_response().
+ *
+ * @tparam Request Struct of the request, is_sax_decodable
+ * @tparam Response Type of the response, with a nlohmann::json conversion
+ */
+template <class Request, class Response>
+class StructRequestHandler : public SaxRequestHandler
+{
+  public:
+    using Function = std::function<Response(const Request&)>;
+
+    explicit StructRequestHandler(std::shared_ptr<const Function> _function)
+        : m_function(std::move(_function)), m_decoder(m_request)
+    {
+    }
+
+    nlohmann::json finish() override
+    {
+      if (!m_decoder.done()) {
+        throw std::invalid_argument("Incomplete request");
+      }
+      return (*m_function)(m_request);
+    }
+
+    bool null() override { return m_decoder.null(); }
+    bool boolean(bool _value) override { return m_decoder.boolean(_value); }
+    bool number_integer(number_integer_t _value) override { return m_decoder.number_integer(_value); }
+    bool number_unsigned(number_unsigned_t _value) override { return m_decoder.number_unsigned(_value); }
+    bool number_float(number_float_t _value, const string_t& _text) override { return m_decoder.number_float(_value, _text); }
+    bool string(string_t& _value) override { return m_decoder.string(_value); }
+    bool binary(binary_t& _value) override { return m_decoder.binary(_value); }
+    bool start_object(std::size_t _size) override { return m_decoder.start_object(_size); }
+    bool key(string_t& _key) override { return m_decoder.key(_key); }
+    bool end_object() override { return m_decoder.end_object(); }
+    bool start_array(std::size_t _size) override { return m_decoder.start_array(_size); }
+    bool end_array() override { return m_decoder.end_array(); }
+
+  private:
+    std::shared_ptr<const Function> m_function;
+    Request m_request{};
+    SaxDecoder m_decoder;
+};
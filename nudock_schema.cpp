@@ -0,0 +1,606 @@
+#include "nudock_schema.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+/// @brief Keywords without any effect on the validation
+const char* const ANNOTATIONS[] = {
+  "$id", "$schema", "$comment", "title", "description", "default", "examples", "readOnly", "writeOnly", "definitions",
+};
+
+bool is_annotation(const std::string& _keyword)
+{
+  return std::find(std::begin(ANNOTATIONS), std::end(ANNOTATIONS), _keyword) != std::end(ANNOTATIONS);
+}
+
+uint8_t type_from_name(const std::string& _name)
+{
+  if (_name == "null") return CompiledSchema::NULL_TYPE;
+  if (_name == "boolean") return CompiledSchema::BOOLEAN_TYPE;
+  if (_name == "integer") return CompiledSchema::INTEGER_TYPE;
+  if (_name == "number") return CompiledSchema::NUMBER_TYPE;
+  if (_name == "string") return CompiledSchema::STRING_TYPE;
+  if (_name == "array") return CompiledSchema::ARRAY_TYPE;
+  if (_name == "object") return CompiledSchema::OBJECT_TYPE;
+  throw std::invalid_argument("Unknown type \"" + _name + "\"");
+}
+
+/// @brief Non-negative integer value of a keyword like "minItems"
+uint64_t count_of(const nlohmann::json& _value, const std::string& _keyword)
+{
+  if (!_value.is_number_unsigned() && !(_value.is_number_integer() && _value.get<int64_t>() >= 0)) {
+    throw std::invalid_argument("\"" + _keyword + "\" must be a non-negative integer");
+  }
+  return _value.get<uint64_t>();
+}
+
+/// @brief Adds a character class item (e.g. "a-z", "_", "\\d") to the lookup table, false if it isn't supported
+bool parse_class(const std::string& _items, bool* _in_class)
+{
+  for (size_t i = 0; i < _items.size(); ++i) {
+    unsigned char first = static_cast<unsigned char>(_items[i]);
+    if (first >= 128 || first == '[' || first == ']' || (first == '^' && i == 0)) {
+      return false;
+    }
+    if (first == '\\') {
+      if (++i == _items.size()) {
+        return false;
+      }
+      const char escaped = _items[i];
+      if (escaped == 'd' || escaped == 'w') {
+        for (int c = 0; c < 128; ++c) {
+          _in_class[c] |= std::isdigit(c) || (escaped == 'w' && (std::isalpha(c) || c == '_'));
+        }
+        continue;
+      }
+      if (std::isalnum(static_cast<unsigned char>(escaped)) || static_cast<unsigned char>(escaped) >= 128) {
+        return false;
+      }
+      first = static_cast<unsigned char>(escaped);
+    }
+    else if (i + 2 < _items.size() && _items[i + 1] == '-') {
+      const unsigned char last = static_cast<unsigned char>(_items[i + 2]);
+      if (last >= 128 || last == '\\' || last == ']' || last < first) {
+        return false;
+      }
+      for (unsigned c = first; c <= last; ++c) {
+        _in_class[c] = true;
+      }
+      i += 2;
+      continue;
+    }
+    _in_class[first] = true;
+  }
+  return true;
+}
+
+/// @brief Escapes a key for a json pointer
+std::string pointer_token(const std::string& _key)
+{
+  std::string token;
+  token.reserve(_key.size());
+  for (char c : _key) {
+    if (c == '~') token += "~0";
+    else if (c == '/') token += "~1";
+    else token += c;
+  }
+  return token;
+}
+
+/// @brief FNV-1a, over the bytes of the message structure
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+void mix(uint64_t& _hash, const void* _data, size_t _size)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(_data);
+  for (size_t i = 0; i < _size; ++i) {
+    _hash = (_hash ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
+void mix_structure(uint64_t& _hash, const nlohmann::json& _value)
+{
+  const uint8_t type = static_cast<uint8_t>(_value.type());
+  mix(_hash, &type, sizeof(type));
+  if (_value.is_object()) {
+    const uint64_t size = _value.size();
+    mix(_hash, &size, sizeof(size));
+    for (auto it = _value.begin(); it != _value.end(); ++it) {
+      // Keys are followed by a separator, so "ab" + "c" and "a" + "bc" differ
+      mix(_hash, it.key().c_str(), it.key().size() + 1);
+      mix_structure(_hash, it.value());
+    }
+  }
+  else if (_value.is_array() || _value.is_binary()) {
+    const uint64_t size = _value.is_binary() ? _value.get_binary().size() : _value.size();
+    mix(_hash, &size, sizeof(size));
+    if (_value.is_array()) {
+      for (const auto& item : _value) {
+        mix_structure(_hash, item);
+      }
+    }
+  }
+}
+
+} // namespace
+
+uint64_t structural_fingerprint(const nlohmann::json& _message)
+{
+  uint64_t hash = FNV_OFFSET;
+  mix_structure(hash, _message);
+  return hash;
+}
+
+bool CompiledSchema::fail(Failure& _failure, const nlohmann::json& _instance, std::string _message)
+{
+  _failure.pointer.clear();
+  _failure.instance = &_instance;
+  _failure.message = std::move(_message);
+  return false;
+}
+
+bool CompiledSchema::fail_under(Failure& _failure, const std::string& _token)
+{
+  _failure.pointer = "/" + _token + _failure.pointer;
+  return false;
+}
+
+bool CompiledSchema::Pattern::matches(const std::string& _string) const
+{
+  if (!is_class) {
+    return std::regex_search(_string, regex);
+  }
+  if (_string.empty()) {
+    return allows_empty;
+  }
+  for (char c : _string) {
+    const unsigned char byte = static_cast<unsigned char>(c);
+    if (byte >= 128 || !in_class[byte]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+CompiledSchema::CompiledSchema(const nlohmann::json& _schema)
+{
+  try {
+    m_root = compile(_schema);
+  }
+  catch (const std::exception&) {
+    // Not in the compiled subset, the generic validator checks it instead
+    m_nodes.clear();
+    m_properties.clear();
+    m_pattern_properties.clear();
+    m_patterns.clear();
+    m_constants.clear();
+    m_subschemas.clear();
+    m_fallback = std::make_unique<nlohmann::json_schema::json_validator>();
+    m_fallback->set_root_schema(_schema);
+  }
+}
+
+void CompiledSchema::validate(const nlohmann::json& _instance, nlohmann::json_schema::error_handler& _errors) const
+{
+  if (m_fallback) {
+    m_fallback->validate(_instance, _errors);
+    return;
+  }
+  Failure failure;
+  if (!check(m_root, _instance, failure)) {
+    _errors.error(nlohmann::json::json_pointer(failure.pointer), *failure.instance, failure.message);
+  }
+}
+
+int32_t CompiledSchema::compile(const nlohmann::json& _schema)
+{
+  if (_schema.is_boolean()) {
+    return _schema.get<bool>() ? ANY_NODE : NO_NODE;
+  }
+  if (!_schema.is_object()) {
+    throw std::invalid_argument("Schemas must be objects or booleans");
+  }
+
+  // Children are compiled first and appended to the tables once the node is done, so each node's slices are contiguous
+  Node node;
+  std::vector<std::pair<std::string, int32_t>> properties;
+  std::vector<std::string> required;
+  std::vector<PatternProperty> pattern_properties;
+  bool has_exclusive_minimum = false;
+  bool has_exclusive_maximum = false;
+  double exclusive_minimum = 0;
+  double exclusive_maximum = 0;
+
+  for (const auto& keyword : _schema.items()) {
+    const std::string& name = keyword.key();
+    const nlohmann::json& value = keyword.value();
+    if (name == "type") {
+      node.types = 0;
+      for (const auto& type : value.is_array() ? value : nlohmann::json::array({value})) {
+        node.types |= type_from_name(type.get<std::string>());
+      }
+    }
+    else if (name == "properties") {
+      for (const auto& property : value.items()) {
+        properties.emplace_back(property.key(), compile(property.value()));
+      }
+    }
+    else if (name == "required") {
+      required = value.get<std::vector<std::string>>();
+    }
+    else if (name == "patternProperties") {
+      for (const auto& property : value.items()) {
+        const uint32_t pattern = compile_pattern(property.key());
+        pattern_properties.push_back({pattern, compile(property.value())});
+      }
+    }
+    else if (name == "additionalProperties") {
+      node.additional_properties = compile(value);
+    }
+    else if (name == "items" && !value.is_array()) {
+      node.items = compile(value);
+    }
+    else if (name == "minItems") {
+      node.min_items = count_of(value, name);
+    }
+    else if (name == "maxItems") {
+      node.max_items = count_of(value, name);
+    }
+    else if (name == "minimum") {
+      node.minimum = value.get<double>();
+    }
+    else if (name == "maximum") {
+      node.maximum = value.get<double>();
+    }
+    else if (name == "exclusiveMinimum" && value.is_number()) {
+      has_exclusive_minimum = true;
+      exclusive_minimum = value.get<double>();
+    }
+    else if (name == "exclusiveMaximum" && value.is_number()) {
+      has_exclusive_maximum = true;
+      exclusive_maximum = value.get<double>();
+    }
+    else if (name == "minLength") {
+      node.min_length = count_of(value, name);
+    }
+    else if (name == "maxLength") {
+      node.max_length = count_of(value, name);
+    }
+    else if (name == "pattern") {
+      node.pattern = static_cast<int32_t>(compile_pattern(value.get<std::string>()));
+    }
+    else if (name == "enum" || name == "const") {
+      node.has_constants = true;
+      node.constants.begin = static_cast<uint32_t>(m_constants.size());
+      if (name == "enum") {
+        m_constants.insert(m_constants.end(), value.begin(), value.end());
+      }
+      else {
+        m_constants.push_back(value);
+      }
+      node.constants.end = static_cast<uint32_t>(m_constants.size());
+    }
+    else if (name == "anyOf") {
+      node.any_of = compile_subschemas(value);
+    }
+    else if (name == "allOf") {
+      node.all_of = compile_subschemas(value);
+    }
+    else if (name == "oneOf") {
+      node.one_of = compile_subschemas(value);
+    }
+    else if (name == "not") {
+      node.not_of = compile(value);
+      if (node.not_of == ANY_NODE) {
+        throw std::invalid_argument("\"not\": true is not compiled");
+      }
+    }
+    else if (!is_annotation(name)) {
+      throw std::invalid_argument("Keyword \"" + name + "\" is not compiled");
+    }
+  }
+
+  // The stricter of the inclusive and exclusive bounds
+  if (has_exclusive_minimum && exclusive_minimum >= node.minimum) {
+    node.minimum = exclusive_minimum;
+    node.exclusive_minimum = true;
+  }
+  if (has_exclusive_maximum && exclusive_maximum <= node.maximum) {
+    node.maximum = exclusive_maximum;
+    node.exclusive_maximum = true;
+  }
+
+  // Property lookup table, sorted by name, the required properties numbered for the bitset
+  std::unordered_map<std::string, size_t> property_ids;
+  std::vector<Property> table;
+  for (const auto& property : properties) {
+    property_ids[property.first] = table.size();
+    table.push_back({property.first, property.second, -1, true});
+  }
+  for (const auto& name : required) {
+    auto id = property_ids.find(name);
+    if (id == property_ids.end()) {
+      id = property_ids.emplace(name, table.size()).first;
+      table.push_back({name, ANY_NODE, -1, false});
+    }
+    Property& property = table[id->second];
+    if (property.required_bit < 0) {
+      const int bits = __builtin_popcountll(node.required);
+      if (bits == 64) {
+        throw std::invalid_argument("More than 64 required properties are not compiled");
+      }
+      property.required_bit = static_cast<int8_t>(bits);
+      node.required |= uint64_t(1) << bits;
+    }
+  }
+  std::sort(table.begin(), table.end(), [](const Property& _a, const Property& _b) { return _a.name < _b.name; });
+  node.properties.begin = static_cast<uint32_t>(m_properties.size());
+  m_properties.insert(m_properties.end(), table.begin(), table.end());
+  node.properties.end = static_cast<uint32_t>(m_properties.size());
+
+  node.pattern_properties.begin = static_cast<uint32_t>(m_pattern_properties.size());
+  m_pattern_properties.insert(m_pattern_properties.end(), pattern_properties.begin(), pattern_properties.end());
+  node.pattern_properties.end = static_cast<uint32_t>(m_pattern_properties.size());
+
+  // Integers are told apart from other numbers by their value, not by their json type
+  const bool integer_only = (node.types & INTEGER_TYPE) && !(node.types & NUMBER_TYPE);
+  m_value_constraints |= std::isfinite(node.minimum) || std::isfinite(node.maximum) || node.min_length > 0 ||
+                         node.max_length != UINT64_MAX || node.pattern >= 0 || node.has_constants || integer_only;
+
+  m_nodes.push_back(node);
+  return static_cast<int32_t>(m_nodes.size() - 1);
+}
+
+uint32_t CompiledSchema::compile_pattern(const std::string& _source)
+{
+  for (size_t i = 0; i < m_patterns.size(); ++i) {
+    if (m_patterns[i].source == _source) {
+      return static_cast<uint32_t>(i);
+    }
+  }
+
+  Pattern pattern;
+  pattern.source = _source;
+  // "^[...]+$" and "^[...]*$" become a lookup table
+  if (_source.size() > 5 && _source.compare(0, 2, "^[") == 0 && _source.back() == '$' &&
+      _source[_source.size() - 3] == ']' && (_source[_source.size() - 2] == '+' || _source[_source.size() - 2] == '*')) {
+    pattern.is_class = parse_class(_source.substr(2, _source.size() - 5), pattern.in_class);
+    pattern.allows_empty = _source[_source.size() - 2] == '*';
+  }
+  if (!pattern.is_class) {
+    std::fill(std::begin(pattern.in_class), std::end(pattern.in_class), false);
+    pattern.regex = std::regex(_source, std::regex::ECMAScript | std::regex::optimize);
+  }
+  m_patterns.push_back(std::move(pattern));
+  return static_cast<uint32_t>(m_patterns.size() - 1);
+}
+
+CompiledSchema::Range CompiledSchema::compile_subschemas(const nlohmann::json& _schemas)
+{
+  if (!_schemas.is_array() || _schemas.empty()) {
+    throw std::invalid_argument("Combinators take a non-empty array of schemas");
+  }
+  std::vector<int32_t> nodes;
+  for (const auto& schema : _schemas) {
+    nodes.push_back(compile(schema));
+  }
+  Range range;
+  range.begin = static_cast<uint32_t>(m_subschemas.size());
+  m_subschemas.insert(m_subschemas.end(), nodes.begin(), nodes.end());
+  range.end = static_cast<uint32_t>(m_subschemas.size());
+  return range;
+}
+
+bool CompiledSchema::check(int32_t _node, const nlohmann::json& _instance, Failure& _failure) const
+{
+  if (_node == ANY_NODE) {
+    return true;
+  }
+  if (_node == NO_NODE) {
+    return fail(_failure, _instance, "instance invalid as per false-schema");
+  }
+  const Node& node = m_nodes[_node];
+
+  // Type tag of the instance, checked against the allowed ones
+  bool allowed = false;
+  switch (_instance.type()) {
+    case nlohmann::json::value_t::null:
+      allowed = node.types & NULL_TYPE;
+      break;
+    case nlohmann::json::value_t::boolean:
+      allowed = node.types & BOOLEAN_TYPE;
+      break;
+    case nlohmann::json::value_t::number_integer:
+    case nlohmann::json::value_t::number_unsigned:
+      allowed = node.types & (INTEGER_TYPE | NUMBER_TYPE);
+      break;
+    case nlohmann::json::value_t::number_float: {
+      const double value = _instance.get<double>();
+      allowed = (node.types & NUMBER_TYPE) || ((node.types & INTEGER_TYPE) && std::isfinite(value) && std::floor(value) == value);
+      break;
+    }
+    case nlohmann::json::value_t::string:
+      allowed = node.types & STRING_TYPE;
+      break;
+    case nlohmann::json::value_t::array:
+    case nlohmann::json::value_t::binary:
+      allowed = node.types & ARRAY_TYPE;
+      break;
+    case nlohmann::json::value_t::object:
+      allowed = node.types & OBJECT_TYPE;
+      break;
+    default:
+      break;
+  }
+  if (!allowed) {
+    return fail(_failure, _instance, "unexpected instance type");
+  }
+
+  if (_instance.is_object()) {
+    if (!check_object(node, _instance, _failure)) return false;
+  }
+  else if (_instance.is_array()) {
+    if (!check_array(node, _instance, _failure)) return false;
+  }
+  else if (_instance.is_number()) {
+    if (!check_number(node, _instance, _failure)) return false;
+  }
+  else if (_instance.is_string()) {
+    if (!check_string(node, _instance, _failure)) return false;
+  }
+
+  if (node.has_constants) {
+    bool found = false;
+    for (uint32_t i = node.constants.begin; i < node.constants.end && !found; ++i) {
+      found = m_constants[i] == _instance;
+    }
+    if (!found) {
+      return fail(_failure, _instance, "instance not found in required enum");
+    }
+  }
+
+  for (uint32_t i = node.all_of.begin; i < node.all_of.end; ++i) {
+    if (!check(m_subschemas[i], _instance, _failure)) {
+      return false;
+    }
+  }
+  if (node.any_of.begin != node.any_of.end) {
+    Failure ignored;
+    bool passed = false;
+    for (uint32_t i = node.any_of.begin; i < node.any_of.end && !passed; ++i) {
+      passed = check(m_subschemas[i], _instance, ignored);
+    }
+    if (!passed) {
+      return fail(_failure, _instance, "no subschema has succeeded, but one of them is required to validate");
+    }
+  }
+  if (node.one_of.begin != node.one_of.end) {
+    Failure ignored;
+    int passed = 0;
+    for (uint32_t i = node.one_of.begin; i < node.one_of.end && passed < 2; ++i) {
+      passed += check(m_subschemas[i], _instance, ignored);
+    }
+    if (passed != 1) {
+      return fail(_failure, _instance, passed ? "more than one subschema has succeeded, but exactly one of them is required to validate"
+                                              : "no subschema has succeeded, but one of them is required to validate");
+    }
+  }
+  if (node.not_of != ANY_NODE) {
+    Failure ignored;
+    if (check(node.not_of, _instance, ignored)) {
+      return fail(_failure, _instance, "the subschema has succeeded, but it is required to not validate");
+    }
+  }
+  return true;
+}
+
+bool CompiledSchema::check_object(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const
+{
+  const auto properties_begin = m_properties.begin() + _node.properties.begin;
+  const auto properties_end = m_properties.begin() + _node.properties.end;
+  uint64_t found = 0;
+
+  for (auto it = _instance.begin(); it != _instance.end(); ++it) {
+    const std::string& key = it.key();
+    bool matched = false;
+
+    auto property = std::lower_bound(properties_begin, properties_end, key,
+                                     [](const Property& _property, const std::string& _key) { return _property.name < _key; });
+    if (property != properties_end && property->name == key) {
+      if (property->required_bit >= 0) {
+        found |= uint64_t(1) << property->required_bit;
+      }
+      if (property->declared) {
+        matched = true;
+        if (!check(property->node, it.value(), _failure)) {
+          return fail_under(_failure, pointer_token(key));
+        }
+      }
+    }
+
+    for (uint32_t i = _node.pattern_properties.begin; i < _node.pattern_properties.end; ++i) {
+      const PatternProperty& pattern_property = m_pattern_properties[i];
+      if (m_patterns[pattern_property.pattern].matches(key)) {
+        matched = true;
+        if (!check(pattern_property.node, it.value(), _failure)) {
+          return fail_under(_failure, pointer_token(key));
+        }
+      }
+    }
+
+    if (!matched && _node.additional_properties != ANY_NODE) {
+      if (_node.additional_properties == NO_NODE) {
+        fail(_failure, it.value(), "validation failed for additional property '" + key + "': instance invalid as per false-schema");
+        return fail_under(_failure, pointer_token(key));
+      }
+      if (!check(_node.additional_properties, it.value(), _failure)) {
+        return fail_under(_failure, pointer_token(key));
+      }
+    }
+  }
+
+  if ((found & _node.required) != _node.required) {
+    for (auto property = properties_begin; property != properties_end; ++property) {
+      if (property->required_bit >= 0 && !(found & (uint64_t(1) << property->required_bit))) {
+        return fail(_failure, _instance, "required property '" + property->name + "' not found in object");
+      }
+    }
+  }
+  return true;
+}
+
+bool CompiledSchema::check_array(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const
+{
+  if (_instance.size() < _node.min_items) {
+    return fail(_failure, _instance, "array has too few items");
+  }
+  if (_instance.size() > _node.max_items) {
+    return fail(_failure, _instance, "array has too many items");
+  }
+  if (_node.items != ANY_NODE) {
+    for (size_t i = 0; i < _instance.size(); ++i) {
+      if (!check(_node.items, _instance[i], _failure)) {
+        return fail_under(_failure, std::to_string(i));
+      }
+    }
+  }
+  return true;
+}
+
+bool CompiledSchema::check_number(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const
+{
+  const double value = _instance.get<double>();
+  if (_node.exclusive_minimum ? value <= _node.minimum : value < _node.minimum) {
+    return fail(_failure, _instance, "instance is below minimum of " + nlohmann::json(_node.minimum).dump());
+  }
+  if (_node.exclusive_maximum ? value >= _node.maximum : value > _node.maximum) {
+    return fail(_failure, _instance, "instance exceeds maximum of " + nlohmann::json(_node.maximum).dump());
+  }
+  return true;
+}
+
+bool CompiledSchema::check_string(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const
+{
+  const std::string& value = _instance.get_ref<const std::string&>();
+  if (_node.min_length > 0 || _node.max_length != UINT64_MAX) {
+    // Lengths count code points, not the bytes of their UTF-8 encoding
+    const uint64_t length = std::count_if(value.begin(), value.end(), [](char _c) { return (static_cast<unsigned char>(_c) & 0xC0) != 0x80; });
+    if (length < _node.min_length) {
+      return fail(_failure, _instance, "instance is too short as per minLength: " + std::to_string(_node.min_length));
+    }
+    if (length > _node.max_length) {
+      return fail(_failure, _instance, "instance is too long as per maxLength: " + std::to_string(_node.max_length));
+    }
+  }
+  if (_node.pattern >= 0 && !m_patterns[_node.pattern].matches(value)) {
+    return fail(_failure, _instance, "instance does not match regex pattern: " + m_patterns[_node.pattern].source);
+  }
+  return true;
+}
@@ -0,0 +1,205 @@
+/**
+ * @file nudock_schema.hpp
+ *
+ * @brief JSON schemas compiled into flat check programs.
+ *
+ * The generic json_validator walks its schema tree for every message, looking
+ * keywords up as it goes. A CompiledSchema does that once, when the endpoint
+ * is registered, and flattens the schema into a table of nodes: allowed types
+ * as a bitmask, the properties of each object in a sorted lookup table with
+ * the required ones as a bitset, and the patternProperties regexes compiled up
+ * front, the usual "^[a-zA-Z0-9_]+$" ones into a character lookup table. With
+ * that, validation costs about as much as reading the message once, and can
+ * stay on in production.
+ *
+ * Schemas using keywords outside of the compiled set (e.g. "$ref", "format")
+ * are validated by json_validator as before.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <nlohmann/json-schema.hpp>
+
+/**
+ * @brief JSON schema compiled into a table of nodes, validating messages without walking the schema.
+ *
+ * Supports the keywords type, properties, required, additionalProperties,
+ * patternProperties, items (a single schema), minItems, maxItems, minimum,
+ * maximum, exclusiveMinimum, exclusiveMaximum, minLength, maxLength, pattern,
+ * enum, const, anyOf, allOf, oneOf and not.
+ */
+class CompiledSchema
+{
+  public:
+    /**
+     * @brief Compiles a schema, keeping a json_validator for the schemas that can't be.
+     *
+     * @param _schema JSON schema of the messages, e.g. the "request" part of an endpoint schema file
+     */
+    explicit CompiledSchema(const nlohmann::json& _schema);
+
+    /**
+     * @brief Validates a message, reporting the first violation to the error handler.
+     *
+     * Same interface as json_validator::validate(). NuDock's binary arrays (see
+     * make_binary_array()) are taken as arrays, their items aren't checked.
+     *
+     * @param _instance Message to validate
+     * @param _errors Called with the json pointer, value and reason of the violation
+     */
+    void validate(const nlohmann::json& _instance, nlohmann::json_schema::error_handler& _errors) const;
+
+    /// @brief Whether the schema was compiled, false if it is validated by json_validator
+    bool compiled() const { return !m_fallback; }
+
+    /**
+     * @brief Whether the schema checks the values of a message and not just its structure.
+     *
+     * True for ranges, string lengths, patterns, enums, consts and integer
+     * types, and for the schemas left to json_validator. Only the messages of
+     * a schema without value constraints can be told valid by their
+     * structural_fingerprint().
+     */
+    bool has_value_constraints() const { return m_fallback || m_value_constraints; }
+
+    /// @brief Type tags of the schema "type" keyword, as bits of Node::types
+    enum TypeTag : uint8_t {
+      NULL_TYPE = 1 << 0,
+      BOOLEAN_TYPE = 1 << 1,
+      INTEGER_TYPE = 1 << 2,
+      NUMBER_TYPE = 1 << 3,
+      STRING_TYPE = 1 << 4,
+      ARRAY_TYPE = 1 << 5,
+      OBJECT_TYPE = 1 << 6,
+      ALL_TYPES = 0x7f,
+    };
+
+  private:
+    /// @brief Child node ids allowing any value / no value at all, i.e. the schemas true and false
+    static constexpr int32_t ANY_NODE = -1;
+    static constexpr int32_t NO_NODE = -2;
+
+    /// @brief Slice of one of the tables below
+    struct Range {
+      uint32_t begin = 0;
+      uint32_t end = 0;
+    };
+
+    /// @brief One (sub)schema, its keywords resolved into plain values
+    struct Node {
+      uint8_t types = ALL_TYPES;
+      // Objects
+      Range properties;
+      uint64_t required = 0;
+      Range pattern_properties;
+      int32_t additional_properties = ANY_NODE;
+      // Arrays
+      int32_t items = ANY_NODE;
+      uint64_t min_items = 0;
+      uint64_t max_items = UINT64_MAX;
+      // Numbers
+      double minimum = -std::numeric_limits<double>::infinity();
+      double maximum = std::numeric_limits<double>::infinity();
+      bool exclusive_minimum = false;
+      bool exclusive_maximum = false;
+      // Strings
+      uint64_t min_length = 0;
+      uint64_t max_length = UINT64_MAX;
+      int32_t pattern = -1;
+      // enum / const
+      bool has_constants = false;
+      Range constants;
+      // Combinators
+      Range any_of;
+      Range all_of;
+      Range one_of;
+      int32_t not_of = ANY_NODE;
+    };
+
+    /// @brief Entry of a property lookup table, sorted by name
+    struct Property {
+      std::string name;
+      int32_t node;
+      /// @brief Bit of Node::required, -1 if the property is optional
+      int8_t required_bit;
+      /// @brief Listed in "properties", false for the names only listed in "required",
+      ///        which additionalProperties still applies to
+      bool declared;
+    };
+
+    /// @brief patternProperties entry
+    struct PatternProperty {
+      uint32_t pattern;
+      int32_t node;
+    };
+
+    /**
+     * @brief Regex compiled up front.
+     *
+     * Patterns of a single character class repeated over the whole string,
+     * e.g. "^[a-zA-Z0-9_]+$", are matched with a lookup table instead.
+     */
+    struct Pattern {
+      std::string source;
+      bool is_class = false;
+      bool allows_empty = false;
+      bool in_class[128] = {};
+      std::regex regex;
+
+      bool matches(const std::string& _string) const;
+    };
+
+    /// @brief Violation found by check(), with the json pointer filled in on the way back up
+    struct Failure {
+      std::string pointer;
+      const nlohmann::json* instance = nullptr;
+      std::string message;
+    };
+
+    int32_t compile(const nlohmann::json& _schema);
+    uint32_t compile_pattern(const std::string& _source);
+    Range compile_subschemas(const nlohmann::json& _schemas);
+
+    bool check(int32_t _node, const nlohmann::json& _instance, Failure& _failure) const;
+    bool check_object(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const;
+    bool check_array(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const;
+    bool check_number(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const;
+    bool check_string(const Node& _node, const nlohmann::json& _instance, Failure& _failure) const;
+
+    /// @brief Records a violation of _instance, returns false
+    static bool fail(Failure& _failure, const nlohmann::json& _instance, std::string _message);
+    /// @brief Prepends the key / index the failure happened under to its pointer, returns false
+    static bool fail_under(Failure& _failure, const std::string& _token);
+
+    /// @brief Node the messages are checked against
+    int32_t m_root = ANY_NODE;
+
+    std::vector<Node> m_nodes;
+    std::vector<Property> m_properties;
+    std::vector<PatternProperty> m_pattern_properties;
+    std::vector<Pattern> m_patterns;
+    std::vector<nlohmann::json> m_constants;
+    std::vector<int32_t> m_subschemas;
+    /// @brief Any node with a constraint on the values, see has_value_constraints()
+    bool m_value_constraints = false;
+
+    /// @brief Validator of the schemas that can't be compiled
+    std::unique_ptr<nlohmann::json_schema::json_validator> m_fallback;
+};
+
+/**
+ * @brief Hash of the structure of a message: its types, object keys and array sizes, but not its values.
+ *
+ * Two messages with the same fingerprint only differ by the numbers, strings
+ * and booleans they hold, so a schema without value constraints (see
+ * CompiledSchema::has_value_constraints()) accepts either both or neither.
+ */
+uint64_t structural_fingerprint(const nlohmann::json& _message);
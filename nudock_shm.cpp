@@ -0,0 +1,442 @@
+#include "nudock_shm.hpp"
+#include "nudock_wire.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+namespace {
+
+constexpr uint32_t SHM_MAGIC = 0x4b434f44; // "DOCK"
+constexpr uint32_t SHM_VERSION = 3;
+
+/// @brief Values of ShmRegionHeader::client_attached
+constexpr uint32_t SHM_CLIENT_DETACHED = 0;
+constexpr uint32_t SHM_CLIENT_ATTACHING = 1;
+constexpr uint32_t SHM_CLIENT_READY = 2;
+
+/// @brief Number of polls of the ring positions before going to sleep on the futex
+constexpr int SHM_SPIN_COUNT = 4000;
+
+/// @brief How long a futex wait lasts before re-checking whether the peer is still there
+constexpr long SHM_WAIT_NS = 100 * 1000 * 1000;
+
+/// @brief Longest request name read from the ring, the rest of a longer one is skipped
+constexpr uint32_t SHM_MAX_NAME_SIZE = 4096;
+
+/// @brief Fixed-size prefix of every message in the rings
+struct ShmMessageHeader {
+  uint32_t name_or_status;
+  /// @brief MessageEncoding of the body, responses use the one of their request
+  uint32_t encoding;
+  uint64_t body_size;
+};
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+void futex_wait(std::atomic<uint32_t>& _word, uint32_t _expected)
+{
+#if defined(__linux__)
+  timespec timeout{0, SHM_WAIT_NS};
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_word), FUTEX_WAIT, _expected, &timeout, nullptr, 0);
+#else
+  if (_word.load() == _expected) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+#endif
+}
+
+void futex_wake(std::atomic<uint32_t>& _word)
+{
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_word), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#else
+  (void)_word;
+#endif
+}
+
+/// @brief Spinning only helps if the peer can make progress on another core
+int spin_count()
+{
+  static const int count = std::thread::hardware_concurrency() > 1 ? SHM_SPIN_COUNT : 0;
+  return count;
+}
+
+/// @brief Whether the process is still running, so a peer killed mid-request isn't waited for forever
+bool process_alive(int32_t _pid)
+{
+  return _pid <= 0 || kill(_pid, 0) == 0 || errno != ESRCH;
+}
+
+uint64_t region_size(uint64_t _capacity)
+{
+  return sizeof(ShmRegionHeader) + 2 * _capacity;
+}
+
+} // namespace
+
+SharedMemoryChannel::SharedMemoryChannel(const std::string& _name, bool _owner)
+    : m_name(_name), m_owner(_owner), m_region(nullptr), m_region_size(0),
+      m_header(nullptr), m_request_data(nullptr), m_response_data(nullptr),
+      m_max_payload_size(MAX_FRAME_PAYLOAD)
+{
+}
+
+SharedMemoryChannel::~SharedMemoryChannel()
+{
+  if (m_header) {
+    if (m_owner) {
+      m_header->server_alive.store(0);
+      futex_wake(m_header->response.data_seq);
+    }
+    else {
+      m_header->client_attached.store(SHM_CLIENT_DETACHED);
+    }
+  }
+  if (m_region) {
+    munmap(m_region, m_region_size);
+  }
+  if (m_owner) {
+    shm_unlink(m_name.c_str());
+  }
+}
+
+void SharedMemoryChannel::map_region(int _fd, uint64_t _size)
+{
+  m_region = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+  close(_fd);
+  if (m_region == MAP_FAILED) {
+    m_region = nullptr;
+    throw std::runtime_error("Could not map shared memory " + m_name + ": " + std::strerror(errno));
+  }
+  m_region_size = _size;
+  m_header = static_cast<ShmRegionHeader*>(m_region);
+}
+
+std::unique_ptr<SharedMemoryChannel> SharedMemoryChannel::create(const std::string& _name,
+                                                                 uint64_t _capacity)
+{
+  std::unique_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel(_name, true));
+
+  // Clean up the old region, if any
+  shm_unlink(_name.c_str());
+  int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("Could not create shared memory " + _name + ": " + std::strerror(errno));
+  }
+  if (ftruncate(fd, region_size(_capacity)) != 0) {
+    close(fd);
+    throw std::runtime_error("Could not resize shared memory " + _name + ": " + std::strerror(errno));
+  }
+  channel->map_region(fd, region_size(_capacity));
+
+  ShmRegionHeader* header = new (channel->m_region) ShmRegionHeader();
+  header->capacity = _capacity;
+  for (ShmRing* ring : {&header->request, &header->response}) {
+    ring->head.store(0);
+    ring->tail.store(0);
+    ring->data_seq.store(0);
+    ring->data_waiters.store(0);
+    ring->space_seq.store(0);
+    ring->space_waiters.store(0);
+  }
+  header->client_attached.store(SHM_CLIENT_DETACHED);
+  header->client_pid.store(0);
+  header->server_pid = getpid();
+  header->server_alive.store(1);
+  header->version = SHM_VERSION;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = SHM_MAGIC;
+
+  channel->m_request_data = static_cast<char*>(channel->m_region) + sizeof(ShmRegionHeader);
+  channel->m_response_data = channel->m_request_data + _capacity;
+  return channel;
+}
+
+std::unique_ptr<SharedMemoryChannel> SharedMemoryChannel::attach(const std::string& _name)
+{
+  std::unique_ptr<SharedMemoryChannel> channel(new SharedMemoryChannel(_name, false));
+
+  int fd = shm_open(_name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open shared memory " + _name + ", is the server running? " + std::strerror(errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(ShmRegionHeader)) {
+    close(fd);
+    throw std::runtime_error("Shared memory " + _name + " is not initialised");
+  }
+  channel->map_region(fd, st.st_size);
+
+  ShmRegionHeader* header = channel->m_header;
+  if (header->magic != SHM_MAGIC || header->version != SHM_VERSION ||
+      region_size(header->capacity) != static_cast<uint64_t>(st.st_size)) {
+    channel->m_header = nullptr;
+    throw std::runtime_error("Shared memory " + _name + " has an unexpected layout");
+  }
+  // The region of a client that crashed without detaching is taken over
+  uint32_t state = header->client_attached.load();
+  if ((state != SHM_CLIENT_DETACHED && process_alive(header->client_pid.load())) ||
+      !header->client_attached.compare_exchange_strong(state, SHM_CLIENT_ATTACHING)) {
+    channel->m_header = nullptr;
+    throw std::runtime_error("Shared memory " + _name + " is already used by another client");
+  }
+  header->client_pid.store(getpid());
+
+  channel->m_request_data = static_cast<char*>(channel->m_region) + sizeof(ShmRegionHeader);
+  channel->m_response_data = channel->m_request_data + header->capacity;
+
+  // Wait for the server to drop what an earlier client left in the rings,
+  // e.g. a response it never read
+  header->request.data_seq.fetch_add(1);
+  futex_wake(header->request.data_seq);
+  while (header->client_attached.load() != SHM_CLIENT_READY) {
+    if (!channel->peer_alive()) {
+      throw std::runtime_error("Shared memory server went away: " + _name);
+    }
+    futex_wait(header->client_attached, SHM_CLIENT_ATTACHING);
+  }
+  return channel;
+}
+
+void SharedMemoryChannel::write_ring(ShmRing& _ring, char* _data, const char* _src, uint64_t _size)
+{
+  const uint64_t capacity = m_header->capacity;
+  uint64_t tail = _ring.tail.load(std::memory_order_relaxed);
+
+  while (_size > 0) {
+    // Wait for free space: spin first, then sleep on the futex
+    uint64_t free_space = capacity - (tail - _ring.head.load(std::memory_order_acquire));
+    for (int spin = 0; free_space == 0 && spin < spin_count(); ++spin) {
+      cpu_relax();
+      free_space = capacity - (tail - _ring.head.load(std::memory_order_acquire));
+    }
+    while (free_space == 0) {
+      uint32_t seq = _ring.space_seq.load();
+      free_space = capacity - (tail - _ring.head.load());
+      if (free_space > 0) {
+        break;
+      }
+      if (!peer_alive()) {
+        throw std::runtime_error("Shared memory peer went away while writing to " + m_name);
+      }
+      _ring.space_waiters.fetch_add(1);
+      futex_wait(_ring.space_seq, seq);
+      _ring.space_waiters.fetch_sub(1);
+      free_space = capacity - (tail - _ring.head.load(std::memory_order_acquire));
+    }
+
+    // Copy as much as fits, wrapping around the end of the buffer
+    uint64_t chunk = std::min(free_space, _size);
+    uint64_t offset = tail % capacity;
+    uint64_t first = std::min(chunk, capacity - offset);
+    std::memcpy(_data + offset, _src, first);
+    std::memcpy(_data, _src + first, chunk - first);
+
+    tail += chunk;
+    _src += chunk;
+    _size -= chunk;
+
+    // Publish and wake up the reader if it went to sleep
+    _ring.tail.store(tail, std::memory_order_release);
+    _ring.data_seq.fetch_add(1);
+    if (_ring.data_waiters.load() > 0) {
+      futex_wake(_ring.data_seq);
+    }
+  }
+}
+
+bool SharedMemoryChannel::peer_alive() const
+{
+  if (m_owner) {
+    return m_header->client_attached.load() == SHM_CLIENT_READY && process_alive(m_header->client_pid.load());
+  }
+  return m_header->server_alive.load() && process_alive(m_header->server_pid);
+}
+
+SharedMemoryChannel::ReadStatus SharedMemoryChannel::read_ring(ShmRing& _ring, const char* _data, char* _dst,
+                                                               uint64_t _size, const std::atomic<bool>* _running)
+{
+  const uint64_t capacity = m_header->capacity;
+  uint64_t head = _ring.head.load(std::memory_order_relaxed);
+
+  while (_size > 0) {
+    // Wait for data: spin first, then sleep on the futex
+    uint64_t available = _ring.tail.load(std::memory_order_acquire) - head;
+    for (int spin = 0; available == 0 && spin < spin_count(); ++spin) {
+      cpu_relax();
+      available = _ring.tail.load(std::memory_order_acquire) - head;
+    }
+    while (available == 0) {
+      uint32_t seq = _ring.data_seq.load();
+      available = _ring.tail.load() - head;
+      if (available > 0) {
+        break;
+      }
+      if (_running && !_running->load()) {
+        return ReadStatus::STOPPED;
+      }
+      if (!m_owner && !peer_alive()) {
+        throw std::runtime_error("Shared memory server went away: " + m_name);
+      }
+      _ring.data_waiters.fetch_add(1);
+      futex_wait(_ring.data_seq, seq);
+      _ring.data_waiters.fetch_sub(1);
+      available = _ring.tail.load(std::memory_order_acquire) - head;
+      // A client that went away won't finish its request, nor read the response
+      if (available == 0 && m_owner && !peer_alive()) {
+        return ReadStatus::PEER_GONE;
+      }
+    }
+
+    uint64_t chunk = std::min(available, _size);
+    uint64_t offset = head % capacity;
+    uint64_t first = std::min(chunk, capacity - offset);
+    std::memcpy(_dst, _data + offset, first);
+    std::memcpy(_dst + first, _data, chunk - first);
+
+    head += chunk;
+    _dst += chunk;
+    _size -= chunk;
+
+    // Release the space and wake up the writer if it went to sleep
+    _ring.head.store(head, std::memory_order_release);
+    _ring.space_seq.fetch_add(1);
+    if (_ring.space_waiters.load() > 0) {
+      futex_wake(_ring.space_seq);
+    }
+  }
+  return ReadStatus::DONE;
+}
+
+SharedMemoryChannel::ReadStatus SharedMemoryChannel::skip_ring(ShmRing& _ring, const char* _data, uint64_t _size,
+                                                               const std::atomic<bool>* _running)
+{
+  char skipped[4096];
+  while (_size > 0) {
+    const uint64_t chunk = std::min<uint64_t>(_size, sizeof(skipped));
+    ReadStatus status = read_ring(_ring, _data, skipped, chunk, _running);
+    if (status != ReadStatus::DONE) {
+      return status;
+    }
+    _size -= chunk;
+  }
+  return ReadStatus::DONE;
+}
+
+void SharedMemoryChannel::reset_client()
+{
+  // Only the server touches the rings until the new client is let in, so
+  // dropping the unread bytes can't race with the client
+  m_header->request.head.store(m_header->request.tail.load());
+  m_header->response.head.store(m_header->response.tail.load());
+
+  uint32_t attaching = SHM_CLIENT_ATTACHING;
+  if (m_header->client_attached.compare_exchange_strong(attaching, SHM_CLIENT_READY)) {
+    futex_wake(m_header->client_attached);
+  }
+}
+
+void SharedMemoryChannel::send_request(const std::string& _request_name, const std::string& _body,
+                                       uint8_t _encoding)
+{
+  ShmMessageHeader header{static_cast<uint32_t>(_request_name.size()), _encoding, _body.size()};
+  write_ring(m_header->request, m_request_data, reinterpret_cast<const char*>(&header), sizeof(header));
+  write_ring(m_header->request, m_request_data, _request_name.data(), _request_name.size());
+  write_ring(m_header->request, m_request_data, _body.data(), _body.size());
+}
+
+int SharedMemoryChannel::receive_response(std::string& _body)
+{
+  ShmMessageHeader header;
+  read_ring(m_header->response, m_response_data, reinterpret_cast<char*>(&header), sizeof(header), nullptr);
+  if (header.body_size > m_max_payload_size) {
+    skip_ring(m_header->response, m_response_data, header.body_size, nullptr);
+    throw std::runtime_error("Response of " + std::to_string(header.body_size) + " bytes is above the maximum of " +
+                             std::to_string(m_max_payload_size) + " bytes");
+  }
+  _body.resize(header.body_size);
+  read_ring(m_header->response, m_response_data, &_body[0], header.body_size, nullptr);
+  return static_cast<int>(header.name_or_status);
+}
+
+bool SharedMemoryChannel::receive_request(std::string& _request_name, std::string& _body,
+                                          const std::atomic<bool>& _running, uint8_t* _encoding,
+                                          bool* _too_large)
+{
+  ReadStatus status;
+  do {
+    status = read_request(_request_name, _body, _running, _encoding, _too_large);
+    if (status == ReadStatus::PEER_GONE) {
+      reset_client();
+    }
+  } while (status == ReadStatus::PEER_GONE);
+  return status == ReadStatus::DONE;
+}
+
+SharedMemoryChannel::ReadStatus SharedMemoryChannel::read_request(std::string& _request_name, std::string& _body,
+                                                                  const std::atomic<bool>& _running,
+                                                                  uint8_t* _encoding, bool* _too_large)
+{
+  ShmRing& ring = m_header->request;
+  ShmMessageHeader header;
+  ReadStatus status = read_ring(ring, m_request_data, reinterpret_cast<char*>(&header), sizeof(header), &_running);
+  if (status != ReadStatus::DONE) {
+    return status;
+  }
+  if (_encoding) {
+    *_encoding = static_cast<uint8_t>(header.encoding);
+  }
+  // A longer name can't be one of the endpoints, it's cut short and answered with 404
+  const uint32_t name_size = std::min(header.name_or_status, SHM_MAX_NAME_SIZE);
+  _request_name.resize(name_size);
+  status = read_ring(ring, m_request_data, &_request_name[0], name_size, &_running);
+  if (status == ReadStatus::DONE) {
+    status = skip_ring(ring, m_request_data, header.name_or_status - name_size, &_running);
+  }
+  if (status != ReadStatus::DONE) {
+    return status;
+  }
+
+  // The size comes from the other process, a larger body is skipped rather than allocated
+  const bool too_large = header.body_size > m_max_payload_size;
+  if (_too_large) {
+    *_too_large = too_large;
+  }
+  if (too_large) {
+    _body.clear();
+    return skip_ring(ring, m_request_data, header.body_size, &_running);
+  }
+  _body.resize(header.body_size);
+  return read_ring(ring, m_request_data, &_body[0], header.body_size, &_running);
+}
+
+void SharedMemoryChannel::send_response(int _status, const std::string& _body, uint8_t _encoding)
+{
+  ShmMessageHeader header{static_cast<uint32_t>(_status), _encoding, _body.size()};
+  write_ring(m_header->response, m_response_data, reinterpret_cast<const char*>(&header), sizeof(header));
+  write_ring(m_header->response, m_response_data, _body.data(), _body.size());
+}
@@ -0,0 +1,162 @@
+/**
+ * @file nudock_shm.hpp
+ *
+ * @brief POSIX shared-memory transport for NuDock server and client on the same node.
+ *
+ * The server creates a shared-memory region with two single-producer /
+ * single-consumer byte rings: one for the requests (client -> server) and one
+ * for the responses (server -> client). Both sides spin shortly on the ring
+ * positions and fall back to futex waits, so a round trip never goes through
+ * the socket stack or HTTP.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/// @brief Ring positions and wakeup words for one direction of the channel.
+struct ShmRing {
+  /// @brief Total number of bytes consumed by the reader
+  alignas(64) std::atomic<uint64_t> head;
+  /// @brief Total number of bytes published by the writer
+  alignas(64) std::atomic<uint64_t> tail;
+  /// @brief Bumped by the writer after publishing, futex word for the reader
+  alignas(64) std::atomic<uint32_t> data_seq;
+  std::atomic<uint32_t> data_waiters;
+  /// @brief Bumped by the reader after consuming, futex word for the writer
+  alignas(64) std::atomic<uint32_t> space_seq;
+  std::atomic<uint32_t> space_waiters;
+};
+
+/// @brief Layout of the start of the shared-memory region, followed by the ring buffers.
+struct ShmRegionHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  std::atomic<uint32_t> server_alive;
+  /// @brief 0 without a client, 1 while the server resets the rings for a new one, 2 once it can send requests
+  std::atomic<uint32_t> client_attached;
+  /// @brief Processes of both sides, to notice a peer that crashed without clearing the flags above
+  int32_t server_pid;
+  std::atomic<int32_t> client_pid;
+  ShmRing request;
+  ShmRing response;
+};
+
+class SharedMemoryChannel
+{
+  public:
+    /**
+     * @brief Server: creates (or re-creates) the shared-memory region.
+     *
+     * @param _name Name of the POSIX shared-memory object, e.g. "/nudock_1234"
+     * @param _capacity Size of each of the request and response rings in bytes
+     */
+    static std::unique_ptr<SharedMemoryChannel> create(const std::string& _name,
+                                                       uint64_t _capacity);
+
+    /**
+     * @brief Client: attaches to a region created by a running server.
+     *
+     * @param _name Name of the POSIX shared-memory object, e.g. "/nudock_1234"
+     */
+    static std::unique_ptr<SharedMemoryChannel> attach(const std::string& _name);
+
+    ~SharedMemoryChannel();
+
+    /**
+     * @brief Sets the largest message body accepted from the peer.
+     *
+     * @param _max_payload_size Size of the body in bytes, MAX_FRAME_PAYLOAD by default
+     */
+    void set_max_payload_size(uint64_t _max_payload_size) { m_max_payload_size = _max_payload_size; }
+
+    /**
+     * @brief Client: writes a request into the request ring.
+     *
+     * @param _request_name Request ID name, e.g. "/set_parameters"
+     * @param _body Serialised request message
+     * @param _encoding MessageEncoding of the message, see nudock_encoding.hpp
+     */
+    void send_request(const std::string& _request_name, const std::string& _body, uint8_t _encoding = 0);
+
+    /**
+     * @brief Client: blocks until the server's response is available.
+     *
+     * Throws std::runtime_error if the server stopped or its process is gone,
+     * instead of waiting for a response that never comes, or if the response
+     * is larger than the maximum payload size; it is skipped in that case.
+     *
+     * @param _body Filled with the serialised response message
+     * @return Status code of the response, following the HTTP ones (200, 400, 404)
+     */
+    int receive_response(std::string& _body);
+
+    /**
+     * @brief Server: blocks until the next request is available.
+     *
+     * A request left half-written by a client that went away is dropped, and
+     * the rings are reset before a new client can use them.
+     *
+     * @param _request_name Filled with the request ID name
+     * @param _body Filled with the serialised request message
+     * @param _running Flag checked periodically, returns false once it's cleared
+     * @param _encoding If given, filled with the MessageEncoding of the message
+     * @param _too_large If given, set when the body was larger than the maximum
+     *                   payload size; it is skipped and _body is left empty
+     * @return true if a request was received, false if the server was stopped
+     */
+    bool receive_request(std::string& _request_name, std::string& _body,
+                         const std::atomic<bool>& _running, uint8_t* _encoding = nullptr,
+                         bool* _too_large = nullptr);
+
+    /**
+     * @brief Server: writes a response into the response ring.
+     *
+     * @param _status Status code of the response
+     * @param _body Serialised response message
+     * @param _encoding MessageEncoding of the message, the one of the request
+     */
+    void send_response(int _status, const std::string& _body, uint8_t _encoding = 0);
+
+  private:
+    /// @brief Outcome of read_ring()
+    enum class ReadStatus { DONE, STOPPED, PEER_GONE };
+
+    SharedMemoryChannel(const std::string& _name, bool _owner);
+
+    void map_region(int _fd, uint64_t _size);
+
+    /// @brief Whether the other side is still attached and its process still running
+    bool peer_alive() const;
+
+    /// @brief Copies bytes into the ring, blocking while it's full
+    void write_ring(ShmRing& _ring, char* _data, const char* _src, uint64_t _size);
+
+    /// @brief Copies bytes out of the ring, blocking while it's empty
+    ReadStatus read_ring(ShmRing& _ring, const char* _data, char* _dst, uint64_t _size,
+                         const std::atomic<bool>* _running);
+
+    /// @brief Reads and throws away bytes of the ring, e.g. a body above the maximum payload size
+    ReadStatus skip_ring(ShmRing& _ring, const char* _data, uint64_t _size,
+                         const std::atomic<bool>* _running);
+
+    /// @brief Server: reads the next request, see receive_request()
+    ReadStatus read_request(std::string& _request_name, std::string& _body, const std::atomic<bool>& _running,
+                            uint8_t* _encoding, bool* _too_large);
+
+    /// @brief Server: drops what's left in both rings, and lets an attaching client in
+    void reset_client();
+
+    std::string m_name;
+    bool m_owner;
+    void* m_region;
+    uint64_t m_region_size;
+    ShmRegionHeader* m_header;
+    char* m_request_data;
+    char* m_response_data;
+    uint64_t m_max_payload_size;
+};
@@ -0,0 +1,126 @@
+/**
+ * @file nudock_validation.hpp
+ *
+ * @brief Schema validation policies of the NuDock server.
+ *
+ * The policy is a template argument of BasicNuDock, so validation is chosen
+ * when the server is compiled instead of following the debug flag. NuDock
+ * is BasicNuDock<NoValidation>:
+ *
+ * @code
+ *   BasicNuDock<FullValidation> dock(false, "", CommunicationType::TCP);   // quiet, but checking every message
+ *   NuDock dock(false, "", CommunicationType::TCP);                        // production, no validation on the request path
+ * @endcode
+ *
+ * With NoValidation the validators are never called and the error messages
+ * are never built, the code isn't even there. The policies are shipped with
+ * the library, which is built with all of them.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/// @brief Defaults of the policies below, each of them only states what it changes
+struct ValidationPolicyBase {
+  /// @brief Whether requests / responses are validated against the endpoint schemas
+  static constexpr bool requests = false;
+  static constexpr bool responses = false;
+  /// @brief Only the requests picked by NuDockBase::set_validation_sampling() are validated
+  static constexpr bool sampled = false;
+  /// @brief Only validates if the instance was constructed with _debug=true
+  static constexpr bool debug_only = false;
+  /// @brief Validates on a background thread, after the response has been sent
+  static constexpr bool asynchronous = false;
+};
+
+/// @brief No validation at all, for production runs with a trusted client
+struct NoValidation : ValidationPolicyBase {};
+
+/// @brief Validates the requests only, catching incompatible clients without checking our own responses
+struct RequestValidation : ValidationPolicyBase {
+  static constexpr bool requests = true;
+};
+
+/// @brief Validates every request and response
+struct FullValidation : ValidationPolicyBase {
+  static constexpr bool requests = true;
+  static constexpr bool responses = true;
+};
+
+/// @brief Validates the requests, and their responses, picked by NuDockBase::set_validation_sampling()
+struct SampledValidation : ValidationPolicyBase {
+  static constexpr bool requests = true;
+  static constexpr bool responses = true;
+  static constexpr bool sampled = true;
+};
+
+/**
+ * @brief Validates every request and response on a background thread, after the response has been sent.
+ *
+ * The requests are answered as with NoValidation, so the validation adds no
+ * latency. The serialised request and the response are handed over to the
+ * validation thread without copies. With IN_PROCESS the response is shared
+ * with the client, and only the json request is copied, as it stays the
+ * caller's.
+ * Violations are logged, counted in NuDockBase::validation_counters() and
+ * passed to the hook of NuDockBase::set_validation_failure_hook(), but the
+ * request that caused one has already been answered. Requests arriving while
+ * the validation thread is too far behind are skipped.
+ */
+struct AsyncValidation : ValidationPolicyBase {
+  static constexpr bool requests = true;
+  static constexpr bool responses = true;
+  static constexpr bool asynchronous = true;
+};
+
+/// @brief Validates every request and response if constructed with _debug=true, like NuDock did before the policies
+struct DebugValidation : ValidationPolicyBase {
+  static constexpr bool requests = true;
+  static constexpr bool responses = true;
+  static constexpr bool debug_only = true;
+};
+
+/**
+ * @brief Requests validated by SampledValidation, counted per endpoint.
+ *
+ * Schema violations show up on the first calls between a fitter and an
+ * experiment, so the first requests of every endpoint are all validated, and
+ * the following ones only now and then:
+ *
+ * @code
+ *   ValidationSampling sampling;
+ *   sampling.warm_up = 1000;             // validate the first 1000 requests of every endpoint,
+ *   sampling.period = 10000;             // then one in every 10000,
+ *   sampling.stop_after_passes = 5000;   // and none once 5000 in a row passed
+ *   dock.set_validation_sampling(sampling);
+ * @endcode
+ */
+struct ValidationSampling {
+  /// @brief Number of first requests that are all validated
+  uint64_t warm_up = 100;
+  /// @brief After the warm-up, one request in every period is validated, 0 for none
+  uint64_t period = 100;
+  /// @brief Validation of the endpoint stops once this many requests passed in a row, 0 never stops
+  uint64_t stop_after_passes = 0;
+};
+
+/// @brief Requests to an endpoint by outcome of their validation, see NuDockBase::validation_counters()
+struct ValidationCounters {
+  /// @brief Requests validated, with their responses if the policy validates those
+  uint64_t validated = 0;
+  /// @brief Requests the policy would validate, but didn't pick
+  uint64_t skipped = 0;
+  /// @brief Requests whose request or response failed the validation
+  uint64_t failed = 0;
+};
+
+/**
+ * @brief Called with the request name and the violation found by AsyncValidation.
+ *
+ * Called on the validation thread. Returning true stops the server, failing
+ * fast like the synchronous policies do, returning false keeps serving.
+ */
+using ValidationFailureHook = std::function<bool(const std::string& _request_name, const std::string& _error)>;
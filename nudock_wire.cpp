@@ -0,0 +1,966 @@
+#include "nudock_wire.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+/// @brief Maximum number of events handled per epoll_wait() call
+constexpr int EPOLL_MAX_EVENTS = 64;
+
+/// @brief Bytes read from a connection per recv() call
+constexpr size_t READ_CHUNK_SIZE = 64 * 1024;
+
+/// @brief Room for the one file descriptor a frame can carry
+union FdControl {
+  char buffer[CMSG_SPACE(sizeof(int))];
+  cmsghdr align;
+};
+
+void attach_fd(msghdr& _msg, FdControl& _control, int _fd)
+{
+  _msg.msg_control = _control.buffer;
+  _msg.msg_controllen = sizeof(_control.buffer);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&_msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg), &_fd, sizeof(int));
+}
+
+/// @brief Collects the file descriptor received with a message, closing any unexpected extra ones
+void collect_fds(msghdr& _msg, int& _attached_fd)
+{
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&_msg); cmsg; cmsg = CMSG_NXTHDR(&_msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; ++i) {
+      int fd;
+      std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      if (_attached_fd < 0) {
+        _attached_fd = fd;
+      }
+      else {
+        close(fd);
+      }
+    }
+  }
+}
+
+/// @brief Reads the frame header, along with the file descriptor sent with it, if any
+bool read_header(int _fd, FrameHeader& _header, int& _attached_fd)
+{
+  char* dst = reinterpret_cast<char*>(&_header);
+  size_t size = sizeof(FrameHeader);
+  while (size > 0) {
+    iovec iov;
+    iov.iov_base = dst;
+    iov.iov_len = size;
+    FdControl control;
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    ssize_t n = recvmsg(_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    collect_fds(msg, _attached_fd);
+    dst += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool read_all(int _fd, char* _dst, uint64_t _size)
+{
+  while (_size > 0) {
+    ssize_t n = recv(_fd, _dst, _size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    _dst += n;
+    _size -= n;
+  }
+  return true;
+}
+
+int make_unix_socket(const std::string& _path, sockaddr_un& _addr)
+{
+  if (_path.size() >= sizeof(_addr.sun_path)) {
+    throw std::runtime_error("Unix domain socket path too long: " + _path);
+  }
+  std::memset(&_addr, 0, sizeof(_addr));
+  _addr.sun_family = AF_UNIX;
+  std::strncpy(_addr.sun_path, _path.c_str(), sizeof(_addr.sun_path) - 1);
+  return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+}
+
+addrinfo* resolve(const std::string& _host, int _port, bool _passive)
+{
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = _passive ? AI_PASSIVE : 0;
+  addrinfo* result = nullptr;
+  int rc = getaddrinfo(_host.empty() ? nullptr : _host.c_str(), std::to_string(_port).c_str(), &hints, &result);
+  if (rc != 0) {
+    throw std::runtime_error("Could not resolve " + _host + ":" + std::to_string(_port) + ": " + gai_strerror(rc));
+  }
+  return result;
+}
+
+} // namespace
+
+bool write_frame(int _fd, const FrameHeader& _header, const char* _payload, int _attached_fd)
+{
+  iovec iov[2];
+  iov[0].iov_base = const_cast<FrameHeader*>(&_header);
+  iov[0].iov_len = sizeof(FrameHeader);
+  iov[1].iov_base = const_cast<char*>(_payload);
+  iov[1].iov_len = _header.payload_size;
+
+  msghdr msg{};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  FdControl control;
+  if (_attached_fd >= 0) {
+    attach_fd(msg, control, _attached_fd);
+  }
+  while (msg.msg_iovlen > 0) {
+    ssize_t n = sendmsg(_fd, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    // The file descriptor went out with the first byte
+    msg.msg_control = nullptr;
+    msg.msg_controllen = 0;
+    // Skip over whatever was written already
+    while (msg.msg_iovlen > 0 && static_cast<size_t>(n) >= msg.msg_iov->iov_len) {
+      n -= msg.msg_iov->iov_len;
+      ++msg.msg_iov;
+      --msg.msg_iovlen;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+bool read_frame(int _fd, FrameHeader& _header, std::string& _payload, int* _attached_fd,
+                uint64_t _max_payload_size)
+{
+  int attached_fd = -1;
+  bool ok = read_header(_fd, _header, attached_fd);
+  if (ok && (_header.magic != FRAME_MAGIC || _header.version != FRAME_VERSION)) {
+    std::cerr << "Received a malformed NuDock frame, closing the connection" << std::endl;
+    ok = false;
+  }
+  if (ok && _header.payload_size > _max_payload_size) {
+    std::cerr << "Received a NuDock frame of " << _header.payload_size << " bytes, more than the "
+              << _max_payload_size << " allowed, closing the connection" << std::endl;
+    ok = false;
+  }
+  if (ok) {
+    _payload.resize(_header.payload_size);
+    ok = read_all(_fd, &_payload[0], _header.payload_size);
+  }
+
+  if (ok && _attached_fd) {
+    *_attached_fd = attached_fd;
+  }
+  else if (attached_fd >= 0) {
+    close(attached_fd);
+  }
+  return ok;
+}
+
+FramedConnection::~FramedConnection()
+{
+  for (const auto& output_fd : output_fds) {
+    close(output_fd.second);
+  }
+  close(fd);
+}
+
+FramedServer::FramedServer(Dispatcher _dispatcher, SocketOptionsFunction _socket_options,
+                           unsigned _max_concurrent_requests)
+    : m_dispatcher(std::move(_dispatcher)),
+      m_socket_options(std::move(_socket_options)),
+      m_max_concurrent_requests(std::max(1u, _max_concurrent_requests)),
+      m_compression_threshold(DEFAULT_COMPRESSION_THRESHOLD),
+      m_max_payload_size(MAX_FRAME_PAYLOAD),
+      m_running(true),
+      m_epoll_fd(-1),
+      m_wakeup_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      m_workers_done(false)
+{
+}
+
+FramedServer::~FramedServer()
+{
+  stop();
+  close(m_wakeup_fd);
+}
+
+bool FramedServer::listen_unix(const std::string& _path)
+{
+  sockaddr_un addr;
+  int fd = make_unix_socket(_path, addr);
+  if (fd < 0) {
+    std::cerr << "Could not create socket: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  // Clean up the old socket file, if any
+  unlink(_path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    std::cerr << "Could not listen on " << _path << ": " << std::strerror(errno) << std::endl;
+    close(fd);
+    return false;
+  }
+  bool served = serve(fd);
+  unlink(_path.c_str());
+  return served;
+}
+
+bool FramedServer::listen_tcp(const std::string& _address, int _port)
+{
+  addrinfo* result = resolve(_address, _port, true);
+  int fd = -1;
+  for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (m_socket_options) {
+      m_socket_options(fd);
+    }
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+
+  if (fd < 0) {
+    std::cerr << "Could not listen on " << _address << ":" << _port << ": " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  return serve(fd);
+}
+
+bool FramedServer::serve(int _listen_fd)
+{
+  m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epoll_fd < 0) {
+    std::cerr << "Could not create the event loop: " << std::strerror(errno) << std::endl;
+    close(_listen_fd);
+    return false;
+  }
+  fcntl(_listen_fd, F_SETFL, fcntl(_listen_fd, F_GETFL) | O_NONBLOCK);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = _listen_fd;
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &event);
+  event.data.fd = m_wakeup_fd;
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &event);
+
+  m_workers_done = false;
+  for (unsigned i = 0; i < m_max_concurrent_requests; ++i) {
+    m_workers.emplace_back(&FramedServer::work, this);
+  }
+
+  epoll_event events[EPOLL_MAX_EVENTS];
+  while (m_running) {
+    int n = epoll_wait(m_epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+    for (int i = 0; i < n && m_running; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == _listen_fd) {
+        accept_connections(_listen_fd);
+        continue;
+      }
+      if (fd == m_wakeup_fd) {
+        uint64_t value;
+        while (read(m_wakeup_fd, &value, sizeof(value)) > 0) {}
+        continue;
+      }
+
+      auto connection_it = m_connections.find(fd);
+      if (connection_it == m_connections.end()) {
+        continue;
+      }
+      std::shared_ptr<FramedConnection> connection = connection_it->second;
+      bool ok = !(events[i].events & EPOLLERR);
+      if (ok && (events[i].events & EPOLLOUT)) {
+        ok = flush_connection(*connection);
+      }
+      if (ok && (events[i].events & (EPOLLIN | EPOLLHUP))) {
+        ok = read_connection(connection);
+      }
+      if (!ok) {
+        close_connection(fd);
+      }
+    }
+  }
+
+  // Close all the connections, and the listening socket
+  while (!m_connections.empty()) {
+    close_connection(m_connections.begin()->first);
+  }
+  close(_listen_fd);
+
+  // Let the workers drain the queue and wait for them
+  {
+    std::lock_guard<std::mutex> lock(m_tasks_mutex);
+    m_workers_done = true;
+  }
+  m_tasks_cv.notify_all();
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+  m_workers.clear();
+
+  close(m_epoll_fd);
+  m_epoll_fd = -1;
+  return true;
+}
+
+void FramedServer::accept_connections(int _listen_fd)
+{
+  while (true) {
+    int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) {
+      return;
+    }
+    if (m_socket_options) {
+      m_socket_options(fd);
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      close(fd);
+      continue;
+    }
+    m_connections[fd] = std::make_shared<FramedConnection>(fd);
+  }
+}
+
+bool FramedServer::read_connection(const std::shared_ptr<FramedConnection>& _connection)
+{
+  // Take in everything the socket has for us
+  std::string& input = _connection->input;
+  while (true) {
+    size_t size = input.size();
+    input.resize(size + READ_CHUNK_SIZE);
+    ssize_t n = recv(_connection->fd, &input[size], READ_CHUNK_SIZE, 0);
+    input.resize(size + std::max<ssize_t>(n, 0));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    if (static_cast<size_t>(n) < READ_CHUNK_SIZE) {
+      break;
+    }
+  }
+
+  // Process all the complete frames
+  size_t offset = 0;
+  while (m_running && input.size() - offset >= sizeof(FrameHeader)) {
+    FrameHeader header;
+    std::memcpy(&header, input.data() + offset, sizeof(FrameHeader));
+    if (header.magic != FRAME_MAGIC || header.version != FRAME_VERSION) {
+      std::cerr << "Received a malformed NuDock frame, closing the connection" << std::endl;
+      return false;
+    }
+    if (header.payload_size > m_max_payload_size) {
+      std::cerr << "Received a NuDock frame of " << header.payload_size << " bytes, more than the "
+                << m_max_payload_size << " allowed, closing the connection" << std::endl;
+      return false;
+    }
+    if (input.size() - offset - sizeof(FrameHeader) < header.payload_size) {
+      // Wait for the rest of the payload. The buffer only grows as its bytes
+      // arrive, so an idle connection that sent a bare header stays cheap
+      break;
+    }
+    std::string body = input.substr(offset + sizeof(FrameHeader), header.payload_size);
+    offset += sizeof(FrameHeader) + header.payload_size;
+
+    // Hand the request over to the workers, keeping the connection alive until it's answered
+    {
+      std::lock_guard<std::mutex> lock(m_tasks_mutex);
+      m_tasks.emplace_back([this, _connection, header, body = std::move(body)]() mutable {
+        respond(*_connection, header, body);
+      });
+    }
+    m_tasks_cv.notify_one();
+  }
+  input.erase(0, offset);
+  return true;
+}
+
+bool FramedServer::flush_connection(FramedConnection& _connection)
+{
+  std::lock_guard<std::mutex> lock(_connection.write_mutex);
+  while (_connection.output_offset < _connection.output.size()) {
+    ssize_t n = send_output(_connection);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (n < 0) {
+      return false;
+    }
+    _connection.output_offset += n;
+  }
+
+  // All written, stop waiting for the socket to become writable
+  _connection.output.clear();
+  _connection.output_offset = 0;
+  _connection.want_write = false;
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = _connection.fd;
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, _connection.fd, &event);
+  return true;
+}
+
+ssize_t FramedServer::send_output(FramedConnection& _connection)
+{
+  // Attach the next file descriptor if the output got to its frame, and
+  // don't let the frames after it go out before it
+  size_t end = _connection.output.size();
+  int attached_fd = -1;
+  if (!_connection.output_fds.empty()) {
+    if (_connection.output_fds.front().first == _connection.output_offset) {
+      attached_fd = _connection.output_fds.front().second;
+      if (_connection.output_fds.size() > 1) {
+        end = _connection.output_fds[1].first;
+      }
+    }
+    else {
+      end = _connection.output_fds.front().first;
+    }
+  }
+
+  iovec iov;
+  iov.iov_base = &_connection.output[_connection.output_offset];
+  iov.iov_len = end - _connection.output_offset;
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  FdControl control;
+  if (attached_fd >= 0) {
+    attach_fd(msg, control, attached_fd);
+  }
+  ssize_t n = sendmsg(_connection.fd, &msg, MSG_NOSIGNAL);
+  if (n > 0 && attached_fd >= 0) {
+    // The client has its own copy now
+    close(attached_fd);
+    _connection.output_fds.pop_front();
+  }
+  return n;
+}
+
+void FramedServer::close_connection(int _fd)
+{
+  auto connection_it = m_connections.find(_fd);
+  if (connection_it == m_connections.end()) {
+    return;
+  }
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, _fd, nullptr);
+  {
+    std::lock_guard<std::mutex> lock(connection_it->second->write_mutex);
+    connection_it->second->closed = true;
+  }
+  // The socket itself is closed once the last request in flight lets go of it
+  shutdown(_fd, SHUT_RDWR);
+  m_connections.erase(connection_it);
+}
+
+void FramedServer::respond(FramedConnection& _connection, FrameHeader _header, std::string& _body)
+{
+  // Written out or queued before returning, so each worker thread can reuse its buffers
+  thread_local std::string request_body;
+  thread_local std::string response_body;
+  thread_local std::string compressed_body;
+  int attached_fd = -1;
+  const auto compression = static_cast<Compression>((_header.flags >> FRAME_COMPRESSION_SHIFT) & FRAME_COMPRESSION_MASK);
+  const auto accepted_compression = static_cast<Compression>((_header.flags >> FRAME_ACCEPT_COMPRESSION_SHIFT) & FRAME_COMPRESSION_MASK);
+  bool decompressed = true;
+  if (compression != Compression::NONE) {
+    try {
+      decompress_payload(_body, compression, request_body, m_max_payload_size);
+    }
+    catch (const std::exception& e) {
+      _header.status = 400;
+      response_body = std::string("Could not decompress the request: ") + e.what();
+      decompressed = false;
+    }
+  }
+  if (decompressed) {
+    _header.status = m_dispatcher(_header.endpoint, _header.encoding,
+                                  compression != Compression::NONE ? request_body : _body, response_body, attached_fd);
+  }
+  _header.flags = attached_fd >= 0 ? FRAME_FLAG_MEMFD : 0;
+
+  // Large responses go out compressed if the client takes it
+  const std::string* payload = &response_body;
+  if (accepted_compression != Compression::NONE && response_body.size() >= m_compression_threshold &&
+      compression_available(accepted_compression)) {
+    try {
+      compress_payload(response_body, accepted_compression, compressed_body);
+      // Payloads that don't compress (e.g. binary noise) go out as they are
+      if (compressed_body.size() < response_body.size()) {
+        payload = &compressed_body;
+        _header.flags |= static_cast<uint16_t>(accepted_compression) << FRAME_COMPRESSION_SHIFT;
+      }
+    }
+    catch (const std::exception& e) {
+      std::cerr << "Sending the response uncompressed: " << e.what() << std::endl;
+    }
+  }
+  _header.payload_size = payload->size();
+
+  std::lock_guard<std::mutex> lock(_connection.write_mutex);
+  if (_connection.closed) {
+    if (attached_fd >= 0) {
+      close(attached_fd);
+    }
+    return;
+  }
+
+  // Write straight away if nothing is queued, otherwise keep the order of the responses
+  const char* header_data = reinterpret_cast<const char*>(&_header);
+  size_t written = 0;
+  if (!_connection.want_write) {
+    iovec iov[2];
+    iov[0].iov_base = const_cast<char*>(header_data);
+    iov[0].iov_len = sizeof(FrameHeader);
+    iov[1].iov_base = const_cast<char*>(payload->data());
+    iov[1].iov_len = payload->size();
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    FdControl control;
+    if (attached_fd >= 0) {
+      attach_fd(msg, control, attached_fd);
+    }
+    ssize_t n;
+    do {
+      n = sendmsg(_connection.fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      // The event loop notices the broken connection by itself
+      if (attached_fd >= 0) {
+        close(attached_fd);
+      }
+      return;
+    }
+    written = std::max<ssize_t>(n, 0);
+    if (written > 0 && attached_fd >= 0) {
+      close(attached_fd);
+      attached_fd = -1;
+    }
+    if (written == sizeof(FrameHeader) + payload->size()) {
+      return;
+    }
+  }
+
+  // Queue whatever the socket did not take and let the event loop write it out
+  if (attached_fd >= 0) {
+    _connection.output_fds.emplace_back(_connection.output.size(), attached_fd);
+  }
+  if (written < sizeof(FrameHeader)) {
+    _connection.output.append(header_data + written, sizeof(FrameHeader) - written);
+    _connection.output.append(*payload);
+  }
+  else {
+    _connection.output.append(*payload, written - sizeof(FrameHeader), std::string::npos);
+  }
+  if (!_connection.want_write) {
+    _connection.want_write = true;
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.fd = _connection.fd;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, _connection.fd, &event);
+  }
+}
+
+void FramedServer::work()
+{
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_tasks_mutex);
+      m_tasks_cv.wait(lock, [this]() { return m_workers_done || !m_tasks.empty(); });
+      if (m_tasks.empty()) {
+        return;
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void FramedServer::stop()
+{
+  m_running = false;
+  uint64_t value = 1;
+  if (write(m_wakeup_fd, &value, sizeof(value)) < 0) {
+    // Already woken up
+  }
+}
+
+void FramedServer::set_compression_threshold(size_t _threshold)
+{
+  m_compression_threshold = _threshold;
+}
+
+void FramedServer::set_max_payload_size(uint64_t _max_payload_size)
+{
+  m_max_payload_size = _max_payload_size;
+}
+
+FramedClient::FramedClient(int _fd)
+    : m_fd(_fd), m_next_request_id(1), m_encoding(0), m_compression(Compression::NONE),
+      m_compression_threshold(DEFAULT_COMPRESSION_THRESHOLD), m_max_payload_size(MAX_FRAME_PAYLOAD),
+      m_reading(false), m_broken(false),
+      m_pending_callbacks(0), m_closing(false)
+{
+}
+
+FramedClient::~FramedClient()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closing = true;
+  }
+  // Wakes up the I/O thread if it's blocked reading
+  shutdown(m_fd, SHUT_RDWR);
+  m_cv.notify_all();
+  if (m_io_thread.joinable()) {
+    m_io_thread.join();
+  }
+  for (const auto& pending : m_pending) {
+    if (pending.second.attached_fd >= 0) {
+      close(pending.second.attached_fd);
+    }
+  }
+  close(m_fd);
+}
+
+std::unique_ptr<FramedClient> FramedClient::connect_unix(const std::string& _path)
+{
+  sockaddr_un addr;
+  int fd = make_unix_socket(_path, addr);
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    std::string error = std::strerror(errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw std::runtime_error("Could not connect to " + _path + ": " + error);
+  }
+  return std::unique_ptr<FramedClient>(new FramedClient(fd));
+}
+
+std::unique_ptr<FramedClient> FramedClient::connect_tcp(const std::string& _host, int _port,
+                                                        SocketOptionsFunction _socket_options)
+{
+  addrinfo* result = resolve(_host, _port, false);
+  int fd = -1;
+  std::string error = "no address";
+  for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (_socket_options) {
+      _socket_options(fd);
+    }
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    error = std::strerror(errno);
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+
+  if (fd < 0) {
+    throw std::runtime_error("Could not connect to " + _host + ":" + std::to_string(_port) + ": " + error);
+  }
+  return std::unique_ptr<FramedClient>(new FramedClient(fd));
+}
+
+void FramedClient::set_encoding(uint8_t _encoding)
+{
+  m_encoding = _encoding;
+}
+
+void FramedClient::set_compression(Compression _compression, size_t _threshold)
+{
+  m_compression_threshold = _threshold;
+  m_compression = _compression;
+}
+
+void FramedClient::set_max_payload_size(uint64_t _max_payload_size)
+{
+  m_max_payload_size = _max_payload_size;
+}
+
+int FramedClient::call(uint32_t _endpoint, const std::string& _body, std::string& _response_body,
+                       int* _attached_fd)
+{
+  return wait(submit(_endpoint, _body), _response_body, _attached_fd);
+}
+
+uint64_t FramedClient::submit(uint32_t _endpoint, const std::string& _body)
+{
+  FrameHeader header;
+  header.encoding = m_encoding;
+  header.endpoint = _endpoint;
+  header.request_id = m_next_request_id++;
+  header.payload_size = _body.size();
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending[header.request_id];
+  }
+  write_request(header, _body);
+  return header.request_id;
+}
+
+void FramedClient::submit(uint32_t _endpoint, const std::string& _body, ResponseCallback _callback)
+{
+  FrameHeader header;
+  header.encoding = m_encoding;
+  header.endpoint = _endpoint;
+  header.request_id = m_next_request_id++;
+  header.payload_size = _body.size();
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending[header.request_id].callback = std::move(_callback);
+    m_pending_callbacks++;
+    if (!m_io_thread.joinable()) {
+      m_io_thread = std::thread(&FramedClient::pump, this);
+    }
+  }
+  m_cv.notify_all();
+  write_request(header, _body);
+}
+
+void FramedClient::write_request(FrameHeader _header, const std::string& _body)
+{
+  // Compressed before taking the write lock, so several threads can compress at once
+  thread_local std::string compressed_body;
+  const std::string* payload = &_body;
+  const Compression compression = m_compression;
+  if (compression != Compression::NONE) {
+    _header.flags |= static_cast<uint16_t>(compression) << FRAME_ACCEPT_COMPRESSION_SHIFT;
+    if (_body.size() >= m_compression_threshold) {
+      try {
+        compress_payload(_body, compression, compressed_body);
+        if (compressed_body.size() < _body.size()) {
+          payload = &compressed_body;
+          _header.flags |= static_cast<uint16_t>(compression) << FRAME_COMPRESSION_SHIFT;
+        }
+      }
+      catch (const std::exception& e) {
+        std::cerr << "Sending the request uncompressed: " << e.what() << std::endl;
+      }
+    }
+  }
+  _header.payload_size = payload->size();
+
+  bool written;
+  {
+    std::lock_guard<std::mutex> lock(m_write_mutex);
+    written = write_frame(m_fd, _header, payload->data());
+  }
+  if (written) {
+    return;
+  }
+
+  std::string error = std::string("Could not send the request: ") + std::strerror(errno);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto pending_it = m_pending.find(_header.request_id);
+  if (pending_it == m_pending.end()) {
+    return;
+  }
+  if (pending_it->second.callback) {
+    ResponseCallback callback = std::move(pending_it->second.callback);
+    m_pending.erase(pending_it);
+    m_pending_callbacks--;
+    lock.unlock();
+    callback(0, error, -1);
+    return;
+  }
+  pending_it->second.done = true;
+  pending_it->second.body = std::move(error);
+}
+
+void FramedClient::read_response(std::unique_lock<std::mutex>& _lock)
+{
+  m_reading = true;
+  _lock.unlock();
+  FrameHeader header;
+  std::string body;
+  int attached_fd = -1;
+  bool ok = read_frame(m_fd, header, body, &attached_fd, m_max_payload_size);
+  const auto compression = static_cast<Compression>((header.flags >> FRAME_COMPRESSION_SHIFT) & FRAME_COMPRESSION_MASK);
+  if (ok && compression != Compression::NONE) {
+    try {
+      std::string payload;
+      decompress_payload(body, compression, payload, m_max_payload_size);
+      body = std::move(payload);
+    }
+    catch (const std::exception& e) {
+      header.status = 0;
+      body = std::string("Could not decompress the response: ") + e.what();
+    }
+  }
+  _lock.lock();
+  m_reading = false;
+
+  if (!ok) {
+    // Nothing else will arrive: fail all the asynchronous requests, the
+    // synchronous ones notice m_broken themselves
+    m_broken = true;
+    std::vector<ResponseCallback> callbacks;
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+      if (it->second.callback) {
+        callbacks.push_back(std::move(it->second.callback));
+        it = m_pending.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+    m_pending_callbacks = 0;
+    m_cv.notify_all();
+    if (m_closing) {
+      // The client is going away, nobody is interested in the responses anymore
+      return;
+    }
+    _lock.unlock();
+    for (auto& callback : callbacks) {
+      std::string error = "Connection closed by the server";
+      callback(0, error, -1);
+    }
+    _lock.lock();
+    return;
+  }
+
+  auto owner_it = m_pending.find(header.request_id);
+  if (owner_it != m_pending.end() && owner_it->second.callback) {
+    ResponseCallback callback = std::move(owner_it->second.callback);
+    m_pending.erase(owner_it);
+    m_pending_callbacks--;
+    // Let somebody else take over reading while the callback runs
+    m_cv.notify_all();
+    _lock.unlock();
+    callback(static_cast<int>(header.status), body, attached_fd);
+    _lock.lock();
+    return;
+  }
+  if (owner_it != m_pending.end()) {
+    owner_it->second.done = true;
+    owner_it->second.status = static_cast<int>(header.status);
+    owner_it->second.body = std::move(body);
+    owner_it->second.attached_fd = attached_fd;
+  }
+  else if (attached_fd >= 0) {
+    close(attached_fd);
+  }
+  m_cv.notify_all();
+}
+
+void FramedClient::pump()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_closing && !m_broken) {
+    if (m_reading || m_pending_callbacks == 0) {
+      m_cv.wait(lock);
+      continue;
+    }
+    read_response(lock);
+  }
+}
+
+int FramedClient::wait(uint64_t _request_id, std::string& _response_body, int* _attached_fd)
+{
+  if (_attached_fd) {
+    *_attached_fd = -1;
+  }
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    auto pending_it = m_pending.find(_request_id);
+    if (pending_it == m_pending.end()) {
+      _response_body = "Unknown request id " + std::to_string(_request_id);
+      return 0;
+    }
+    if (pending_it->second.done) {
+      int status = pending_it->second.status;
+      _response_body = std::move(pending_it->second.body);
+      if (_attached_fd) {
+        *_attached_fd = pending_it->second.attached_fd;
+      }
+      else if (pending_it->second.attached_fd >= 0) {
+        close(pending_it->second.attached_fd);
+      }
+      m_pending.erase(pending_it);
+      return status;
+    }
+    if (m_broken) {
+      m_pending.erase(pending_it);
+      _response_body = "Connection closed by the server";
+      return 0;
+    }
+    if (m_reading) {
+      // Somebody else is reading, they will hand over our response
+      m_cv.wait(lock);
+      continue;
+    }
+
+    // Become the reader until one response has arrived
+    read_response(lock);
+  }
+}
@@ -0,0 +1,391 @@
+/**
+ * @file nudock_wire.hpp
+ *
+ * @brief NuDock-native length-prefixed framing over unix domain sockets and TCP.
+ *
+ * Every message is a fixed 32-byte FrameHeader followed by the payload. The
+ * header carries an integer endpoint id instead of a request path, so the
+ * server does no HTTP header generation, parsing or path routing. Endpoint
+ * ids are handed out by the server in the /validate_start response, which
+ * itself always uses the reserved endpoint id 0.
+ *
+ * A connection can carry many outstanding requests at once: each frame is
+ * tagged with a request id, and the server may answer them in any order.
+ *
+ * The server runs a single epoll event loop over all its connections, so
+ * idle connections cost no threads. Requests are processed by a separate
+ * pool of compute workers, so the event loop only does I/O and a slow
+ * handler never holds up the other connections.
+ *
+ * Once a compression is agreed on, the client compresses its large request
+ * payloads and the server its large responses, see nudock_compression.hpp.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "nudock_compression.hpp"
+
+/// @brief Protocol spoken over unix domain sockets and TCP
+enum class WireProtocol {
+  /// HTTP/1.1 through httplib, works with curl and other HTTP tools
+  HTTP,
+  /// NuDock binary frames, see FrameHeader
+  NUDOCK,
+};
+
+constexpr uint32_t FRAME_MAGIC = 0x4b43444e; // "NDCK"
+constexpr uint8_t FRAME_VERSION = 1;
+
+/// @brief Largest payload a frame may announce by default, larger ones are rejected before anything is allocated
+constexpr uint64_t MAX_FRAME_PAYLOAD = 256ull * 1024 * 1024;
+
+/// @brief Endpoint id reserved for the /validate_start handshake
+constexpr uint32_t VALIDATE_START_ENDPOINT = 0;
+
+/// @brief Frame flag: a file descriptor (a sealed memfd, see nudock_memfd.hpp) comes along with the frame
+constexpr uint16_t FRAME_FLAG_MEMFD = 1 << 0;
+
+/// @brief Frame flags bits 1-2: Compression of the payload, 0 if it isn't compressed
+constexpr uint16_t FRAME_COMPRESSION_SHIFT = 1;
+/// @brief Request frame flags bits 3-4: Compression the client takes for the response payload
+constexpr uint16_t FRAME_ACCEPT_COMPRESSION_SHIFT = 3;
+constexpr uint16_t FRAME_COMPRESSION_MASK = 0x3;
+
+/// @brief Fixed-size header in front of every request and response payload
+struct FrameHeader {
+  uint32_t magic = FRAME_MAGIC;
+  uint8_t version = FRAME_VERSION;
+  /// @brief MessageEncoding of the payload (see nudock_encoding.hpp), 0 for json. Responses use the one of their request.
+  uint8_t encoding = 0;
+  /// @brief FRAME_FLAG_* bits
+  uint16_t flags = 0;
+  /// @brief Endpoint id as given by the server in /validate_start
+  uint32_t endpoint = 0;
+  /// @brief Status code of a response, following the HTTP ones. Zero for requests.
+  uint32_t status = 0;
+  /// @brief Client-chosen id, echoed back in the response
+  uint64_t request_id = 0;
+  uint64_t payload_size = 0;
+};
+static_assert(sizeof(FrameHeader) == 32, "FrameHeader must stay 32 bytes on the wire");
+
+/// @brief Called on each freshly created socket, e.g. to apply TcpOptions
+using SocketOptionsFunction = std::function<void(int)>;
+
+/// @brief Server side of one accepted connection, shared with the requests still being processed
+struct FramedConnection {
+  explicit FramedConnection(int _fd) : fd(_fd) {}
+  ~FramedConnection();
+  int fd;
+  /// @brief Bytes received but not yet processed, only touched by the event loop
+  std::string input;
+  /// @brief Responses may be written from several worker threads
+  std::mutex write_mutex;
+  /// @brief Bytes of responses the socket could not take yet, guarded by write_mutex
+  std::string output;
+  size_t output_offset = 0;
+  /// @brief File descriptors to attach to the output, by position in it, guarded by write_mutex
+  std::deque<std::pair<size_t, int>> output_fds;
+  /// @brief Whether the event loop is waiting for the socket to become writable
+  bool want_write = false;
+  bool closed = false;
+};
+
+class FramedServer
+{
+  public:
+    /**
+     * @brief Processes one request payload for an endpoint id, returns the status code
+     *
+     * _encoding is the one given in the request's FrameHeader, and is used for
+     * the response as well. The dispatcher may set _attached_fd to a file
+     * descriptor to pass along with the response, which then belongs to the
+     * server. Only possible on unix domain sockets. The body is the server's
+     * own buffer, which the dispatcher may take over, e.g. by swapping it.
+     */
+    using Dispatcher = std::function<int(uint32_t _endpoint, uint8_t _encoding, std::string& _body,
+                                         std::string& _response_body, int& _attached_fd)>;
+
+    /**
+     * @brief FramedServer constructor
+     *
+     * @param _dispatcher Function processing the requests
+     * @param _socket_options Optional function applied to the listening and accepted TCP sockets
+     * @param _max_concurrent_requests Number of worker threads processing the requests. With 1, requests
+     *        are processed one after the other, in the order they arrived. With more, they are completed
+     *        out of order, so the dispatcher must be thread-safe.
+     */
+    FramedServer(Dispatcher _dispatcher, SocketOptionsFunction _socket_options = nullptr,
+                 unsigned _max_concurrent_requests = 1);
+    ~FramedServer();
+
+    /**
+     * @brief Listens on a unix domain socket. Blocking until stop() is called.
+     *
+     * @param _path Path of the socket file, any old file is removed first
+     * @return false if the socket could not be set up
+     */
+    bool listen_unix(const std::string& _path);
+
+    /**
+     * @brief Listens on a TCP address and port. Blocking until stop() is called.
+     *
+     * @param _address Address to bind to, e.g. "0.0.0.0"
+     * @param _port Port number to bind to
+     * @return false if the socket could not be set up
+     */
+    bool listen_tcp(const std::string& _address, int _port);
+
+    /**
+     * @brief Stops listening and closes all the connections. Can be called from any thread.
+     *
+     * A server stopped before it started listening returns straight away from listen_unix() / listen_tcp().
+     */
+    void stop();
+
+    /**
+     * @brief Sets the size from which responses are compressed, for the clients that take a compression.
+     *
+     * Must be called before listening.
+     *
+     * @param _threshold Size of the payload in bytes
+     */
+    void set_compression_threshold(size_t _threshold);
+
+    /**
+     * @brief Sets the largest request payload a frame may announce, like httplib's set_payload_max_length().
+     *
+     * Connections sending a larger frame are closed before anything is
+     * allocated for it. Must be called before listening.
+     *
+     * @param _max_payload_size Size of the payload in bytes, MAX_FRAME_PAYLOAD by default
+     */
+    void set_max_payload_size(uint64_t _max_payload_size);
+
+  private:
+    /// @brief Runs the event loop over the bound socket and all the connections until stopped
+    bool serve(int _listen_fd);
+
+    /// @brief Accepts all the pending connections
+    void accept_connections(int _listen_fd);
+
+    /// @brief Reads whatever arrived on a connection and processes the complete requests
+    bool read_connection(const std::shared_ptr<FramedConnection>& _connection);
+
+    /// @brief Writes out responses the socket could not take earlier
+    bool flush_connection(FramedConnection& _connection);
+
+    /// @brief Removes a connection from the event loop
+    void close_connection(int _fd);
+
+    /// @brief Processes one request and writes back its response
+    void respond(FramedConnection& _connection, FrameHeader _header, std::string& _body);
+
+    /// @brief Sends queued output up to the next attached file descriptor. Called with write_mutex locked.
+    ssize_t send_output(FramedConnection& _connection);
+
+    /// @brief Worker thread loop, processing queued requests
+    void work();
+
+    Dispatcher m_dispatcher;
+    SocketOptionsFunction m_socket_options;
+    unsigned m_max_concurrent_requests;
+    size_t m_compression_threshold;
+    uint64_t m_max_payload_size;
+    std::atomic<bool> m_running;
+
+    /// @brief epoll instance and the eventfd used to wake it up from stop()
+    int m_epoll_fd;
+    int m_wakeup_fd;
+
+    /// @brief Open connections by socket, only touched by the event loop
+    std::unordered_map<int, std::shared_ptr<FramedConnection>> m_connections;
+
+    /// @brief Queue of requests waiting for a worker
+    std::mutex m_tasks_mutex;
+    std::condition_variable m_tasks_cv;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_workers_done;
+    std::vector<std::thread> m_workers;
+};
+
+class FramedClient
+{
+  public:
+    /**
+     * @brief Connects to a server listening on a unix domain socket.
+     *
+     * @param _path Path of the socket file
+     */
+    static std::unique_ptr<FramedClient> connect_unix(const std::string& _path);
+
+    /**
+     * @brief Connects to a server listening on TCP.
+     *
+     * @param _host Address or hostname of the server
+     * @param _port Port number of the server
+     * @param _socket_options Optional function applied to the socket before connecting
+     */
+    static std::unique_ptr<FramedClient> connect_tcp(const std::string& _host, int _port,
+                                                     SocketOptionsFunction _socket_options = nullptr);
+
+    ~FramedClient();
+
+    /**
+     * @brief Sets the encoding given in the FrameHeader of the requests sent from now on.
+     *
+     * @param _encoding MessageEncoding of the request payloads, see nudock_encoding.hpp
+     */
+    void set_encoding(uint8_t _encoding);
+
+    /**
+     * @brief Sets the compression of the requests sent from now on, and of their responses.
+     *
+     * @param _compression Compression agreed on with the server, Compression::NONE to turn it off
+     * @param _threshold Size from which request payloads are compressed, in bytes
+     */
+    void set_compression(Compression _compression, size_t _threshold);
+
+    /**
+     * @brief Sets the largest response payload a frame may announce, the connection fails on larger ones.
+     *
+     * @param _max_payload_size Size of the payload in bytes, MAX_FRAME_PAYLOAD by default
+     */
+    void set_max_payload_size(uint64_t _max_payload_size);
+
+    /**
+     * @brief Sends one request and waits for its response.
+     *
+     * Thread-safe, several threads can have requests in flight on the same connection.
+     *
+     * @param _endpoint Endpoint id
+     * @param _body Serialised request message
+     * @param _response_body Filled with the serialised response, or the error message
+     * @param _attached_fd If given, filled with the file descriptor passed along with the response, or -1.
+     *        Otherwise any such file descriptor is closed.
+     * @return Status code of the response, 0 if the connection failed
+     */
+    int call(uint32_t _endpoint, const std::string& _body, std::string& _response_body,
+             int* _attached_fd = nullptr);
+
+    /**
+     * @brief Sends one request without waiting for its response.
+     *
+     * @param _endpoint Endpoint id
+     * @param _body Serialised request message
+     * @return Request id to pass to wait()
+     */
+    uint64_t submit(uint32_t _endpoint, const std::string& _body);
+
+    /**
+     * @brief Called with the status code and the response (or error message) of an asynchronous request
+     *
+     * _attached_fd is the file descriptor passed along with the response, or
+     * -1. The callback takes over closing it.
+     */
+    using ResponseCallback = std::function<void(int _status, std::string& _response_body, int _attached_fd)>;
+
+    /**
+     * @brief Sends one request and calls a function once its response arrives.
+     *
+     * The callback runs on whichever thread reads the response off the
+     * connection: the client's I/O thread, started on the first asynchronous
+     * request, or a thread waiting for its own response in wait().
+     *
+     * @param _endpoint Endpoint id
+     * @param _body Serialised request message
+     * @param _callback Function receiving the response
+     */
+    void submit(uint32_t _endpoint, const std::string& _body, ResponseCallback _callback);
+
+    /**
+     * @brief Waits for the response to a submitted request.
+     *
+     * Whichever waiting thread gets there first reads the responses off the
+     * connection and hands them over to their owners, so there is no extra
+     * reader thread in the way.
+     *
+     * @param _request_id Request id returned by submit()
+     * @param _response_body Filled with the serialised response, or the error message
+     * @param _attached_fd If given, filled with the file descriptor passed along with the response, or -1.
+     *        Otherwise any such file descriptor is closed.
+     * @return Status code of the response, 0 if the connection failed
+     */
+    int wait(uint64_t _request_id, std::string& _response_body, int* _attached_fd = nullptr);
+
+  private:
+    explicit FramedClient(int _fd);
+
+    /// @brief Writes the request frame, compressed if large enough, recording a failure in the pending response
+    void write_request(FrameHeader _header, const std::string& _body);
+
+    /// @brief Reads one response off the connection and hands it over. Called with m_mutex locked.
+    void read_response(std::unique_lock<std::mutex>& _lock);
+
+    /// @brief I/O thread loop, reading responses while asynchronous requests are pending
+    void pump();
+
+    /// @brief Response (or failure) of a submitted request
+    struct PendingResponse {
+      bool done = false;
+      int status = 0;
+      std::string body;
+      int attached_fd = -1;
+      ResponseCallback callback;
+    };
+
+    int m_fd;
+    std::atomic<uint64_t> m_next_request_id;
+    std::atomic<uint8_t> m_encoding;
+    std::atomic<Compression> m_compression;
+    std::atomic<size_t> m_compression_threshold;
+    std::atomic<uint64_t> m_max_payload_size;
+
+    /// @brief Serialises the writes of whole frames
+    std::mutex m_write_mutex;
+
+    /// @brief Guards the pending responses and the reader role
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::unordered_map<uint64_t, PendingResponse> m_pending;
+    bool m_reading;
+    bool m_broken;
+
+    /// @brief Number of pending requests with a callback, the I/O thread only reads while there are any
+    size_t m_pending_callbacks;
+    bool m_closing;
+    std::thread m_io_thread;
+};
+
+/**
+ * @brief Writes one frame (header + payload) to a socket.
+ *
+ * @param _attached_fd File descriptor to pass along with the frame, or -1. Unix domain sockets only.
+ * @return false if the connection failed
+ */
+bool write_frame(int _fd, const FrameHeader& _header, const char* _payload, int _attached_fd = -1);
+
+/**
+ * @brief Reads one frame (header + payload) from a socket.
+ *
+ * @param _attached_fd If given, filled with the file descriptor passed along with the frame, or -1
+ * @param _max_payload_size Largest payload size the header may announce
+ * @return false if the connection was closed or the frame is malformed or too large
+ */
+bool read_frame(int _fd, FrameHeader& _header, std::string& _payload, int* _attached_fd = nullptr,
+                uint64_t _max_payload_size = MAX_FRAME_PAYLOAD);
@@ -1,6 +1,10 @@
 #include <nudock/nudock.hpp>
+#include <nudock/nudock_schemas.hpp>
 #include <random>
 
+// The /log_likelihood response generated from its schema, decoded straight from the received message
+NUDOCK_SAX_FIELDS(LogLikelihoodResponse, duration_us, log_likelihood)
+
 void randomize_parameters(nlohmann::json& _request, std::normal_distribution<double>& dist, std::mt19937& gen)
 {
     // Randomize osc_pars
@@ -39,19 +43,30 @@ int main()
     set_pars_request["sys_pars"]["sys1"] = 0.01;
     set_pars_request["sys_pars"]["sys2"] = 0.02;
 
-    // Empty log_likelihood request json
-    nlohmann::json logl_request = "";
+    // Fetch the order of the parameters once, and from then on send arrays of
+    // values instead of objects keyed by parameter name
+    ParameterLayout layout = client.fetch_parameter_layout();
+
+    // Look the endpoints up once, the requests in the loop then skip the request name lookups
+    const EndpointHandle set_parameters = client.endpoint("/set_parameters");
+    const EndpointHandle log_likelihood = client.endpoint("/log_likelihood");
+
+    // Empty log_likelihood request
+    const LogLikelihoodEndpoint::Request logl_request = "";
 
     while (true) {
         // Randomize parameters for each iteration
         randomize_parameters(set_pars_request, dist, gen);
 
         // Send set_parameters request
-        client.send_request("/set_parameters", set_pars_request);
+        SetParametersEndpoint::Response set_pars_response =
+            client.send_request<SetParametersEndpoint::Response>(set_parameters, layout.pack(set_pars_request));
+        if (set_pars_response.status) {
+            std::cout << "Set parameters: " << *set_pars_response.status << std::endl;
+        }
 
         // Send log_likelihood request and print the result
-        nlohmann::json logl_response = client.send_request("/log_likelihood", logl_request);
-        double logl = logl_response["log_likelihood"];
+        double logl = client.send_request<LogLikelihoodEndpoint::Response>(log_likelihood, logl_request).log_likelihood;
         std::cout << "Log-likelihood: " << logl << std::endl;
 
         // Wait for a second before next iteration
@@ -0,0 +1,38 @@
+/**
+ * @file nudock_test.hpp
+ *
+ * @brief Checks shared by the test programs run by ctest.
+ *
+ * A failed CHECK() is reported with its location and the test goes on, so
+ * one run lists every failure. main() returns nudock_test_result().
+ */
+
+#pragma once
+
+#include <iostream>
+
+/// @brief Number of failed checks of the test program
+inline int& nudock_test_failures()
+{
+  static int failures = 0;
+  return failures;
+}
+
+/// @brief Reports the condition with its location if it doesn't hold
+#define CHECK(CONDITION)                                                                        \
+  do {                                                                                          \
+    if (!(CONDITION)) {                                                                         \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #CONDITION << std::endl;   \
+      ++nudock_test_failures();                                                                 \
+    }                                                                                           \
+  } while (false)
+
+/// @brief Exit code of the test program, 0 if all the checks passed
+inline int nudock_test_result()
+{
+  if (nudock_test_failures() > 0) {
+    std::cerr << nudock_test_failures() << " check(s) failed" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include <nudock/nudock.hpp>
+#include <nudock/nudock_schemas.hpp>
 
 nlohmann::json pong(const nlohmann::json& _request) 
 {
@@ -14,46 +15,70 @@ public:
   // Set the osc and sys parameters from the request json
   // This will be used for the fake logl calulation. Will also print the set
   // parameters to stdout
-  nlohmann::json set_parameters(const nlohmann::json& _request)
+  SetParametersEndpoint::Response set_parameters(const nlohmann::json& _request)
   {
-    for (auto& [key, value] : _request["osc_pars"].items()) {
-      if (!value.is_number()) {
-        std::cerr << "Invalid osc_param value for key: " << key << std::endl;
-        throw std::invalid_argument("Invalid osc_param value for key: " + key);
-      }
-      osc_pars_[key] = value.get<double>();
+    // Delta requests must follow the last accepted one, otherwise the client
+    // is told to send all the parameters again
+    if (!sequence_.accept(_request)) {
+      SetParametersEndpoint::Response response;
+      response.status = "sequence gap";
+      response.sequence = sequence_.last();
+      return response;
     }
 
-    for (auto& [key, value] : _request["sys_pars"].items()) {
-      if (!value.is_number()) {
-        std::cerr << "Invalid sys_param value for key: " << key << std::endl;
-        throw std::invalid_argument("Invalid sys_param value for key: " + key);
+    // Delta requests only carry the parameters that changed since the last one
+    const nlohmann::json& parameters = _request.contains("changed") ? _request["changed"] : _request;
+    const nlohmann::json no_parameters = nlohmann::json::object();
+    const nlohmann::json& osc_pars = parameters.contains("osc_pars") ? parameters["osc_pars"] : no_parameters;
+    const nlohmann::json& sys_pars = parameters.contains("sys_pars") ? parameters["sys_pars"] : no_parameters;
+
+    // Clients that fetched the layout from /get_parameter_names send arrays
+    // of values in the layout's order instead of objects keyed by name
+    if (osc_pars.is_array()) {
+      set_positional_parameters(osc_pars, layout_.names("osc_pars"), osc_pars_);
+    } else {
+      for (auto& [key, value] : osc_pars.items()) {
+        if (!value.is_number()) {
+          std::cerr << "Invalid osc_param value for key: " << key << std::endl;
+          throw std::invalid_argument("Invalid osc_param value for key: " + key);
+        }
+        osc_pars_[key] = value.get<double>();
       }
-      sys_pars_[key] = value.get<double>();
     }
 
-    nlohmann::json response;
-    response["status"] = "parameters set";
-    std::cout << "Set osc_pars: ";
-    for (const auto& [key, value] : osc_pars_) {
-      std::cout << key << "=" << value << " ";
-    }
-    std::cout << std::endl;
-    std::cout << "Set sys_pars: ";
-    for (const auto& [key, value] : sys_pars_) {
-      std::cout << key << "=" << value << " ";
+    if (sys_pars.is_array()) {
+      set_positional_parameters(sys_pars, layout_.names("sys_pars"), sys_pars_);
+    } else {
+      for (auto& [key, value] : sys_pars.items()) {
+        if (!value.is_number()) {
+          std::cerr << "Invalid sys_param value for key: " << key << std::endl;
+          throw std::invalid_argument("Invalid sys_param value for key: " + key);
+        }
+        sys_pars_[key] = value.get<double>();
+      }
     }
-    std::cout << std::endl;
-    return response;
+
+    return print_parameters();
+  }
+
+  // Names of the parameters, in the order of the positional /set_parameters requests
+  nlohmann::json get_parameter_names(const nlohmann::json& /*_request*/)
+  {
+    return layout_.names();
+  }
+
+  // Same layout, announced to the clients in /validate_start
+  const ParameterLayout& parameter_layout() const
+  {
+    return layout_;
   }
 
   // Simple fake log-likelihood calculation
   // It will compute a fake log-likelihood based on the internally held parameters
-  nlohmann::json log_likelihood(const nlohmann::json& _request)
+  LogLikelihoodEndpoint::Response log_likelihood(const LogLikelihoodEndpoint::Request& _request)
   {
     // Implementation of log-likelihood calculation using osc_pars_ and sys_pars_
-    nlohmann::json response;
-    response["log_likelihood"] = 0.0; // Placeholder
+    LogLikelihoodEndpoint::Response response;
 
     // Compute fake log-likelihood based on current parameters
     double logl = 0.0;
@@ -69,12 +94,48 @@ public:
     }
 
 
-    response["log_likelihood"] = logl;
+    response.log_likelihood = logl;
 
     return response;
   }
 
   private:
+    // Sets the parameters of a group from an array of values, ordered as in the layout
+    void set_positional_parameters(const nlohmann::json& _values,
+                                   const std::vector<std::string>& _names,
+                                   std::map<std::string, double>& _parameters)
+    {
+      if (_values.size() != _names.size()) {
+        throw std::invalid_argument("Expected " + std::to_string(_names.size()) + " parameter values, got " + std::to_string(_values.size()));
+      }
+      for (size_t i = 0; i < _names.size(); ++i) {
+        if (!_values[i].is_number()) {
+          std::cerr << "Invalid parameter value for: " << _names[i] << std::endl;
+          throw std::invalid_argument("Invalid parameter value for: " + _names[i]);
+        }
+        _parameters[_names[i]] = _values[i].get<double>();
+      }
+    }
+
+    // Prints the set parameters to stdout
+    SetParametersEndpoint::Response print_parameters()
+    {
+      SetParametersEndpoint::Response response;
+      response.status = "parameters set";
+      response.sequence = sequence_.last();
+      std::cout << "Set osc_pars: ";
+      for (const auto& [key, value] : osc_pars_) {
+        std::cout << key << "=" << value << " ";
+      }
+      std::cout << std::endl;
+      std::cout << "Set sys_pars: ";
+      for (const auto& [key, value] : sys_pars_) {
+        std::cout << key << "=" << value << " ";
+      }
+      std::cout << std::endl;
+      return response;
+    }
+
     // Hold the osc parameter name -- value pairs
     std::map<std::string, double> osc_pars_;
 
@@ -90,6 +151,15 @@ public:
       {"Theta23", 0.5},
       {"DeltaCP", 0.0}
     };
+
+    // Sequence numbers of the delta /set_parameters requests
+    ParameterSequence sequence_;
+
+    // Order of the parameters in the positional /set_parameters requests
+    ParameterLayout layout_{nlohmann::json{
+      {"osc_pars", {"Deltam2_32", "Deltam2_21", "Theta23", "Theta13", "Theta12", "DeltaCP"}},
+      {"sys_pars", {"sys1", "sys2"}}
+    }};
 };
 
 int main()
@@ -97,16 +167,23 @@ int main()
   // Example fake experiment class (e.g. SingleSample/Multi Experiment from NOvA, or some SamplePDFSKBase (or class that contains multiple SamplePDFBase etc) from T2K
   Experiment experiment;
 
-  // Create a NuDock instance with debugging enabled and using unix domain sockets.
+  // Create a NuDock instance with debugging enabled, validating every request and
+  // response, and using unix domain sockets.
   // Empty schema location means it will use the default installed location.
-  NuDock dock(true, "", CommunicationType::UNIX_DOMAIN_SOCKET);
+  BasicNuDock<FullValidation> dock(true, "", CommunicationType::UNIX_DOMAIN_SOCKET);
+
+  // Clients get the parameter layout in /validate_start, see the test client
+  dock.set_parameter_layout(experiment.parameter_layout());
 
   // You can bind to a function that's not a member of any class
   dock.register_response("/ping", std::bind(pong, std::placeholders::_1));
 
   // Or bind to member functions of a class instance
-  dock.register_response("/set_parameters", std::bind(&Experiment::set_parameters, &experiment,  std::placeholders::_1));
-  dock.register_response("/log_likelihood", std::bind(&Experiment::log_likelihood, &experiment, std::placeholders::_1));
+  dock.register_response("/get_parameter_names", std::bind(&Experiment::get_parameter_names, &experiment, std::placeholders::_1));
+  // Typed handlers take and return the structs generated from the schemas (nudock_schemas.hpp) instead of json
+  dock.register_response<LogLikelihoodEndpoint>(std::bind(&Experiment::log_likelihood, &experiment, std::placeholders::_1));
+  // The parameters may come as arrays or objects, so the request stays json
+  dock.register_response<nlohmann::json, SetParametersEndpoint::Response>(SetParametersEndpoint::name, std::bind(&Experiment::set_parameters, &experiment, std::placeholders::_1));
   dock.start_server();
   return 0;
 }
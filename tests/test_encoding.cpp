@@ -0,0 +1,137 @@
+#include <nudock/nudock.hpp>
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "nudock_test.hpp"
+
+namespace {
+
+const MessageEncoding ENCODINGS[] = {
+  MessageEncoding::JSON, MessageEncoding::CBOR, MessageEncoding::MSGPACK, MessageEncoding::UBJSON, MessageEncoding::BSON,
+};
+
+// Values each encoding has to carry over exactly, doubles that json text could round off included
+nlohmann::json sample_message()
+{
+  return {
+    {"osc_pars", {{"Deltam2_32", 0.0025}, {"Theta23", 0.1 + 0.2}, {"DeltaCP", -3.141592653589793}}},
+    {"sys_pars", {1e-300, -0.0, 1.7976931348623157e308, 5e-324}},
+    {"sequence", std::numeric_limits<int64_t>::max()},
+    {"offset", std::numeric_limits<int64_t>::min()},
+    {"label", "\xce\xb8\xe2\x82\x82\xe2\x82\x83 \"quoted\"\n"},
+    {"flags", {true, false, nullptr}},
+    {"nested", {{"empty_object", nlohmann::json::object()}, {"empty_array", nlohmann::json::array()}}}
+  };
+}
+
+// Every encoding gives back the message it was given
+void test_encode_decode()
+{
+  for (MessageEncoding encoding : ENCODINGS) {
+    const nlohmann::json message = sample_message();
+    std::string body = encode_message(message, encoding);
+    CHECK(decode_message(body, encoding) == message);
+
+    // A reused buffer gives the same bytes
+    std::string reused = "left over from a larger message, to be replaced";
+    encode_message(message, encoding, reused);
+    CHECK(reused == body);
+  }
+}
+
+// Binary values survive the binary encodings, UBJSON gives back the objects json text has for them
+void test_binary_values()
+{
+  nlohmann::json message = {{"bins", nlohmann::json::binary({1, 2, 3, 255}, 0x80)}};
+  for (MessageEncoding encoding : {MessageEncoding::CBOR, MessageEncoding::MSGPACK, MessageEncoding::BSON}) {
+    CHECK(decode_message(encode_message(message, encoding), encoding) == message);
+  }
+  const nlohmann::json expected = {{"bins", {{"bytes", {1, 2, 3, 255}}, {"subtype", 0x80}}}};
+  CHECK(decode_message(encode_message(message, MessageEncoding::UBJSON), MessageEncoding::UBJSON) == expected);
+}
+
+// Names, content types and header bytes all lead back to the same encoding
+void test_lookups()
+{
+  for (MessageEncoding encoding : ENCODINGS) {
+    MessageEncoding found = MessageEncoding::JSON;
+    CHECK(encoding_from_name(encoding_name(encoding), found) && found == encoding);
+    found = MessageEncoding::JSON;
+    CHECK(encoding_from_content_type(std::string(encoding_content_type(encoding)) + "; charset=utf-8", found) && found == encoding);
+    found = MessageEncoding::JSON;
+    CHECK(encoding_from_byte(static_cast<uint8_t>(encoding), found) && found == encoding);
+  }
+  MessageEncoding found;
+  CHECK(!encoding_from_name("yaml", found));
+  CHECK(!encoding_from_content_type("text/plain", found));
+  CHECK(!encoding_from_byte(200, found));
+}
+
+// Server in a child process, answering /set_parameters with the request it got
+pid_t fork_echo_server(WireProtocol _protocol, int _port)
+{
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  NuDock server(false, "", CommunicationType::UNIX_DOMAIN_SOCKET, _port);
+  server.set_wire_protocol(_protocol);
+  server.register_response("/set_parameters", [](const nlohmann::json& _request) { return nlohmann::json{{"echo", _request}}; });
+  server.start_server();
+  _exit(0);
+}
+
+// The client aborts when there is no server to connect to, so it waits for the socket first
+bool wait_for_socket(const std::string& _path)
+{
+  for (int attempt = 0; attempt < 500; ++attempt) {
+    if (access(_path.c_str(), F_OK) == 0) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+// Each encoding negotiated with the server carries the messages both ways
+void test_negotiated(WireProtocol _protocol, int _port)
+{
+  const std::string path = "/tmp/nudock_" + std::to_string(_port) + ".sock";
+  unlink(path.c_str());
+  pid_t server = fork_echo_server(_protocol, _port);
+  CHECK(wait_for_socket(path));
+  for (MessageEncoding encoding : ENCODINGS) {
+    NuDock client(false, "", CommunicationType::UNIX_DOMAIN_SOCKET, _port);
+    client.set_wire_protocol(_protocol);
+    client.set_encoding(encoding);
+    client.start_client();
+    const nlohmann::json message = sample_message();
+    const nlohmann::json response = client.send_request("/set_parameters", message);
+    CHECK(response == nlohmann::json({{"echo", message}}));
+  }
+  kill(server, SIGTERM);
+  waitpid(server, nullptr, 0);
+  unlink(path.c_str());
+}
+
+} // namespace
+
+int main()
+{
+  test_encode_decode();
+  test_binary_values();
+  test_lookups();
+  const int port = 20000 + getpid() % 10000;
+  test_negotiated(WireProtocol::NUDOCK, port);
+  test_negotiated(WireProtocol::HTTP, port + 1);
+  return nudock_test_result();
+}
@@ -0,0 +1,199 @@
+#include <nudock/nudock_wire.hpp>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nudock_test.hpp"
+
+namespace {
+
+constexpr uint64_t MAX_PAYLOAD = 1024;
+
+// Answers every request with its endpoint id and body
+int echo(uint32_t _endpoint, uint8_t /*_encoding*/, std::string& _body, std::string& _response_body, int& /*_attached_fd*/)
+{
+  _response_body = std::to_string(_endpoint) + ":" + _body;
+  return 200;
+}
+
+std::string frame(uint32_t _endpoint, uint64_t _request_id, const std::string& _body)
+{
+  FrameHeader header;
+  header.endpoint = _endpoint;
+  header.request_id = _request_id;
+  header.payload_size = _body.size();
+  return std::string(reinterpret_cast<const char*>(&header), sizeof(header)) + _body;
+}
+
+// Raw connection to the server, giving up on reads after a few seconds instead of hanging the test
+int connect_raw(const std::string& _path)
+{
+  for (int attempt = 0; attempt < 500; ++attempt) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, _path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+      timeval timeout{5, 0};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      return fd;
+    }
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return -1;
+}
+
+void send_all(int _fd, const std::string& _bytes)
+{
+  size_t sent = 0;
+  while (sent < _bytes.size()) {
+    ssize_t n = send(_fd, _bytes.data() + sent, _bytes.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    sent += static_cast<size_t>(n);
+  }
+}
+
+bool recv_all(int _fd, char* _data, size_t _size)
+{
+  while (_size > 0) {
+    ssize_t n = recv(_fd, _data, _size, 0);
+    if (n <= 0) {
+      return false;
+    }
+    _data += n;
+    _size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Reads one response frame, false if the server closed the connection
+bool read_response(int _fd, FrameHeader& _header, std::string& _body)
+{
+  if (!recv_all(_fd, reinterpret_cast<char*>(&_header), sizeof(_header))) {
+    return false;
+  }
+  _body.resize(_header.payload_size);
+  return recv_all(_fd, &_body[0], _body.size());
+}
+
+// Whether the server closed the connection, rather than leaving it open or answering.
+// Closed with the rest of the frame still unread, the connection is reset instead.
+bool closed_by_server(int _fd)
+{
+  char byte;
+  const ssize_t n = recv(_fd, &byte, 1, 0);
+  return n == 0 || (n < 0 && errno == ECONNRESET);
+}
+
+// A frame trickling in piece by piece, header included, is answered once complete
+void test_partial_frame(const std::string& _path)
+{
+  int fd = connect_raw(_path);
+  CHECK(fd >= 0);
+  const std::string bytes = frame(5, 42, "hello, partial frame");
+  const size_t cuts[] = {0, 3, 17, sizeof(FrameHeader), sizeof(FrameHeader) + 6, bytes.size()};
+  for (size_t i = 0; i + 1 < sizeof(cuts) / sizeof(cuts[0]); ++i) {
+    send_all(fd, bytes.substr(cuts[i], cuts[i + 1] - cuts[i]));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  FrameHeader header;
+  std::string body;
+  CHECK(read_response(fd, header, body));
+  CHECK(header.magic == FRAME_MAGIC);
+  CHECK(header.status == 200);
+  CHECK(header.request_id == 42);
+  CHECK(body == "5:hello, partial frame");
+  close(fd);
+}
+
+// Several frames in one write, the last one cut short, are answered as they complete
+void test_coalesced_frames(const std::string& _path)
+{
+  int fd = connect_raw(_path);
+  CHECK(fd >= 0);
+  const std::string last = frame(3, 3, "third");
+  send_all(fd, frame(1, 1, "first") + frame(2, 2, "") + last.substr(0, sizeof(FrameHeader) + 2));
+  FrameHeader header;
+  std::string body;
+  CHECK(read_response(fd, header, body));
+  CHECK(header.request_id == 1 && body == "1:first");
+  CHECK(read_response(fd, header, body));
+  CHECK(header.request_id == 2 && body == "2:");
+  send_all(fd, last.substr(sizeof(FrameHeader) + 2));
+  CHECK(read_response(fd, header, body));
+  CHECK(header.request_id == 3 && body == "3:third");
+  close(fd);
+}
+
+// Frames announcing more than the maximum payload, or not NuDock frames at all, close the connection
+void test_rejected_frames(const std::string& _path)
+{
+  int fd = connect_raw(_path);
+  CHECK(fd >= 0);
+  FrameHeader header;
+  header.endpoint = 1;
+  header.payload_size = MAX_PAYLOAD + 1;
+  // Only the header is sent, nothing is allocated nor waited for
+  send_all(fd, std::string(reinterpret_cast<const char*>(&header), sizeof(header)));
+  CHECK(closed_by_server(fd));
+  close(fd);
+
+  fd = connect_raw(_path);
+  CHECK(fd >= 0);
+  std::string bytes = frame(1, 1, "body");
+  bytes[0] ^= 0xff;
+  send_all(fd, bytes);
+  CHECK(closed_by_server(fd));
+  close(fd);
+
+  // The other connections are still served
+  fd = connect_raw(_path);
+  CHECK(fd >= 0);
+  send_all(fd, frame(1, 7, std::string(MAX_PAYLOAD, 'x')));
+  std::string body;
+  CHECK(read_response(fd, header, body));
+  CHECK(header.request_id == 7 && body == "1:" + std::string(MAX_PAYLOAD, 'x'));
+  close(fd);
+}
+
+// The client gives up on a response announcing more than its maximum payload
+void test_oversized_response(const std::string& _path)
+{
+  auto client = FramedClient::connect_unix(_path);
+  client->set_max_payload_size(16);
+  std::string response;
+  CHECK(client->call(1, "short", response) == 200);
+  CHECK(response == "1:short");
+  CHECK(client->call(1, std::string(100, 'x'), response) == 0);
+}
+
+} // namespace
+
+int main()
+{
+  const std::string path = "/tmp/nudock_test_frames_" + std::to_string(getpid()) + ".sock";
+  FramedServer server(echo);
+  server.set_max_payload_size(MAX_PAYLOAD);
+  std::thread server_thread([&]() { server.listen_unix(path); });
+
+  test_partial_frame(path);
+  test_coalesced_frames(path);
+  test_rejected_frames(path);
+  test_oversized_response(path);
+
+  server.stop();
+  server_thread.join();
+  unlink(path.c_str());
+  return nudock_test_result();
+}
@@ -0,0 +1,123 @@
+#include <nudock/nudock.hpp>
+#include <nudock/nudock_schemas.hpp>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "nudock_test.hpp"
+
+namespace {
+
+// Fake experiment, the log-likelihood is the sum of the parameters it was given
+class Experiment
+{
+  public:
+    nlohmann::json set_parameters(const nlohmann::json& _request)
+    {
+      m_logl = 0.0;
+      for (const auto& group : {"osc_pars", "sys_pars"}) {
+        for (const auto& value : _request.value(group, nlohmann::json::object())) {
+          m_logl += value.get<double>();
+        }
+      }
+      return {{"status", "parameters set"}};
+    }
+
+    LogLikelihoodEndpoint::Response log_likelihood(const LogLikelihoodEndpoint::Request& /*_request*/)
+    {
+      LogLikelihoodEndpoint::Response response;
+      response.log_likelihood = m_logl;
+      return response;
+    }
+
+  private:
+    double m_logl = 0.0;
+};
+
+void register_experiment(NuDockBase& _dock, Experiment& _experiment)
+{
+  _dock.register_response("/set_parameters", [&_experiment](const nlohmann::json& _request) { return _experiment.set_parameters(_request); });
+  _dock.register_response<LogLikelihoodEndpoint>([&_experiment](const LogLikelihoodEndpoint::Request& _request) { return _experiment.log_likelihood(_request); });
+}
+
+const nlohmann::json PARAMETERS = {
+  {"osc_pars", {{"Deltam2_32", 0.0025}, {"Deltam2_21", 0.000075}, {"Theta23", 0.5}, {"Theta13", 0.15}, {"Theta12", 0.55}, {"DeltaCP", 1.0}}},
+  {"sys_pars", {{"sys1", 0.25}, {"sys2", -0.5}}}
+};
+const double EXPECTED_LOGL = 0.0025 + 0.000075 + 0.5 + 0.15 + 0.55 + 1.0 + 0.25 - 0.5;
+
+// The handlers get the client's messages and the client their responses, validated on the way
+void test_round_trip()
+{
+  Experiment experiment;
+  BasicNuDock<FullValidation> server(false, "", CommunicationType::IN_PROCESS, 4711);
+  register_experiment(server, experiment);
+  server.start_server();
+
+  NuDock client(false, "", CommunicationType::IN_PROCESS, 4711);
+  client.start_client();
+
+  const nlohmann::json request = PARAMETERS;
+  nlohmann::json response = client.send_request("/set_parameters", request);
+  CHECK(response == nlohmann::json({{"status", "parameters set"}}));
+  CHECK(request == PARAMETERS);
+
+  const EndpointHandle log_likelihood = client.endpoint("/log_likelihood");
+  response = client.send_request(log_likelihood, "");
+  CHECK(response.is_object() && response["log_likelihood"].get<double>() == EXPECTED_LOGL);
+
+  // Typed, decoded from the response value, and asynchronous requests take the same path
+  CHECK(client.send_request<LogLikelihoodEndpoint>("").log_likelihood == EXPECTED_LOGL);
+  std::future<nlohmann::json> future = client.send_request_async("/log_likelihood", "");
+  CHECK(future.get()["log_likelihood"].get<double>() == EXPECTED_LOGL);
+
+  const ValidationCounters counters = server.validation_counters("/log_likelihood");
+  CHECK(counters.validated == 3);
+  CHECK(counters.failed == 0);
+}
+
+// With AsyncValidation the client gets its response while the validation thread still checks it
+void test_async_validation()
+{
+  Experiment experiment;
+  BasicNuDock<AsyncValidation> server(false, "", CommunicationType::IN_PROCESS, 4712);
+  register_experiment(server, experiment);
+  server.register_response("/ping", [](const nlohmann::json&) { return nlohmann::json(42); });
+  server.set_validation_failure_hook([](const std::string&, const std::string&) { return false; });
+  server.start_server();
+
+  NuDock client(false, "", CommunicationType::IN_PROCESS, 4712);
+  client.start_client();
+
+  client.send_request("/set_parameters", PARAMETERS);
+  const int requests = 100;
+  for (int i = 0; i < requests; ++i) {
+    CHECK(client.send_request("/log_likelihood", "")["log_likelihood"].get<double>() == EXPECTED_LOGL);
+  }
+  // Against its schema, but answered as it is
+  CHECK(client.send_request("/ping", "ping") == nlohmann::json(42));
+
+  ValidationCounters logl;
+  ValidationCounters ping;
+  for (int wait = 0; wait < 500; ++wait) {
+    logl = server.validation_counters("/log_likelihood");
+    ping = server.validation_counters("/ping");
+    if (logl.validated + logl.skipped + logl.failed == requests && ping.failed == 1) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  CHECK(logl.validated + logl.skipped == requests);
+  CHECK(logl.failed == 0);
+  CHECK(ping.failed == 1);
+}
+
+} // namespace
+
+int main()
+{
+  test_round_trip();
+  test_async_validation();
+  return nudock_test_result();
+}
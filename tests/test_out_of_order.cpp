@@ -0,0 +1,116 @@
+#include <nudock/nudock_wire.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "nudock_test.hpp"
+
+namespace {
+
+// Answers after the number of milliseconds given in the body, so later requests can finish first
+int delayed_echo(uint32_t _endpoint, uint8_t /*_encoding*/, std::string& _body, std::string& _response_body, int& /*_attached_fd*/)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(_body)));
+  _response_body = std::to_string(_endpoint) + ":" + _body;
+  return 200;
+}
+
+std::unique_ptr<FramedClient> connect_when_ready(const std::string& _path)
+{
+  for (int attempt = 0; attempt < 500; ++attempt) {
+    try {
+      return FramedClient::connect_unix(_path);
+    }
+    catch (const std::runtime_error&) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  return nullptr;
+}
+
+// Responses completed out of order are matched to their requests by wait()
+void test_wait(FramedClient& _client)
+{
+  const std::vector<std::string> delays = {"200", "150", "100", "50", "0"};
+  std::vector<uint64_t> ids;
+  for (size_t i = 0; i < delays.size(); ++i) {
+    ids.push_back(_client.submit(static_cast<uint32_t>(i + 1), delays[i]));
+  }
+  std::string response;
+  for (size_t i = 0; i < delays.size(); ++i) {
+    CHECK(_client.wait(ids[i], response) == 200);
+    CHECK(response == std::to_string(i + 1) + ":" + delays[i]);
+  }
+}
+
+// Callbacks run in the order the responses arrive, each with its own response
+void test_callbacks(FramedClient& _client)
+{
+  const std::vector<std::string> delays = {"200", "150", "100", "50"};
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::string> arrived;
+  for (size_t i = 0; i < delays.size(); ++i) {
+    const std::string expected = std::to_string(i + 1) + ":" + delays[i];
+    _client.submit(static_cast<uint32_t>(i + 1), delays[i], [&, expected](int _status, std::string& _response_body, int) {
+      CHECK(_status == 200);
+      CHECK(_response_body == expected);
+      std::lock_guard<std::mutex> lock(mutex);
+      arrived.push_back(_response_body);
+      cv.notify_one();
+    });
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  CHECK(cv.wait_for(lock, std::chrono::seconds(10), [&]() { return arrived.size() == delays.size(); }));
+  CHECK(arrived == std::vector<std::string>({"4:50", "3:100", "2:150", "1:200"}));
+}
+
+// Threads sharing the connection each get their own responses back
+void test_threads(FramedClient& _client)
+{
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&_client, t]() {
+      std::string response;
+      for (int i = 0; i < 20; ++i) {
+        const std::string delay = std::to_string((t * 7 + i * 3) % 5);
+        const uint32_t endpoint = static_cast<uint32_t>(t * 100 + i);
+        CHECK(_client.call(endpoint, delay, response) == 200);
+        CHECK(response == std::to_string(endpoint) + ":" + delay);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+} // namespace
+
+int main()
+{
+  const std::string path = "/tmp/nudock_test_out_of_order_" + std::to_string(getpid()) + ".sock";
+  FramedServer server(delayed_echo, nullptr, 8);
+  std::thread server_thread([&]() { server.listen_unix(path); });
+
+  {
+    auto client = connect_when_ready(path);
+    CHECK(client != nullptr);
+    if (client) {
+      test_wait(*client);
+      test_callbacks(*client);
+      test_threads(*client);
+    }
+  }
+
+  server.stop();
+  server_thread.join();
+  unlink(path.c_str());
+  return nudock_test_result();
+}
@@ -0,0 +1,130 @@
+#include <nudock/nudock_config.hpp>
+#include <nudock/nudock_schema.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "nudock_test.hpp"
+
+namespace {
+
+// Keywords CompiledSchema supports, each with instances on both sides of it: [schema, [[instance, valid], ...]]
+const nlohmann::json KEYWORD_CORPUS = nlohmann::json::parse(R"([
+  [{"type": "number"}, [[1, true], [1.5, true], ["1", false], [null, false], [[1], false]]],
+  [{"type": "integer"}, [[1, true], [-3, true], [2.0, true], [2.5, false], [true, false]]],
+  [{"type": ["string", "null"]}, [["a", true], [null, true], [0, false], [{}, false]]],
+  [{"type": "boolean"}, [[false, true], [0, false]]],
+  [true, [[1, true], [{}, true]]],
+  [{"minimum": 0, "maximum": 10}, [[0, true], [10, true], [-0.5, false], [10.5, false], ["11", true]]],
+  [{"exclusiveMinimum": 0, "exclusiveMaximum": 10}, [[0, false], [0.5, true], [9.5, true], [10, false]]],
+  [{"minLength": 2, "maxLength": 3}, [["a", false], ["ab", true], ["abc", true], ["abcd", false], ["θθ", true], [5, true]]],
+  [{"pattern": "^[a-z]+$"}, [["abc", true], ["aBc", false], ["", false]]],
+  [{"pattern": "b+"}, [["abba", true], ["aca", false]]],
+  [{"pattern": "^[a-zA-Z0-9_]*$"}, [["", true], ["x_1", true], ["x-1", false]]],
+  [{"enum": [1, "one", null, [1]]}, [[1, true], [1.0, true], ["one", true], [null, true], [[1], true], [2, false], ["ONE", false]]],
+  [{"const": {"a": 1}}, [[{"a": 1}, true], [{"a": 2}, false], [{"a": 1, "b": 1}, false]]],
+  [{"items": {"type": "number"}, "minItems": 1, "maxItems": 2}, [[[1], true], [[1, 2], true], [[], false], [[1, 2, 3], false], [["a"], false], [{}, true]]],
+  [{"type": "object", "properties": {"a": {"type": "number"}, "b": {"type": "string"}}, "required": ["a"]},
+   [[{"a": 1}, true], [{"a": 1, "b": "x"}, true], [{"b": "x"}, false], [{"a": "x"}, false], [{"a": 1, "c": null}, true]]],
+  [{"properties": {"a": true, "b": false}}, [[{"a": 1}, true], [{"b": 1}, false], [{}, true]]],
+  [{"properties": {"a": {}}, "additionalProperties": false}, [[{"a": 1}, true], [{"a": 1, "b": 2}, false], [{}, true]]],
+  [{"properties": {"a": {}}, "additionalProperties": {"type": "number"}}, [[{"a": "x", "b": 2}, true], [{"b": "x"}, false]]],
+  [{"properties": {"a": {}}, "required": ["a", "b"], "additionalProperties": false}, [[{"a": 1}, false], [{"a": 1, "b": 2}, false]]],
+  [{"properties": {"a": {}}, "required": ["b"], "additionalProperties": {"type": "number"}}, [[{"b": 2}, true], [{"b": "x"}, false], [{"a": "x"}, false]]],
+  [{"required": ["a"], "additionalProperties": {"type": "string"}}, [[{"a": "x"}, true], [{"a": 1}, false], [{}, false]]],
+  [{"patternProperties": {"^[a-zA-Z0-9_]+$": {"type": "number"}}, "additionalProperties": false},
+   [[{"sys1": 1}, true], [{"sys1": "x"}, false], [{"sys-1": 1}, false], [{}, true]]],
+  [{"properties": {"x_1": {"type": "string"}}, "patternProperties": {"^x": {"minLength": 2}}}, [[{"x_1": "ab"}, true], [{"x_1": "a"}, false], [{"x_1": 12}, false]]],
+  [{"anyOf": [{"type": "string"}, {"minimum": 5}]}, [["a", true], [6, true], [4, false]]],
+  [{"allOf": [{"minimum": 1}, {"maximum": 3}]}, [[2, true], [0, false], [4, false]]],
+  [{"oneOf": [{"type": "integer"}, {"minimum": 2}]}, [[1, true], [2.5, true], [3, false], [1.5, false]]],
+  [{"not": {"type": "string"}}, [[1, true], ["a", false]]],
+  [{"definitions": {"n": {"type": "number"}}, "properties": {"x": {"$ref": "#/definitions/n"}}}, [[{"x": 1}, true], [{"x": "a"}, false]]]
+])");
+
+// Messages like the ones the endpoints exchange, valid and not
+const nlohmann::json MESSAGES = nlohmann::json::parse(R"([
+  null, 42, 1.5, "ping", [], {}, [1, 2, 3, 4, 5, 6],
+  {"osc_pars": {"Deltam2_32": 0.0025, "Deltam2_21": 7.5e-5, "Theta23": 0.5, "Theta13": 0.15, "Theta12": 0.55, "DeltaCP": 1.0}, "sys_pars": {"sys1": 0.1}},
+  {"osc_pars": {"Deltam2_32": 0.0025, "Deltam2_21": 7.5e-5, "Theta23": 0.5, "Theta13": 0.15, "Theta12": 0.55, "DeltaCP": 1.0, "Extra": 0}},
+  {"osc_pars": {"Deltam2_32": 0.0025, "Theta23": 0.5}},
+  {"osc_pars": [0.0025, 7.5e-5, 0.5, 0.15, 0.55, 1.0], "sys_pars": [0.1, 0.2]},
+  {"osc_pars": [0.0025, 7.5e-5, 0.5, 0.15, 0.55]},
+  {"sys_pars": {"sys-1": 0.1}},
+  {"sys_pars": {"sys1": "high"}},
+  {"sequence": 3}, {"sequence": -1}, {"sequence": 2.5},
+  {"changed": {"osc_pars": {"Theta23": 0.5}, "sys_pars": {"sys1": 0.1}}},
+  {"changed": {"osc_pars": {"Theta": 0.5}}},
+  {"log_likelihood": 1.5}, {"log_likelihood": "1.5"}, {"log_likelihood": 1.5, "duration_us": 3},
+  {"status": "parameters set", "sequence": 1, "duration_us": 2.5}, {"status": 1},
+  {"osc_pars": ["Theta23", "DeltaCP"], "sys_pars": ["sys1"]}, {"osc_pars": [1]}
+])");
+
+bool compiled_verdict(const CompiledSchema& _schema, const nlohmann::json& _instance)
+{
+  nlohmann::json_schema::basic_error_handler errors;
+  _schema.validate(_instance, errors);
+  return !errors;
+}
+
+bool validator_verdict(const nlohmann::json_schema::json_validator& _validator, const nlohmann::json& _instance)
+{
+  nlohmann::json_schema::basic_error_handler errors;
+  _validator.validate(_instance, errors);
+  return !errors;
+}
+
+// Both validators take the same side on every instance, the one the corpus expects if it gives one
+void check_same_verdicts(const nlohmann::json& _schema, const nlohmann::json& _instances, bool _expected_given)
+{
+  const CompiledSchema compiled(_schema);
+  nlohmann::json_schema::json_validator validator;
+  validator.set_root_schema(_schema);
+  for (const auto& entry : _instances) {
+    const nlohmann::json& instance = _expected_given ? entry[0] : entry;
+    const bool verdict = compiled_verdict(compiled, instance);
+    if (verdict != validator_verdict(validator, instance) || (_expected_given && verdict != entry[1].get<bool>())) {
+      std::cerr << "schema " << _schema.dump() << ": instance " << instance.dump() << " is " << (verdict ? "valid" : "invalid") << " when compiled" << std::endl;
+      CHECK(false);
+    }
+  }
+}
+
+void test_keywords()
+{
+  for (const auto& entry : KEYWORD_CORPUS) {
+    check_same_verdicts(entry[0], entry[1], true);
+  }
+  // The corpus goes through the compiled path, "$ref" aside
+  CHECK(CompiledSchema(KEYWORD_CORPUS.front()[0]).compiled());
+  CHECK(!CompiledSchema(KEYWORD_CORPUS.back()[0]).compiled());
+}
+
+void test_schema_files()
+{
+  int files = 0;
+  for (const auto& file : std::filesystem::directory_iterator(NUDOCK_SCHEMAS_DIR)) {
+    const std::string path = file.path().string();
+    if (path.size() < 12 || path.compare(path.size() - 12, 12, ".schema.json") != 0) {
+      continue;
+    }
+    std::ifstream stream(path);
+    const nlohmann::json schema = nlohmann::json::parse(stream);
+    for (const char* part : {"request", "response"}) {
+      check_same_verdicts(schema["properties"][part], MESSAGES, false);
+    }
+    ++files;
+  }
+  CHECK(files > 0);
+}
+
+} // namespace
+
+int main()
+{
+  test_keywords();
+  test_schema_files();
+  return nudock_test_result();
+}
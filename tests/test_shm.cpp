@@ -0,0 +1,185 @@
+#include <nudock/nudock_shm.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "nudock_test.hpp"
+
+namespace {
+
+std::string region_name(const std::string& _test)
+{
+  return "/nudock_test_" + _test + "_" + std::to_string(getpid());
+}
+
+// Answers every request with its name and body, until _running is cleared
+void serve_echo(SharedMemoryChannel& _channel, const std::atomic<bool>& _running)
+{
+  std::string name;
+  std::string body;
+  while (_channel.receive_request(name, body, _running)) {
+    _channel.send_response(200, name + ":" + body);
+  }
+}
+
+// Attaches once the server has (re)created the region
+std::unique_ptr<SharedMemoryChannel> attach_when_ready(const std::string& _name)
+{
+  for (int attempt = 0; attempt < 500; ++attempt) {
+    try {
+      return SharedMemoryChannel::attach(_name);
+    }
+    catch (const std::runtime_error&) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  return nullptr;
+}
+
+// Server in a child process: echoes the requests, leaves "/hang" unanswered and exits on "/quit"
+pid_t fork_server(const std::string& _name)
+{
+  pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+  auto channel = SharedMemoryChannel::create(_name, 4096);
+  std::atomic<bool> running{true};
+  std::string name;
+  std::string body;
+  while (channel->receive_request(name, body, running)) {
+    if (name == "/hang") {
+      pause();
+    }
+    channel->send_response(200, name + ":" + body);
+    if (name == "/quit") {
+      break;
+    }
+  }
+  channel.reset();
+  _exit(0);
+}
+
+// Messages of sizes not dividing the ring, some larger than it, wrap around at every offset
+void test_wrap_around()
+{
+  const std::string name = region_name("wrap");
+  auto server = SharedMemoryChannel::create(name, 1024);
+  std::atomic<bool> running{true};
+  std::thread server_thread([&]() { serve_echo(*server, running); });
+  {
+    auto client = SharedMemoryChannel::attach(name);
+    std::string response;
+    for (int i = 0; i < 200; ++i) {
+      std::string body((i * 37) % 3000, '\0');
+      for (size_t j = 0; j < body.size(); ++j) {
+        body[j] = static_cast<char>('a' + (i + j) % 26);
+      }
+      client->send_request("/echo", body);
+      CHECK(client->receive_response(response) == 200);
+      CHECK(response == "/echo:" + body);
+    }
+  }
+  running = false;
+  server_thread.join();
+}
+
+// A client that went away without reading its response doesn't leave it to the next one
+void test_client_dies()
+{
+  const std::string name = region_name("client");
+  auto server = SharedMemoryChannel::create(name, 4096);
+
+  // Forked before the server thread exists, the child only attaches and sends
+  pid_t child = fork();
+  if (child == 0) {
+    auto client = SharedMemoryChannel::attach(name);
+    client->send_request("/echo", "stale");
+    _exit(0);
+  }
+
+  std::atomic<bool> running{true};
+  std::thread server_thread([&]() { serve_echo(*server, running); });
+  int status = 0;
+  CHECK(waitpid(child, &status, 0) == child);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  {
+    auto client = attach_when_ready(name);
+    CHECK(client != nullptr);
+    if (client) {
+      std::string response;
+      client->send_request("/echo", "fresh");
+      CHECK(client->receive_response(response) == 200);
+      CHECK(response == "/echo:fresh");
+    }
+  }
+  running = false;
+  server_thread.join();
+}
+
+// A client waiting on a server that died gets an error, and reconnects once it is back
+void test_server_dies()
+{
+  const std::string name = region_name("server");
+  pid_t server = fork_server(name);
+  std::string response;
+  {
+    auto client = attach_when_ready(name);
+    CHECK(client != nullptr);
+    if (!client) {
+      kill(server, SIGKILL);
+      waitpid(server, nullptr, 0);
+      return;
+    }
+    client->send_request("/echo", "one");
+    CHECK(client->receive_response(response) == 200);
+    CHECK(response == "/echo:one");
+
+    client->send_request("/hang", "");
+    kill(server, SIGKILL);
+    CHECK(waitpid(server, nullptr, 0) == server);
+    bool failed = false;
+    try {
+      client->receive_response(response);
+    }
+    catch (const std::runtime_error&) {
+      failed = true;
+    }
+    CHECK(failed);
+  }
+
+  server = fork_server(name);
+  auto client = attach_when_ready(name);
+  CHECK(client != nullptr);
+  if (client) {
+    client->send_request("/echo", "two");
+    CHECK(client->receive_response(response) == 200);
+    CHECK(response == "/echo:two");
+    client->send_request("/quit", "");
+    CHECK(client->receive_response(response) == 200);
+  }
+  else {
+    kill(server, SIGKILL);
+  }
+  int status = 0;
+  CHECK(waitpid(server, &status, 0) == server);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+} // namespace
+
+int main()
+{
+  test_client_dies();
+  test_server_dies();
+  test_wrap_around();
+  return nudock_test_result();
+}